@@ -0,0 +1,107 @@
+#ifndef _ARENA_HPP_
+#define _ARENA_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+// bump allocator for objects that share one owner and die together. memory
+// is handed out from chunks and only given back when the arena is released,
+// destructors of the objects have to be run by the owner.
+class Arena {
+ public:
+  explicit Arena(size_t chunk_size = 512)
+      : head_(nullptr),
+        ptr_(nullptr),
+        end_(nullptr),
+        chunk_size_(chunk_size),
+        memory_usage_(0) {}
+  ~Arena() { Release(); }
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // make sure the next bytes of allocations fit in a single chunk
+  void Reserve(size_t bytes) {
+    if (static_cast<size_t>(end_ - ptr_) < bytes + kAlign) {
+      NewChunk(bytes + kAlign);
+    }
+  }
+
+  void *Allocate(size_t size, size_t align = kAlign) {
+    char *p = Align(ptr_, align);
+    if (p == nullptr || p + size > end_) {
+      size_t grown = chunk_size_;
+      chunk_size_ = chunk_size_ < kMaxChunkSize ? 2 * chunk_size_ : chunk_size_;
+      NewChunk(size + align > grown ? size + align : grown);
+      p = Align(ptr_, align);
+    }
+    ptr_ = p + size;
+    return p;
+  }
+
+  template <typename T, typename... Args>
+  T *New(Args &&...args) {
+    return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  bool Owns(const void *ptr) const {
+    const char *p = static_cast<const char *>(ptr);
+    for (Chunk *chunk = head_; chunk != nullptr; chunk = chunk->next) {
+      const char *begin = reinterpret_cast<const char *>(chunk + 1);
+      if (p >= begin && p < begin + chunk->capacity) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // bytes of all chunks
+  size_t MemoryUsage() const { return memory_usage_; }
+
+  // free all chunks at once
+  void Release() {
+    while (head_ != nullptr) {
+      Chunk *next = head_->next;
+      free(head_);
+      head_ = next;
+    }
+    ptr_ = end_ = nullptr;
+    memory_usage_ = 0;
+  }
+
+ private:
+  struct alignas(alignof(std::max_align_t)) Chunk {
+    Chunk *next;
+    size_t capacity;
+  };
+  static constexpr size_t kAlign = alignof(std::max_align_t);
+  static constexpr size_t kMaxChunkSize = 64 * 1024;
+
+  static char *Align(char *p, size_t align) {
+    if (p == nullptr) return nullptr;
+    uintptr_t v = reinterpret_cast<uintptr_t>(p);
+    return reinterpret_cast<char *>((v + align - 1) & ~(uintptr_t)(align - 1));
+  }
+
+  void NewChunk(size_t capacity) {
+    Chunk *chunk = static_cast<Chunk *>(malloc(sizeof(Chunk) + capacity));
+    if (chunk == nullptr) throw std::bad_alloc();
+    chunk->next = head_;
+    chunk->capacity = capacity;
+    head_ = chunk;
+    memory_usage_ += sizeof(Chunk) + capacity;
+    ptr_ = reinterpret_cast<char *>(chunk + 1);
+    end_ = ptr_ + capacity;
+  }
+
+  Chunk *head_;
+  char *ptr_;  // next free byte of the current chunk
+  char *end_;
+  size_t chunk_size_;  // size of the next chunk that is not reserved
+  size_t memory_usage_;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef _CODEC_HPP_
+#define _CODEC_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// block codecs of VDLS. a codec is only available if the library it uses is
+// built in with LETUS_WITH_LZ4, LETUS_WITH_ZSTD or LETUS_WITH_ZLIB, which only
+// src/Codec.cpp sees.
+enum class CompressionCodec : uint32_t {
+  kNone = 0,
+  kLz4 = 1,
+  kZstd = 2,
+  kZlib = 3,
+};
+
+bool CodecAvailable(CompressionCodec codec);
+
+// compress size bytes of data into out, which is resized to the result
+void Compress(CompressionCodec codec, const char *data, size_t size,
+              std::string &out);
+
+// decompress size bytes of data into the raw_size bytes at out
+void Decompress(CompressionCodec codec, const char *data, size_t size,
+                char *out, size_t raw_size);
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef _CRC32C_HPP_
+#define _CRC32C_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// the crc32 instructions of SSE4.2 are used if the cpu has them, those of
+// ARMv8 if the build targets them
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define LETUS_CRC32C_SSE42
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define LETUS_CRC32C_ARMV8
+#endif
+
+// CRC-32C (Castagnoli polynomial) used to checksum the records of VDLS and
+// the pages and blocks of LSVPS
+inline const std::array<uint32_t, 256> &Crc32cTable() {
+  static const std::array<uint32_t, 256> table = []() {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int k = 0; k < 8; k++) {
+        crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+      }
+      t[i] = crc;
+    }
+    return t;
+  }();
+  return table;
+}
+
+inline uint32_t Crc32cExtendTable(uint32_t crc, const char *data,
+                                  size_t size) {
+  const std::array<uint32_t, 256> &table = Crc32cTable();
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+#if defined(LETUS_CRC32C_SSE42)
+__attribute__((target("sse4.2"))) inline uint32_t Crc32cExtendHardware(
+    uint32_t crc, const char *data, size_t size) {
+  uint64_t c = ~crc;
+  for (; size >= 8; size -= 8, data += 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    c = _mm_crc32_u64(c, word);
+  }
+  uint32_t c32 = static_cast<uint32_t>(c);
+  for (; size > 0; size--, data++) {
+    c32 = _mm_crc32_u8(c32, static_cast<unsigned char>(*data));
+  }
+  return ~c32;
+}
+
+inline bool Crc32cHardwareAvailable() {
+  static const bool available = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2") != 0;
+  }();
+  return available;
+}
+#elif defined(LETUS_CRC32C_ARMV8)
+inline uint32_t Crc32cExtendHardware(uint32_t crc, const char *data,
+                                     size_t size) {
+  crc = ~crc;
+  for (; size >= 8; size -= 8, data += 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc = __crc32cd(crc, word);
+  }
+  for (; size > 0; size--, data++) {
+    crc = __crc32cb(crc, static_cast<uint8_t>(*data));
+  }
+  return ~crc;
+}
+
+inline bool Crc32cHardwareAvailable() { return true; }
+#else
+inline bool Crc32cHardwareAvailable() { return false; }
+#endif
+
+// continue the checksum crc of the preceding bytes over data
+inline uint32_t Crc32cExtend(uint32_t crc, const char *data, size_t size) {
+#if defined(LETUS_CRC32C_SSE42) || defined(LETUS_CRC32C_ARMV8)
+  if (Crc32cHardwareAvailable()) {
+    return Crc32cExtendHardware(crc, data, size);
+  }
+#endif
+  return Crc32cExtendTable(crc, data, size);
+}
+
+inline uint32_t Crc32c(const char *data, size_t size) {
+  return Crc32cExtend(0, data, size);
+}
+
+// when the checksums of what is read from disk are checked: on every read,
+// on one read out of a sample rate, or only by explicit verification (scrub)
+enum class ChecksumVerify : uint32_t {
+  kAlways = 0,
+  kSampled = 1,
+  kScrub = 2,
+};
+
+// picks the reads whose checksums are checked, shared by reader threads
+class ChecksumPolicy {
+ public:
+  static constexpr uint32_t kDefaultSampleRate = 16;
+
+  void Set(ChecksumVerify mode, uint32_t sample_rate) {
+    sample_rate_.store(sample_rate == 0 ? 1 : sample_rate,
+                       std::memory_order_relaxed);
+    mode_.store(mode, std::memory_order_relaxed);
+  }
+
+  ChecksumVerify GetMode() const {
+    return mode_.load(std::memory_order_relaxed);
+  }
+
+  // every read of the calling thread checks its checksum while a scrub holds
+  // a ScrubScope, whatever the mode
+  class ScrubScope {
+   public:
+    ScrubScope() : outer_(Scrubbing()) { Scrubbing() = true; }
+    ~ScrubScope() { Scrubbing() = outer_; }
+    ScrubScope(const ScrubScope &) = delete;
+    ScrubScope &operator=(const ScrubScope &) = delete;
+
+   private:
+    bool outer_;
+  };
+
+  // whether the next read checks its checksum
+  bool ShouldVerify() {
+    if (Scrubbing()) {
+      return true;
+    }
+    switch (mode_.load(std::memory_order_relaxed)) {
+      case ChecksumVerify::kAlways:
+        return true;
+      case ChecksumVerify::kSampled:
+        return reads_.fetch_add(1, std::memory_order_relaxed) %
+                   sample_rate_.load(std::memory_order_relaxed) ==
+               0;
+      default:
+        return false;
+    }
+  }
+
+ private:
+  static bool &Scrubbing() {
+    static thread_local bool scrubbing = false;
+    return scrubbing;
+  }
+
+  std::atomic<ChecksumVerify> mode_{ChecksumVerify::kSampled};
+  std::atomic<uint32_t> sample_rate_{kDefaultSampleRate};
+  std::atomic<uint64_t> reads_{0};
+};
+
+#endif
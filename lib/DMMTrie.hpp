@@ -2,19 +2,30 @@
 #define _DMMTRIE_HPP_
 
 #include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <iostream>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
 
+#include "Arena.hpp"
+#include "Hash.hpp"
+#include "PageCache.hpp"
+#include "ThreadPool.hpp"
 #include "VDLS.hpp"
+#include "WorkStealingPool.hpp"
 #include "common.hpp"
 
-static constexpr size_t HASH_SIZE = 32;
 static constexpr size_t DMM_NODE_FANOUT = 16;
 static constexpr uint16_t Td_ = 128;  // update threshold of DeltaPage
 static constexpr uint16_t Tb_ = 256;  // update threshold of BasePage
@@ -23,9 +34,12 @@ using namespace std;
 
 class LSVPS;
 class DMMTrie;
+class DMMTrieIterator;
+class DMMTrieScrubber;
 class DeltaPage;
 
 string HashFunction(const string &input);
+string HashFunction(const char *input, size_t size);
 
 struct NodeProof {
   int level;
@@ -59,6 +73,8 @@ class Node {
   virtual uint64_t GetChildVersion(int index);
   virtual void UpdateNode();
   virtual void SetLocation(tuple<uint64_t, uint64_t, uint64_t> location);
+  // bytes held by the node outside of the page arena
+  virtual size_t HeapSize() const;
 
   virtual string GetHash() = 0;
   virtual uint64_t GetVersion() = 0;
@@ -86,6 +102,7 @@ class LeafNode : public Node {
                   DeltaPage *deltapage);
   tuple<uint64_t, uint64_t, uint64_t> GetLocation() const;
   void SetLocation(tuple<uint64_t, uint64_t, uint64_t> location) override;
+  size_t HeapSize() const override;
   string GetHash();
   uint64_t GetVersion();
   void SetVersion(uint64_t version);
@@ -104,17 +121,16 @@ class LeafNode : public Node {
 class IndexNode : public Node {
  public:
   IndexNode(uint64_t V = 0, const string &h = "", uint16_t b = 0);
-  IndexNode(
-      uint64_t version, const string &hash, uint16_t bitmap,
-      const array<tuple<uint64_t, string, Node *>, DMM_NODE_FANOUT> &children);
-  IndexNode(const IndexNode &other);
+  // deep copy, children are allocated from the arena of the new page
+  IndexNode(const IndexNode &other, Arena &arena);
+  IndexNode(const IndexNode &other) = delete;
   void CalculateHash() override;
   void SerializeTo(char *buffer, size_t &current_size,
                    bool is_root) const override;
   void DeserializeFrom(char *buffer, size_t &current_size,
                        bool is_root) override;
-  void UpdateNode(uint64_t version, int index, const string &child_hash,
-                  uint8_t location_in_page, DeltaPage *deltapage);
+  // deserialize the second level of a page that follows its root
+  void DeserializeChildren(char *buffer, size_t &current_size, Arena &arena);
   void AddChild(int index, Node *child, uint64_t version = 0,
                 const string &hash = "") override;
   Node *GetChild(int index) const override;
@@ -122,6 +138,7 @@ class IndexNode : public Node {
   void SetChild(int index, uint64_t version, string hash) override;
   string GetChildHash(int index);
   uint64_t GetChildVersion(int index);
+  size_t HeapSize() const override;
   string GetHash();
   uint64_t GetVersion();
   void SetVersion(uint64_t version);
@@ -130,11 +147,17 @@ class IndexNode : public Node {
   NodeProof GetNodeProof(int level, int index);
 
  private:
+  void SetChildHash(int index, const string &hash);
+
   uint64_t version_;
   string hash_;
-  uint16_t bitmap_;  // bitmap for children
-  array<tuple<uint64_t, string, Node *>, DMM_NODE_FANOUT> children_;  // trie
+  uint16_t bitmap_;       // bitmap for children
+  uint16_t hash_bitmap_;  // children whose hash is not empty
   const bool is_leaf_;
+  // children are kept as struct of arrays so that a node is one flat block
+  uint64_t child_versions_[DMM_NODE_FANOUT];
+  Node *child_nodes_[DMM_NODE_FANOUT];
+  char child_hashes_[DMM_NODE_FANOUT][HASH_SIZE];
 };
 
 class DeltaPage : public Page {
@@ -176,6 +199,9 @@ class DeltaPage : public Page {
                          uint64_t fileID, uint64_t offset, uint64_t size);
   void SerializeTo();
   void ClearDeltaPage();
+  // move the items into a frozen deltapage with pagekey and go on with an
+  // empty page chained to it
+  shared_ptr<DeltaPage> Freeze(const PageKey &pagekey);
   const vector<DeltaItem> &GetDeltaItems() const;
   PageKey GetLastPageKey() const;
   void SetLastPageKey(PageKey pagekey);
@@ -193,6 +219,15 @@ class DeltaPage : public Page {
   uint16_t b_update_count_;
 };
 
+// one update of a page in a commit: the value of a leaf for zero or one
+// nibble, the new root hash of a child page for two nibbles
+struct NibbleUpdate {
+  string nibbles;
+  tuple<uint64_t, uint64_t, uint64_t> location;
+  const string *value;  // points into the put cache, nullptr for index nibbles
+  string child_hash;
+};
+
 class BasePage : public Page {
  public:
   BasePage(DMMTrie *trie = nullptr, Node *root = nullptr,
@@ -202,17 +237,64 @@ class BasePage : public Page {
   BasePage(const BasePage &other);  // deep copy
   ~BasePage();
   void SerializeTo();
-  void UpdatePage(uint64_t version,
-                  tuple<uint64_t, uint64_t, uint64_t> location,
-                  const string &value, const string &nibbles,
-                  const string &child_hash, DeltaPage *deltapage,
-                  PageKey pagekey);
+  // returns true if the page reached a checkpoint, the caller hands the page
+  // itself to LSVPS then
+  bool UpdatePage(uint64_t version, const vector<NibbleUpdate> &updates,
+                  DeltaPage *deltapage, PageKey pagekey);
   void UpdateDeltaItem(const DeltaPage::DeltaItem &deltaitem);
   Node *GetRoot() const;
+  // approximate bytes of the page in memory, charged to the page cache
+  size_t GetMemorySize() const;
 
  private:
+  template <typename T, typename... Args>
+  T *NewNode(Args &&...args);
+  void DestroyNodes();
+
   DMMTrie *trie_;
-  Node *root_;  // the root of the page
+  Arena arena_;  // all nodes of the page are allocated from it
+  Node *root_;   // the root of the page
+};
+
+// read-only view of a node in a serialized basepage, fields are read from the
+// buffer by offset and no node object is created
+class NodeView {
+ public:
+  NodeView(const char *data = nullptr, const char *end = nullptr,
+           bool is_root = false);
+  bool IsLeaf() const;
+  uint64_t GetVersion() const;
+  string GetHash() const;
+  bool HasChild(int index) const;
+  NodeView GetChild(int index) const;  // only the root of a page has children
+  string GetChildHash(int index) const;
+  uint64_t GetChildVersion(int index) const;
+  tuple<uint64_t, uint64_t, uint64_t> GetLocation() const;
+  NodeProof GetNodeProof(int level, int index) const;
+  size_t SerializedSize() const;
+  // lets code written for Node * take a NodeView as well
+  const NodeView *operator->() const { return this; }
+
+ private:
+  uint16_t GetBitmap() const;
+  const char *ChildEntry(int index) const;  // version and hash in child table
+
+  const char *data_;  // first byte of the node (is_leaf)
+  const char *end_;   // end of the page buffer
+  bool is_root_;
+};
+
+// read-only view of a basepage serialized by BasePage::SerializeTo
+class BasePageView {
+ public:
+  explicit BasePageView(const char *buffer = nullptr);
+  uint64_t GetVersion() const;
+  string GetPid() const;
+  NodeView GetRoot() const;
+
+ private:
+  const char *buffer_;
+  size_t root_offset_;
 };
 
 class DMMTrie {
@@ -223,6 +305,21 @@ class DMMTrie {
   bool Put(uint64_t tid, uint64_t version, const string &key,
            const string &value);
   string Get(uint64_t tid, uint64_t version, const string &key);
+  // values of the keys in the order of keys, "" for keys not found. the keys
+  // are walked in sorted order, so a page shared by their paths is loaded once
+  // and the values are read in file order
+  vector<string> MultiGet(uint64_t tid, uint64_t version,
+                          const vector<string> &keys);
+  // ordered scan over the keys in [begin, end) at version, see
+  // DMMTrieIterator. the iterator must not outlive the trie.
+  unique_ptr<DMMTrieIterator> NewIterator(uint64_t tid, uint64_t version,
+                                          const string &begin,
+                                          const string &end);
+  // background scrub of version against root_hash, see DMMTrieScrubber. the
+  // scrubber must not outlive the trie.
+  unique_ptr<DMMTrieScrubber> NewScrubber(uint64_t tid, uint64_t version,
+                                          const string &root_hash,
+                                          const string &checkpoint_path);
   void Delete(uint64_t tid, uint64_t version, const string &key);
   void Commit(uint64_t version);
   void CalcRootHash(uint64_t tid, uint64_t version);
@@ -238,35 +335,320 @@ class DMMTrie {
   PageKey GetLatestBasePageKey(PageKey pagekey) const;
   void UpdatePageVersion(PageKey pagekey, uint64_t current_version,
                          uint64_t latest_basepage_version);
-  void WritePageCache(PageKey pagekey, Page *page);
+  void WritePageCache(PageKey pagekey, shared_ptr<Page> page);
   void AddDeltaPageVersion(const string &pid, uint64_t version);
   uint64_t GetVersionUpperbound(const string &pid, uint64_t version);
+  void SetCommitThreads(size_t num_threads);
+  // Verify of a version hashes the child pages of a page as tasks on a
+  // work-stealing pool of num_threads, 1 verifies depth first on the caller.
+  // the root hash is the same either way.
+  void SetVerifyThreads(size_t num_threads);
+  // bytes of the pages waiting for the hashes of their child pages in a
+  // parallel Verify, pages below them are verified depth first beyond it.
+  // pages read per second by Verify at most, 0 for no limit.
+  void SetVerifyBudget(size_t memory_bytes, uint64_t pages_per_second);
+  // let Get, GetProof, GetRootHash and Verify run on other threads while a
+  // version is committed. they read the last committed version at most, and
+  // the commit updates copies of the pages it touches instead of the pages
+  // readers may hold. set it before readers are started.
+  void SetConcurrentReads(bool enable);
+  uint64_t GetCommittedVersion() const;
+  // bytes of deserialized pages kept in memory, and the number of trie levels
+  // whose latest pages are never evicted
+  void SetCacheBudget(size_t bytes);
+  void SetPinnedCacheLevels(size_t levels);
+  PageCache::Stats GetCacheStats() const;
+  // when the values of committed versions are synced, see VDLS. Flush waits
+  // until the values of the version are durable.
+  void SetDurability(VDLS::DurabilityPolicy policy, uint64_t interval_ms = 0);
+  uint64_t GetDurableVersion() const;
+  // store repeated values once, see VDLS::SetDedup
+  void SetValueDedup(size_t table_entries, size_t min_value_size);
+  VDLS::DedupStats GetValueDedupStats() const;
+  // compress full data files of values, see VDLS::SetCompression
+  bool SetValueCompression(CompressionCodec codec, size_t block_size);
+  // threads that read the values of a MultiGet, see VDLS::SetReadThreads
+  void SetValueReadThreads(size_t num_threads);
+  // keep values of at most max_size bytes in the leaves instead of VDLS
+  // records, see VDLS::SetInlineValueSize. hashes don't change.
+  void SetValueInlineSize(size_t max_size);
+  // which reads of values and pages check their CRC32C: all, one out of
+  // sample_rate or none (only scrubs), see ChecksumPolicy
+  void SetChecksumVerify(
+      ChecksumVerify mode,
+      uint32_t sample_rate = ChecksumPolicy::kDefaultSampleRate);
+  // drop the values that no version from oldest_version on locates from the
+  // data files of VDLS, see VDLS::CollectGarbage. older versions can't be
+  // read afterwards. called between commits, like CalcRootHash.
+  size_t CollectGarbage(uint64_t tid, uint64_t oldest_version);
+  void SetGcRateLimit(uint64_t bytes_per_second);
 
  private:
+  friend class DMMTrieIterator;
+  friend class DMMTrieScrubber;
+
+  // the updates to a page in CalcRootHash, prepared serially and applied by
+  // the commit workers
+  struct PageUpdate {
+    PageKey pagekey;
+    PageKey old_pagekey;
+    shared_ptr<BasePage> page;
+    DeltaPage *deltapage;
+    bool if_exceed;
+    vector<NibbleUpdate> nibble_updates;
+  };
+
+  // a page of a parallel Verify, see VerifyPageTask
+  struct VerifyLayout;
+  struct VerifyFrame;
+  struct VerifyJob;
+
+  // the state of a MultiGet walk
+  struct MultiGetBatch {
+    const vector<string> &keys;
+    vector<tuple<uint64_t, uint64_t, uint64_t>> locations;
+    vector<bool> found;
+    vector<vector<char>> buffers;  // serialized page of each trie level
+  };
+
   LSVPS *page_store_;
   VDLS *value_store_;
   uint64_t tid;
   BasePage *root_page_;
-  uint64_t current_version_;
-  unordered_map<PageKey, list<pair<PageKey, BasePage *>>::iterator,
-                PageKey::Hash>
-      lru_cache_;                             //  use a hash map as lru cache
-  list<pair<PageKey, BasePage *>> pagekeys_;  // list to maintain cache order
-  const size_t max_cache_size_ = 800;      // maximum pages in cache
+  atomic<uint64_t> current_version_;
+  atomic<uint64_t> committed_version_;  // the last version readers may see
+  bool concurrent_reads_;
+  // pages are shared with page_cache_ and LSVPS, a shared page is copied
+  // before it is modified (see GetPageForWrite)
+  mutable PageCache cache_;
+  // pages of a stage of CalcRootHash that are updated before the store lock is
+  // released for readers
+  static constexpr size_t kStageChunkPages = 400;
   unordered_map<string, DeltaPage>
       active_deltapages_;  // deltapage of all pages, delta pages are indexed by
                            // pid
   unordered_map<string, pair<uint64_t, uint64_t>>
       page_versions_;  // current version, latest basepage version
-  map<PageKey, Page *> page_cache_;
-  map<string, string> put_cache_;  // temporarily store the key of value of Put
+  map<PageKey, shared_ptr<Page>> page_cache_;
+  // a value of Put, its location is set when CalcRootHash writes it to VDLS
+  struct PendingValue {
+    string value;
+    tuple<uint64_t, uint64_t, uint64_t> location;
+  };
+  map<string, PendingValue>
+      put_cache_;  // temporarily store the key of value of Put
   unordered_map<string, vector<uint64_t>>
       deltapage_versions_;  // the versions of deltapages for every pid
+  mutable mutex page_meta_mutex_;  // guards page_versions_, page_cache_ and
+                                   // deltapage_versions_ during commit
+  // held exclusively while the commit changes LSVPS and the active
+  // deltapages, shared by readers loading a page that is not cached
+  mutable shared_mutex store_mutex_;
+  unique_ptr<ThreadPool> commit_pool_;  // workers of CalcRootHash
+  static constexpr size_t kDefaultVerifyMemoryBudget = 64 << 20;
+  unique_ptr<WorkStealingPool> verify_pool_;  // workers of Verify
+  mutex verify_mutex_;  // one parallel Verify runs on the pool at a time
+  size_t verify_memory_budget_;
+  uint64_t verify_rate_limit_;
 
-  BasePage *GetPage(const PageKey &pagekey);
-  void PutPage(const PageKey &pagekey, BasePage *page);
+  // GetPage is used by the commit, readers use ReadPage
+  shared_ptr<BasePage> GetPage(const PageKey &pagekey);
+  shared_ptr<BasePage> GetCachedPage(const PageKey &pagekey);
+  // the cached page to be updated, copied first if anyone else shares it
+  shared_ptr<BasePage> GetPageForWrite(const PageKey &pagekey);
+  // a page to read from, either a BasePage or a view over buffer if the page
+  // is not cached and can be read without replaying deltas
+  bool ReadPage(const PageKey &pagekey, char *buffer,
+                shared_ptr<BasePage> &page, BasePageView &view);
+  shared_ptr<BasePage> ReadPage(const PageKey &pagekey);
+  uint64_t ReadVersion(uint64_t version) const;
+  // add the locations of the values below the page to live, the pages in
+  // visited and below them are skipped
+  void CollectLiveValues(const PageKey &pagekey,
+                         set<pair<string, uint64_t>> &visited,
+                         vector<char> &buffer, VDLS::LiveRecords &live);
+  void PutPage(const PageKey &pagekey, shared_ptr<BasePage> page);
   void UpdatePageKey(const PageKey &old_pagekey, const PageKey &new_pagekey);
   string RecursiveVerify(PageKey pagekey);
+  // RecursiveVerify on verify_pool_: the child pages of a page are spawned as
+  // tasks while the memory budget allows, and the last one to finish hashes
+  // the page
+  string ParallelVerify(const PageKey &pagekey);
+  // read a page and hash its leaves like RecursiveVerify, false if the page
+  // is not found
+  bool ReadVerifyLayout(VerifyJob &job, const PageKey &pagekey,
+                        VerifyLayout &layout);
+  void VerifyPageTask(VerifyJob &job, const PageKey &pagekey,
+                      shared_ptr<VerifyFrame> parent, size_t slot);
+  string VerifySubtree(VerifyJob &job, const PageKey &pagekey);
+  // the hash of a page from its layout and the hashes of its child pages
+  static string HashVerifyLayout(const VerifyLayout &layout,
+                                 const vector<string> &child_hashes);
+  // hand the hash of a page to its parent, and hash the parent once all its
+  // child pages are hashed
+  void FinishVerifyPage(VerifyJob &job, shared_ptr<VerifyFrame> parent,
+                        size_t slot, string hash);
+  PageUpdate PreparePageUpdate(const string &pid, const set<string> &nibbles,
+                               uint64_t version);
+  void ApplyPageUpdate(PageUpdate &update, uint64_t version);
+  void RunPageUpdates(vector<PageUpdate> &stage, uint64_t version);
+  // look up the keys of members (indices into batch.keys, sorted by key) in
+  // the page, and walk the child pages once for all keys that continue there
+  void MultiGetPage(MultiGetBatch &batch, const PageKey &pagekey,
+                    const vector<size_t> &members);
+};
+
+// ordered scan over the keys in [begin, end) of a version, an empty end means
+// no upper bound. keys are ordered as strings of lowercase hex nibbles. the
+// pages on the path to the current key are kept on a stack, so a seek loads one
+// page per level and Next and Prev only load the pages they enter. the next
+// sibling page in the direction of the scan is loaded into the page cache by a
+// background thread meanwhile. a deleted key is returned with an empty value,
+// as Get returns it.
+class DMMTrieIterator {
+ public:
+  DMMTrieIterator(DMMTrie *trie, uint64_t version, const string &begin,
+                  const string &end);
+  ~DMMTrieIterator();
+  DMMTrieIterator(const DMMTrieIterator &) = delete;
+  DMMTrieIterator &operator=(const DMMTrieIterator &) = delete;
+
+  bool Valid() const;
+  void SeekToFirst();
+  void SeekToLast();
+  // the first key in range not less than key
+  void Seek(const string &key);
+  void Next();
+  void Prev();
+  const string &Key() const;
+  string Value() const;
+
+ private:
+  // a page on the path to the current key and the slot of its entry on the
+  // path. slot a * 16 + b is child b of child a of the root of the page.
+  struct Frame {
+    PageKey pagekey;
+    shared_ptr<BasePage> page;  // nullptr if the page is read through view
+    BasePageView view;
+    int slot;
+  };
+
+  static constexpr size_t kPrefetchQueueSize = 4;
+
+  bool PushPage(const PageKey &pagekey);
+  // the position of the first key not less than key, bounds are not checked
+  bool SeekFrom(const string &key);
+  bool SeekLast();
+  // move the slot of the frame to the next or previous entry
+  void Step(Frame &frame, bool forward);
+  // go down from the entry of the top frame to the first leaf in direction,
+  // moving on to the next entries if a subtree has no leaf
+  bool Settle(bool forward);
+  void Prefetch(const PageKey &pagekey);
+  void PrefetchLoop();
+
+  DMMTrie *trie_;
+  uint64_t version_;
+  string begin_;
+  string end_;
+  vector<Frame> stack_;
+  vector<vector<char>> buffers_;  // serialized page of each level
+  bool valid_;
+  string key_;
+  tuple<uint64_t, uint64_t, uint64_t> location_;
+
+  thread prefetch_thread_;  // started by the first prefetch
+  mutex prefetch_mutex_;
+  condition_variable prefetch_cv_;
+  deque<PageKey> prefetch_queue_;
+  bool stop_prefetch_;
+};
+
+// scrubs a version of the trie on a background thread. the hashes of every
+// page are derived again from its values and the hashes of its child pages,
+// and compared with the hashes stored in the page and in its parent, down to
+// the root hash the scrub was started with. pages are checked one by one in
+// pid order, read from LSVPS with their checksums checked and without going
+// through the page cache. the scrub stops at the first divergent node and
+// reports the nibbles leading to it.
+// the pid of the last page checked is kept in a checkpoint file, a scrubber
+// of the same version and root hash goes on behind it. scrubbing along with
+// commits needs concurrent reads, see DMMTrie::SetConcurrentReads.
+class DMMTrieScrubber {
+ public:
+  enum class State {
+    kIdle,      // not started or stopped before the end
+    kRunning,
+    kPassed,    // every page matches the root hash
+    kDiverged,  // see divergent_pid and error
+  };
+
+  struct Status {
+    State state;
+    string cursor;         // pid of the last page checked
+    uint64_t pages;        // pages checked, including earlier runs
+    uint64_t values;       // values hashed, including earlier runs
+    string divergent_pid;  // nibbles down to the first divergent node
+    string error;          // what diverged
+  };
+
+  static constexpr uint64_t kDefaultRateLimit = 1000;  // pages per second
+
+  DMMTrieScrubber(DMMTrie *trie, uint64_t tid, uint64_t version,
+                  const string &root_hash, const string &checkpoint_path);
+  ~DMMTrieScrubber();
+  DMMTrieScrubber(const DMMTrieScrubber &) = delete;
+  DMMTrieScrubber &operator=(const DMMTrieScrubber &) = delete;
+
+  // pages checked per second at most, 0 for no limit
+  void SetRateLimit(uint64_t pages_per_second);
+  void Start();
+  // the checkpoint is written before Stop returns
+  void Stop();
+  // wait until the scrub has passed, diverged or was stopped
+  Status Wait();
+  Status GetStatus() const;
+
+ private:
+  // a page to check and the hash its parent stores for it
+  struct Task {
+    PageKey pagekey;
+    string expected_hash;
+  };
+
+  static constexpr uint64_t kCheckpointInterval = 256;  // pages
+  static constexpr uint64_t kCheckpointMagic = 0x3142524353545244ULL;
+
+  void ScrubLoop();
+  // queue the child pages of a page that lie behind the cursor and check the
+  // page unless it is the cursor or before it. false if the page diverges.
+  bool ScrubPage(const Task &task, vector<Task> &tasks, bool &checked);
+  // derive the hash of node from the values below it and the hashes stored
+  // for its child pages, and compare it with the stored ones
+  template <typename NodeRef>
+  bool DeriveHash(NodeRef node, bool is_root, const string &pid,
+                  const string &expected_hash, string &hash,
+                  uint64_t &values);
+  bool Diverge(const string &pid, const string &error);
+  bool LoadCheckpoint();
+  void WriteCheckpoint();
+  void Join();
+
+  DMMTrie *trie_;
+  uint64_t tid_;
+  uint64_t version_;
+  string root_hash_;
+  string checkpoint_path_;
+  vector<char> buffer_;  // serialized page being checked
+
+  thread scrub_thread_;
+  mutex join_mutex_;  // guards scrub_thread_, taken before mutex_
+  mutable mutex mutex_;
+  condition_variable cv_;
+  bool stop_;
+  uint64_t rate_limit_;
+  Status status_;
+  bool cursor_valid_;  // the cursor names a page, false before the root
 };
 
 #endif
\ No newline at end of file
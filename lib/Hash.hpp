@@ -0,0 +1,93 @@
+#ifndef _HASH_HPP_
+#define _HASH_HPP_
+
+#include <openssl/sha.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef LETUS_HASH_BLAKE3
+#include <blake3.h>
+#endif
+
+// hash algorithms of the DMM-Trie, chosen at compile time with one of
+// LETUS_HASH_SHA1 (default), LETUS_HASH_SHA256 or LETUS_HASH_BLAKE3. node,
+// page and proof layouts take their hash width from kDigestSize. kId is
+// stored with the pages, data written with another hash is refused.
+struct Sha1Hash {
+  static constexpr uint32_t kId = 1;
+  static constexpr size_t kDigestSize = SHA_DIGEST_LENGTH;  // 20
+  static void Digest(const char *input, size_t size, unsigned char *out) {
+    SHA1(reinterpret_cast<const unsigned char *>(input), size, out);
+  }
+};
+
+struct Sha256Hash {
+  static constexpr uint32_t kId = 2;
+  static constexpr size_t kDigestSize = SHA256_DIGEST_LENGTH;  // 32
+  static void Digest(const char *input, size_t size, unsigned char *out) {
+    SHA256(reinterpret_cast<const unsigned char *>(input), size, out);
+  }
+};
+
+#ifdef LETUS_HASH_BLAKE3
+struct Blake3Hash {
+  static constexpr uint32_t kId = 3;
+  static constexpr size_t kDigestSize = BLAKE3_OUT_LEN;  // 32
+  static void Digest(const char *input, size_t size, unsigned char *out) {
+    blake3_hasher hasher;
+    blake3_hasher_init(&hasher);
+    blake3_hasher_update(&hasher, input, size);
+    blake3_hasher_finalize(&hasher, out, BLAKE3_OUT_LEN);
+  }
+};
+#endif
+
+#if defined(LETUS_HASH_BLAKE3)
+using TrieHash = Blake3Hash;
+#elif defined(LETUS_HASH_SHA256)
+using TrieHash = Sha256Hash;
+#else
+using TrieHash = Sha1Hash;
+#endif
+
+static constexpr size_t HASH_SIZE = TrieHash::kDigestSize;
+
+// name of a stored hash id, for error messages
+inline std::string HashName(uint32_t id) {
+  switch (id) {
+    case 1:
+      return "SHA1";
+    case 2:
+      return "SHA256";
+    case 3:
+      return "BLAKE3";
+    default:
+      return "unknown hash " + std::to_string(id);
+  }
+}
+
+// hashes are stored in HASH_SIZE slots, an empty hash (deleted or missing
+// node) is stored as all zero bytes and read back as an empty string
+inline void WriteHash(char *buffer, const std::string &hash) {
+  size_t size = hash.size() < HASH_SIZE ? hash.size() : HASH_SIZE;
+  memcpy(buffer, hash.data(), size);
+  memset(buffer + size, 0, HASH_SIZE - size);
+}
+
+inline bool IsEmptyHash(const char *buffer) {
+  for (size_t i = 0; i < HASH_SIZE; i++) {
+    if (buffer[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline std::string ReadHash(const char *buffer) {
+  return IsEmptyHash(buffer) ? std::string() : std::string(buffer, HASH_SIZE);
+}
+
+#endif
@@ -2,13 +2,24 @@
 #define _LSVPS_H_
 
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <queue>
+#include <stack>
 #include <string>
 #include <vector>
 
 #include "DMMTrie.hpp"
 #include "common.hpp"
 
+// the lookup block of an index file and the index block of the delta cache
+// start with this magic and format version, followed by TrieHash::kId. files
+// written before pages and blocks had checksums have neither and are refused,
+// so are pages hashed with another hash than this build uses.
+static constexpr uint64_t LSVPS_FORMAT_MAGIC = 0x3153505653564c4cULL;  // LLVSVPS1
+static constexpr uint32_t LSVPS_FORMAT_VERSION = 1;
+
 // 索引块结构体
 struct IndexBlock {
   static constexpr size_t INDEXBLOCK_SIZE = 12288;  // 12KB
@@ -26,8 +37,10 @@ struct IndexBlock {
   bool AddMapping(const PageKey &pagekey, uint64_t location);
   bool IsFull() const;
   const std::vector<Mapping> &GetMappings() const;
+  // the block ends with the CRC32C of the bytes before it, it is checked by
+  // Deserialize if verify is set
   bool SerializeTo(std::ofstream &out) const;
-  bool Deserialize(std::ifstream &in);
+  bool Deserialize(std::istream &in, bool verify = true);
 
  private:
   std::vector<Mapping> mappings_;
@@ -46,8 +59,14 @@ struct LookupBlock {
 
   std::vector<std::pair<PageKey, size_t>>
       entries;  // mapping indexblock to its location
+  // false after Deserialize if the block has no LSVPS_FORMAT_MAGIC or another
+  // format version
+  bool format_supported = true;
+  // TrieHash::kId of the pages, Deserialize fails if it is another one
+  uint32_t hash_id = TrieHash::kId;
+  // starts with the format and ends with a checksum like IndexBlock
   bool SerializeTo(std::ostream &out) const;
-  bool Deserialize(std::istream &in);
+  bool Deserialize(std::istream &in, bool verify = true);
 };
 
 // LSVPS类定义
@@ -58,17 +77,57 @@ class LSVPS {
       : cache_(),
         table_(*this),
         index_file_path_(index_file_path),
-        active_delta_page_cache_(800, index_file_path) {}
+        active_delta_page_cache_(800, index_file_path, checksum_policy_),
+        trie_(nullptr),
+        pending_pages_(nullptr),
+        pending_pages_mutex_(nullptr) {}
   Page *PageQuery(uint64_t version);
-  BasePage *LoadPage(const PageKey &pagekey);
-  void StorePage(Page *page);
+  // a basepage in memory that needs no delta replay is shared, not copied
+  std::shared_ptr<BasePage> LoadPage(const PageKey &pagekey);
+  // if the basepage on disk needs no delta replay, its serialized bytes are
+  // copied into view_buffer (PAGE_SIZE) and nullptr is returned instead of a
+  // deserialized page
+  std::shared_ptr<BasePage> LoadPage(const PageKey &pagekey,
+                                     char *view_buffer);
+  // LoadPage may run on several reader threads at once, as long as no commit
+  // changes the store meanwhile
+  // the page is kept as it is, the trie must not modify it afterwards
+  void StorePage(std::shared_ptr<Page> page);
   void AddIndexFile(const IndexFile &index_file);
   int GetNumOfIndexFile();
   void RegisterTrie(DMMTrie *DMM_trie);
-  const std::vector<Page *> &GetTable() const;
+  const std::vector<std::shared_ptr<Page>> &GetTable() const;
   void Flush();
   void StoreActiveDeltaPage(DeltaPage *page);
   DeltaPage *GetActiveDeltaPage(const string &pid);
+  void PinActiveDeltaPage(const string &pid);
+  void UnpinActiveDeltaPage(const string &pid);
+  // pages and blocks are written with a CRC32C, which reads of them check
+  // according to mode, see ChecksumPolicy
+  void SetChecksumVerify(ChecksumVerify mode, uint32_t sample_rate);
+
+  // pages a commit has frozen but not handed over with StorePage yet. lookups
+  // find them while the scope lives, pages is read under mutex. the scope is
+  // opened and closed while no reader loads pages.
+  class PendingPageScope {
+   public:
+    PendingPageScope(LSVPS *store,
+                     const std::map<PageKey, std::shared_ptr<Page>> &pages,
+                     std::mutex &mutex)
+        : store_(store) {
+      store_->pending_pages_ = &pages;
+      store_->pending_pages_mutex_ = &mutex;
+    }
+    ~PendingPageScope() {
+      store_->pending_pages_ = nullptr;
+      store_->pending_pages_mutex_ = nullptr;
+    }
+    PendingPageScope(const PendingPageScope &) = delete;
+    PendingPageScope &operator=(const PendingPageScope &) = delete;
+
+   private:
+    LSVPS *store_;
+  };
 
  private:
   // 块缓存类（占位）
@@ -78,8 +137,8 @@ class LSVPS {
   class MemIndexTable {
    public:
     explicit MemIndexTable(LSVPS &parent);
-    const std::vector<Page *> &GetBuffer() const;
-    void Store(Page *page);
+    const std::vector<std::shared_ptr<Page>> &GetBuffer() const;
+    void Store(std::shared_ptr<Page> page);
     bool IsFull() const;
     void Flush();
 
@@ -87,7 +146,7 @@ class LSVPS {
     void writeToStorage(const std::vector<IndexBlock> &index_blocks,
                         const LookupBlock &lookup_blocks,
                         const std::filesystem::path &filepath);
-    std::vector<Page *> buffer_;
+    std::vector<std::shared_ptr<Page>> buffer_;
     // gurantee that max_size >= one version pages
     // max number of entries in lookup block = 126, 126^2 = 15876
     const size_t max_size_ = 800;
@@ -96,10 +155,14 @@ class LSVPS {
 
   class ActiveDeltaPageCache {
    public:
-    ActiveDeltaPageCache(size_t max_size, std::string cache_dir);
+    ActiveDeltaPageCache(size_t max_size, std::string cache_dir,
+                         ChecksumPolicy &checksum_policy);
     ~ActiveDeltaPageCache();
     void Store(DeltaPage *page);
     DeltaPage *Get(const string &pid);
+    // pinned pages are skipped by eviction while a commit stage holds them
+    void Pin(const string &pid);
+    void Unpin(const string &pid);
     // TODO: DeltaPage* GetNewPage();
     void FlushToDisk();
 
@@ -118,23 +181,48 @@ class LSVPS {
     std::queue<size_t> free_pages_;
     unordered_map<string, size_t> cache_;          // map pid to cache pool
     unordered_map<string, size_t> pid_to_offset_;  // Maps pid to file offset
+    size_t pages_end_ = 0;  // the index block follows the pages
     const size_t max_size_;                        // 缓存最大容量
     std::string cache_dir_;                        // 磁盘缓存目录
     std::string cache_file_;                       // 统一存储文件路径
     std::list<string> lru_queue_;                  // 用于LRU淘汰策略
+    unordered_map<string, size_t> pinned_;  // pids not to be evicted, pin count
+    ChecksumPolicy &checksum_policy_;
   };
 
-  Page *pageLookup(const PageKey &pagekey);
-  Page *readPageFromIndexFile(std::vector<IndexFile>::const_iterator file_it,
-                              const PageKey &pagekey);
+  std::shared_ptr<BasePage> loadPage(const PageKey &pagekey,
+                                     char *view_buffer);
+  std::shared_ptr<Page> pageLookup(const PageKey &pagekey);
+  // pages of the buffer or of the ongoing commit, shared with them
+  std::shared_ptr<Page> findPageInMemory(const PageKey &pagekey);
+  // a new page read from the index files
+  std::shared_ptr<Page> readPageFromDisk(const PageKey &pagekey);
+  // collect the deltapages to replay for pagekey and return the pagekey of the
+  // basepage they start from, version 0 means that there is no basepage
+  PageKey resolvePageChain(const PageKey &pagekey,
+                           std::stack<const DeltaPage *> &delta_pages,
+                           std::vector<std::shared_ptr<Page>> &chain_pages);
+  bool hasDeltaToReplay(const PageKey &pagekey, const PageKey &base_pagekey,
+                        std::stack<const DeltaPage *> delta_pages) const;
+  std::vector<IndexFile>::const_iterator findIndexFile(
+      const PageKey &pagekey) const;
+  bool readPageData(std::vector<IndexFile>::const_iterator file_it,
+                    const PageKey &pagekey, char *data, PageKey &true_pagekey);
+  std::shared_ptr<Page> readPageFromIndexFile(
+      std::vector<IndexFile>::const_iterator file_it, const PageKey &pagekey);
   void applyDelta(BasePage *basepage, const DeltaPage *deltapage,
                   PageKey pagekey);
 
   blockCache cache_;
+  ChecksumPolicy checksum_policy_;
   MemIndexTable table_;
   std::string index_file_path_;
   ActiveDeltaPageCache active_delta_page_cache_;
+  std::mutex delta_cache_mutex_;  // guards active_delta_page_cache_
   DMMTrie *trie_;
+  // pages of the commit in progress, see PendingPageScope
+  const std::map<PageKey, std::shared_ptr<Page>> *pending_pages_;
+  std::mutex *pending_pages_mutex_;
   std::vector<IndexFile> index_files_;
 };
 
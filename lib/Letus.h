@@ -5,16 +5,78 @@
 
 typedef struct Letus Letus;
 typedef struct LetusProofPath LetusProofPath;
+typedef struct LetusIterator LetusIterator;
+typedef struct LetusScrubber LetusScrubber;
 
 extern struct Letus* OpenLetus(const char* path_c);
 void LetusPut(Letus* p, uint64_t tid, uint64_t version, const char* key_c,
               const char* value_c);
 void LetusDelete(Letus* p, uint64_t tid, uint64_t version, const char* key_c);
 char* LetusGet(Letus* p, uint64_t tid, uint64_t version, const char* key_c);
+char** LetusMultiGet(Letus* p, uint64_t tid, uint64_t version,
+                     const char** keys_c, uint64_t num_keys);
 bool LetusRevert(Letus* p, uint64_t tid, uint64_t version);
 bool LetusCalcRootHash(Letus* p, uint64_t tid, uint64_t version);
 char* LetusGetRootHash(Letus* p, uint64_t tid, uint64_t version);
 bool LetusFlush(Letus* p, uint64_t tid, uint64_t version);
+void LetusSetCommitThreads(Letus* p, uint64_t num_threads);
+void LetusSetConcurrentReads(Letus* p, bool enable);
+void LetusSetCacheBudget(Letus* p, uint64_t bytes);
+void LetusGetCacheStats(Letus* p, uint64_t* hits, uint64_t* misses,
+                        uint64_t* evictions);
+// policy 0 syncs values only when a data file is full and on LetusFlush, 1
+// once per committed version and 2 every interval_ms in the background.
+// LetusFlush waits until the values of the version are durable.
+void LetusSetDurability(Letus* p, int policy, uint64_t interval_ms);
+uint64_t LetusGetDurableVersion(Letus* p);
+// values of at least min_value_size bytes that were stored before are not
+// written again, table_entries 0 turns it off
+void LetusSetValueDedup(Letus* p, uint64_t table_entries,
+                        uint64_t min_value_size);
+// compress full data files in blocks of about block_size bytes, codec 0 is
+// none, 1 LZ4, 2 zstd and 3 zlib. false if the codec is not built in.
+bool LetusSetValueCompression(Letus* p, int codec, uint64_t block_size);
+// threads that read the values of LetusMultiGet with pread, 0 reads them in
+// the calling thread
+void LetusSetValueReadThreads(Letus* p, uint64_t num_threads);
+// keep values of at most max_size bytes (up to 16) in the trie leaves instead
+// of the data files, 0 turns it off
+void LetusSetValueInlineSize(Letus* p, uint64_t max_size);
+// reads of values and pages check their checksums with mode 0 always, with
+// mode 1 once every sample_rate reads and with mode 2 never (only scrubs)
+void LetusSetChecksumVerify(Letus* p, int mode, uint64_t sample_rate);
+// drop the values no version from oldest_version on uses from the data files
+// in the background, at most rate_limit bytes per second (0 for no limit).
+// versions older than oldest_version can't be read afterwards. returns the
+// number of data files that are rewritten.
+uint64_t LetusCollectGarbage(Letus* p, uint64_t tid, uint64_t oldest_version,
+                             uint64_t rate_limit);
+// ordered scan over [begin_c, end_c) at version, an empty end_c has no bound
+LetusIterator* LetusNewIterator(Letus* p, uint64_t tid, uint64_t version,
+                                const char* begin_c, const char* end_c);
+void LetusIteratorSeekToFirst(LetusIterator* it);
+void LetusIteratorSeekToLast(LetusIterator* it);
+void LetusIteratorSeek(LetusIterator* it, const char* key_c);
+void LetusIteratorNext(LetusIterator* it);
+void LetusIteratorPrev(LetusIterator* it);
+bool LetusIteratorValid(LetusIterator* it);
+char* LetusIteratorKey(LetusIterator* it);
+char* LetusIteratorValue(LetusIterator* it);
+void LetusDeleteIterator(LetusIterator* it);
+// background check of the stored pages and values of version against the
+// root hash of hash_size bytes, throttled to rate_limit pages per second (0
+// for no limit). progress is kept in checkpoint_path_c and a new scrubber of
+// the same version and root hash resumes from it.
+LetusScrubber* LetusNewScrubber(Letus* p, uint64_t tid, uint64_t version,
+                                const char* root_hash_c, uint64_t hash_size,
+                                const char* checkpoint_path_c,
+                                uint64_t rate_limit);
+void LetusScrubberStart(LetusScrubber* s);
+void LetusScrubberStop(LetusScrubber* s);
+// state 0 is idle, 1 running, 2 passed and 3 diverged. the pid of the first
+// divergent node is returned for state 3, NULL otherwise.
+int LetusScrubberState(LetusScrubber* s, uint64_t* pages, char** divergent_pid);
+void LetusDeleteScrubber(LetusScrubber* s);
 LetusProofPath* LetusProof(Letus* p, uint64_t tid, uint64_t version,
                            const char* key_c);
 uint64_t LetusGetProofPathSize(LetusProofPath* path);
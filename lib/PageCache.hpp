@@ -0,0 +1,102 @@
+#ifndef _PAGECACHE_HPP_
+#define _PAGECACHE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+
+class BasePage;
+
+// cache of deserialized basepages with a budget in bytes. pages are spread
+// over shards by pid, so all versions of a page live in the same shard. each
+// shard evicts with the CLOCK algorithm: a hit only sets the reference bit of
+// the entry under the shared lock of its shard, and the hand clears the bits
+// and evicts unreferenced pages when the shard is over its share of the
+// budget. the latest version of the pages in the top levels of the trie is
+// pinned and never evicted.
+class PageCache {
+ public:
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t pages;
+    uint64_t bytes;
+  };
+
+  static constexpr size_t kDefaultBudget = 64ULL << 20;  // 64 MB
+  static constexpr size_t kDefaultShards = 16;
+  static constexpr size_t kDefaultPinnedLevels = 2;  // root and its children
+
+  explicit PageCache(size_t budget = kDefaultBudget,
+                     size_t num_shards = kDefaultShards,
+                     size_t pinned_levels = kDefaultPinnedLevels);
+  ~PageCache();
+
+  PageCache(const PageCache &) = delete;
+  PageCache &operator=(const PageCache &) = delete;
+
+  // nullptr if the page is not cached
+  std::shared_ptr<BasePage> Get(const PageKey &pagekey);
+  // whether page is cached under pagekey, not counted as a hit or a miss
+  bool Holds(const PageKey &pagekey, const BasePage *page);
+  // add the page, or replace the page cached under pagekey
+  void Put(const PageKey &pagekey, std::shared_ptr<BasePage> page);
+  // add the page unless a page is cached under pagekey, returns the cached
+  // page. readers add the pages they load with it, a commit may be changing
+  // the cached page meanwhile.
+  std::shared_ptr<BasePage> PutIfAbsent(const PageKey &pagekey,
+                                        std::shared_ptr<BasePage> page);
+  // cache the page of old_pagekey under new_pagekey, it may have grown
+  void Rekey(const PageKey &old_pagekey, const PageKey &new_pagekey);
+  void Clear();
+
+  void SetBudget(size_t budget);
+  // pages whose pid has less than 2 * levels nibbles are pinned
+  void SetPinnedLevels(size_t levels);
+  Stats GetStats() const;
+
+ private:
+  struct Entry {
+    PageKey pagekey;
+    std::shared_ptr<BasePage> page;
+    size_t bytes;
+    std::atomic<bool> referenced;
+    bool pinned;
+  };
+
+  struct Shard {
+    mutable std::shared_mutex mutex;
+    std::unordered_map<PageKey, size_t, PageKey::Hash> index;  // to slots
+    std::vector<std::unique_ptr<Entry>> slots;  // clock ring, nullptr if free
+    std::vector<size_t> free_slots;
+    std::unordered_map<std::string, Entry *> pinned;  // pinned entry by pid
+    size_t hand = 0;
+    size_t bytes = 0;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+  };
+
+  Shard &GetShard(const std::string &pid);
+  bool IsTopLevel(const std::string &pid) const;
+  // the entry becomes the pinned version of its pid if it is the latest
+  void Pin(Shard &shard, Entry *entry);
+  // a new entry in a free slot, the caller sets its page and charges it
+  Entry *AddEntry(Shard &shard, const PageKey &pagekey);
+  void Charge(Shard &shard, Entry *entry, size_t bytes);
+  void Remove(Shard &shard, size_t slot);
+  void EvictIfNeeded(Shard &shard);
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<size_t> shard_budget_;
+  std::atomic<size_t> pinned_levels_;
+};
+
+#endif
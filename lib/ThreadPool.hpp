@@ -0,0 +1,130 @@
+#ifndef _THREADPOOL_HPP_
+#define _THREADPOOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed-size worker pool running one data-parallel job at a time. the caller
+// of ParallelFor also executes iterations, so a pool of size 1 has no worker
+// threads and runs everything inline.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t num_threads = 1)
+      : num_threads_(num_threads == 0 ? 1 : num_threads),
+        job_(nullptr),
+        job_size_(0),
+        next_index_(0),
+        generation_(0),
+        running_workers_(0),
+        stop_(false) {
+    for (size_t i = 1; i < num_threads_; i++) {
+      workers_.emplace_back([this]() { WorkerLoop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    job_cv_.notify_all();
+    for (auto &worker : workers_) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t Size() const { return num_threads_; }
+
+  // run fn(i) for every i in [0, n) and return after all of them finished,
+  // the first exception thrown by any iteration is rethrown to the caller
+  void ParallelFor(size_t n, const std::function<void(size_t)> &fn) {
+    if (n == 0) return;
+    if (workers_.empty() || n == 1) {
+      for (size_t i = 0; i < n; i++) {
+        fn(i);
+      }
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_ = &fn;
+      job_size_ = n;
+      next_index_.store(0);
+      error_ = nullptr;
+      running_workers_ = workers_.size();
+      generation_++;
+    }
+    job_cv_.notify_all();
+
+    RunIterations();  // the calling thread works as well
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this]() { return running_workers_ == 0; });
+    job_ = nullptr;
+    if (error_) {
+      std::exception_ptr error = error_;
+      error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+ private:
+  void WorkerLoop() {
+    uint64_t seen_generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        job_cv_.wait(lock, [&]() {
+          return stop_ || generation_ != seen_generation;
+        });
+        if (stop_) return;
+        seen_generation = generation_;
+      }
+      RunIterations();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--running_workers_ == 0) {
+          done_cv_.notify_one();
+        }
+      }
+    }
+  }
+
+  void RunIterations() {
+    while (true) {
+      size_t i = next_index_.fetch_add(1);
+      if (i >= job_size_) return;
+      try {
+        (*job_)(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) error_ = std::current_exception();
+      }
+    }
+  }
+
+  const size_t num_threads_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable job_cv_;   // workers wait for a new job
+  std::condition_variable done_cv_;  // caller waits for the workers
+  const std::function<void(size_t)> *job_;
+  size_t job_size_;
+  std::atomic<size_t> next_index_;
+  uint64_t generation_;
+  size_t running_workers_;
+  std::exception_ptr error_;
+  bool stop_;
+};
+
+#endif
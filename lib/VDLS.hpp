@@ -1,24 +1,152 @@
 #ifndef _VDLS_HPP_
 #define _VDLS_HPP_
 
-#include <fcntl.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <unistd.h>
-
-#include <fstream>
-#include <iostream>
-#include <sstream>
-#include <stdexcept>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
+#include "Codec.hpp"
+#include "Crc32c.hpp"
+
 using namespace std;
 
-// log stream format: fileID,offset,size\n
+// values are appended to 64MB data files and located by fileID,offset,size.
+// record format (size in bytes):
+// | version (8) | key_size (4) | value_size (4) | crc32c (4) | key | value |
+// the checksum covers the first 16 bytes of the header, the key and the value.
+// values are read through the write mapping of the current data file and an
+// LRU pool of read mappings of the older ones. a background thread keeps the
+// next data file created and mapped, and syncs the retired one, so that the
+// writer only swaps mappings when a data file is full.
+// the durability policy decides when the values of a committed version are
+// synced: never on its own, by a group sync per commit, or by the background
+// thread every few milliseconds. the durable version watermark tells up to
+// which version the values are on disk.
+// after every sync the background thread records the synced data file and
+// offset in a manifest with two checksummed slots that are written in turns,
+// so that a torn write leaves the other slot intact. a reopened VDLS goes on
+// writing behind the recorded offset, after a bounded scan that takes in the
+// complete records written behind it before a crash.
+// with deduplication on, a value that is byte for byte equal to one written
+// before is located at the earlier record instead of being written again.
+// with compression on, the background thread rewrites every retired data file
+// as blocks of whole records that are compressed one by one, followed by an
+// index of the blocks and a footer:
+// | block ... | index (24 per block) | footer (32) |
+// locations keep their offsets in the records of the file, reads find the
+// block in the index and decompress it into an LRU cache of blocks.
+// garbage collection rewrites retired data files with few live records in
+// the same format, with the live records only. a record keeps its location,
+// the index of the rewritten file forwards it to the block it moved to.
+// values of at most the inline value size are not written, they are kept in
+// the location itself: the fileID has kInlineValueFlag and the size of the
+// value set, offset and size hold the bytes of the value.
+// batches of values are read by a pool of read threads with pread, or with
+// io_uring when built with LETUS_WITH_IO_URING, where a read thread submits
+// up to kReadRingDepth runs at once. records that lie close together in a
+// data file are read at once. records whose
+// pages are in memory already are copied from the mapping by the caller.
+// reads check the checksums of all records, a sample of them (the default)
+// or none, leaving them to VerifyRecord.
 class VDLS {
  public:
+  enum class DurabilityPolicy {
+    kNone,         // only synced at rollover or when waited for
+    kGroupCommit,  // synced once per committed version
+    kInterval,     // synced by the background thread every interval
+  };
+
+  // a block of a compressed data file, offset and size are in the records
+  struct Block {
+    uint64_t offset;
+    uint64_t physical_offset;
+    uint32_t physical_size;
+    uint32_t size;
+  };
+
+  // a mapping of a data file, unmapped with its last handle. the blocks of
+  // a compressed data file are filled in before the mapping is shared.
+  struct Segment {
+    Segment(char* data, size_t length) : data(data), length(length) {}
+    ~Segment();
+    Segment(const Segment&) = delete;
+    Segment& operator=(const Segment&) = delete;
+
+    char* const data;
+    const size_t length;
+    uint64_t id = 0;  // tells apart the mappings of a rewritten data file
+    bool has_blocks = false;  // false for a data file of plain records
+    CompressionCodec codec = CompressionCodec::kNone;
+    vector<Block> blocks;
+    int fd = -1;  // a plain data file stays open for the read threads
+  };
+
+  // reads submitted together by ReadValuesAsync, their values are filled in
+  // once Wait returns
+  class ReadBatch {
+   public:
+    // wait for all reads of the batch, the first error is rethrown
+    void Wait();
+
+    bool Done();
+
+   private:
+    friend class VDLS;
+
+    void Finish(exception_ptr error);
+
+    mutex mutex_;
+    condition_variable done_cv_;
+    size_t pending_runs_ = 0;
+    exception_ptr error_;
+  };
+
+  // a value in VDLS, the mapping or the decompressed block it lies in is
+  // kept while the view is held
+  struct ValueView {
+    string_view value;
+    shared_ptr<const void> holder;
+  };
+
+  struct DedupStats {
+    uint64_t hits;
+    uint64_t saved_bytes;
+  };
+
+  struct GcStats {
+    uint64_t files;  // data files rewritten
+    uint64_t reclaimed_bytes;
+  };
+
+  // live records of data files by fileID, as offset and size
+  typedef unordered_map<uint64_t, vector<pair<uint64_t, uint64_t>>> LiveRecords;
+
+  static constexpr size_t kDefaultReadSegments = 16;
+  static constexpr size_t kDefaultDedupMinValueSize = 64;
+  static constexpr size_t kDefaultBlockSize = 64 * 1024;                // 64KB
+  static constexpr size_t kDefaultBlockCacheBytes = 32 * 1024 * 1024;  // 32MB
+  static constexpr double kDefaultGcDeadRatio = 0.5;
+  static constexpr size_t kDefaultReadMapBytes = 1ULL << 30;  // 1GB
+  static constexpr size_t kDefaultReadThreads = 4;
+  // records at most this far apart are read by one pread, up to kMaxReadRun
+  static constexpr size_t kReadCoalesceGap = 4 * 1024;   // 4KB
+  static constexpr size_t kMaxReadRun = 256 * 1024;       // 256KB
+  // runs a read thread keeps in flight on its io_uring
+  static constexpr size_t kReadRingDepth = 32;
+
   // VDLS(string file_path = "/mnt/c/Users/qyf/Desktop/LETUS_prototype/data/")
   //     : current_fileID_(0),
   //       current_offset_(0),
@@ -28,172 +156,130 @@ class VDLS {
   //       buffer_fileID_(-1),
   //       buffer_offset_(-1) {}
 
-  VDLS(string file_path = "/mnt/c/Users/qyf/Desktop/LETUS_prototype/data/")
-      : current_fileID_(0),
-        current_offset_(0),
-        file_path_(file_path),
-        write_map_(MAP_FAILED),
-        read_map_(MAP_FAILED),
-        read_map_fileID_(-1) {
-    OpenAndMapWriteFile();
-  }
+  VDLS(string file_path = "/mnt/c/Users/qyf/Desktop/LETUS_prototype/data/");
 
-  tuple<uint64_t, uint64_t, uint64_t> WriteValue(uint64_t version,
-                                                 const string& key,
-                                                 const string& value) {
-    string record = to_string(version) + "," + key + "," + value + "\n";
-    size_t record_size = record.size();
-
-    // 检查是否需要创建新文件
-    if (current_offset_ + record_size > MaxFileSize) {
-      // 同步更改到磁盘
-      if (msync(write_map_, MaxFileSize, MS_SYNC) == -1) {
-        throw runtime_error("Failed to sync changes to disk");
-      }
-      // 解除旧的映射
-      if (write_map_ != MAP_FAILED) {
-        munmap(write_map_, MaxFileSize);
-      }
-
-      // 创建新文件 ID 和重置偏移量
-      current_fileID_++;
-      current_offset_ = 0;
-
-      // 重新打开和映射新文件
-      OpenAndMapWriteFile();
-    }
-
-    // 写入新记录到写映射区域
-    memcpy(static_cast<char*>(write_map_) + current_offset_, record.c_str(),
-           record_size);
-
-    // 同步更改到磁盘
-    // if (msync(write_map_, MaxFileSize, MS_SYNC) == -1) {
-    //   throw runtime_error("Failed to sync changes to disk");
-    // }
-
-    current_offset_ += record_size;
-
-    return make_tuple(current_fileID_, current_offset_ - record_size,
-                      record_size);
-  }
+  ~VDLS();
 
-  tuple<uint64_t, uint64_t, uint64_t> WriteValueV1(
-      uint64_t version, const string& key,
-      const string& value) {  // append a new record to the log stream
-    string version_str = to_string(version);
-    size_t record_size = version_str.size() + key.size() + value.size() + 3;
-    if (current_offset_ + record_size > MaxFileSize) {
-      current_fileID_++;
-      current_offset_ = 0;
-    }
+  static constexpr size_t kRecordHeaderSize = 20;
+  static constexpr uint64_t kInlineValueFlag = 1ULL << 63;
+  static constexpr size_t kMaxInlineValueSize = 2 * sizeof(uint64_t);
 
-    ofstream file(
-        file_path_ + "data_file_" + to_string(current_fileID_) + ".dat",
-        ios::app);  // create or open the file for appending
-    if (!file) {
-      throw std::runtime_error("Cannot open file ");
-    }
+  static bool IsInline(const tuple<uint64_t, uint64_t, uint64_t>& location) {
+    return (get<0>(location) & kInlineValueFlag) != 0;
+  }
 
-    file << version_str << "," << key << "," << value << "\n";
+  static tuple<uint64_t, uint64_t, uint64_t> InlineLocation(
+      const string& value) {
+    uint64_t words[2] = {0, 0};
+    memcpy(words, value.data(), value.size());
+    return make_tuple(kInlineValueFlag | value.size(), words[0], words[1]);
+  }
 
-    tuple<uint64_t, uint64_t, uint64_t> location(current_fileID_,
-                                                 current_offset_, record_size);
+  static string InlineValue(
+      const tuple<uint64_t, uint64_t, uint64_t>& location) {
+    uint64_t words[2] = {get<1>(location), get<2>(location)};
+    return string(reinterpret_cast<const char*>(words),
+                  get<0>(location) & ~kInlineValueFlag);
+  }
 
-    current_offset_ += record_size;  // update current offset
+  tuple<uint64_t, uint64_t, uint64_t> WriteValue(uint64_t version,
+                                                 const string& key,
+                                                 const string& value);
 
-    file.close();
+  // append the records of a batch of keys and values, given as pointers into
+  // the caller's strings. the offsets of a run of records that fits into the
+  // current data file are computed first and the run is then copied into the
+  // mapping in one pass, the batch goes on in the next data file after it.
+  // inline values and values found by deduplication are not written, a value
+  // that repeats in the batch takes the location of its first record.
+  vector<tuple<uint64_t, uint64_t, uint64_t>> WriteValues(
+      uint64_t version,
+      const vector<pair<const string*, const string*>>& records);
 
-    return location;
-  }
+  string ReadValue(const tuple<uint64_t, uint64_t, uint64_t>& location);
 
-  // vector<tuple<uint64_t, uint64_t, uint64_t>> WriteValues(
-  //     uint64_t version, const vector<string>& key,
-  //     const vector<string>& value) {  // append a new record to the log
-  //     stream
-  //   string version_str = to_string(version);
-  //   size_t record_size =
-  //       version_str.size() + key[0].size() + value[0].size() + 3;
-  //   if (current_offset_ + record_size * key.size() > MaxFileSize) {
-  //     current_fileID_++;
-  //     current_offset_ = 0;
-  //   }
+  // the value in the mapping of its data file, without a copy. an inline
+  // value is copied into the holder.
+  ValueView ReadValueView(const tuple<uint64_t, uint64_t, uint64_t>& location);
 
-  //   ofstream file(
-  //       file_path_ + "data_file_" + to_string(current_fileID_) + ".dat",
-  //       ios::app);  // create or open the file for appending
-  //   if (!file) {
-  //     throw std::runtime_error("Cannot open file ");
-  //   }
+  // check the header and the checksum of the record at location
+  bool VerifyRecord(const tuple<uint64_t, uint64_t, uint64_t>& location);
 
-  //   string content = "";
-  //   vector<tuple<uint64_t, uint64_t, uint64_t>> locations;
-  //   for (int i = 0; i < key.size(); i++) {
-  //     content += version_str + "," + key[i] + "," + value[i] + "\n";
-  //     current_offset_ += record_size;
-  //     locations.push_back(
-  //         make_tuple(current_fileID_, current_offset_, record_size));
-  //   }
+  // read a batch of values, see ReadValuesAsync. the caller reads the first
+  // run itself while the read threads take the others. values are returned
+  // in the order of locations.
+  vector<string> ReadValues(
+      const vector<tuple<uint64_t, uint64_t, uint64_t>>& locations);
 
-  //   file << content;
+  // start reading the values at locations into values, which the caller
+  // keeps until the batch is done. the locations are read in file and offset
+  // order, neighbours in a data file by one pread on a read thread.
+  shared_ptr<ReadBatch> ReadValuesAsync(
+      const vector<tuple<uint64_t, uint64_t, uint64_t>>& locations,
+      vector<string>& values);
 
-  //   file.close();
+  // the number of read threads, 0 reads every batch in the caller. not to be
+  // called while reads are submitted.
+  void SetReadThreads(size_t num_threads);
 
-  //   return locations;
-  // }
+  void SetDurability(DurabilityPolicy policy, uint64_t interval_ms = 0);
 
-  string ReadValue(const tuple<uint64_t, uint64_t, uint64_t>& location) {
-    uint64_t fileID, offset, size;
-    tie(fileID, offset, size) = location;
+  DurabilityPolicy GetDurability();
 
-    // 检查是否需要重新映射文件
-    if (fileID != read_map_fileID_) {
-      if (read_map_ != MAP_FAILED) {
-        munmap(read_map_, MaxFileSize);
-        read_map_ = MAP_FAILED;
-      }
-      OpenAndMapReadFile(fileID);
-      read_map_fileID_ = fileID;
-    }
+  // all values of version are written. under group commit their sync starts
+  // right away on the background thread, WaitDurable waits for it.
+  void CommitVersion(uint64_t version);
 
-    // 从映射区域读取数据
-    string line(static_cast<char*>(read_map_) + offset, size);
+  // wait until the values of version, or of the last committed version if
+  // it is older, are synced. the sync is started if it is not queued yet.
+  void WaitDurable(uint64_t version);
 
-    stringstream ss(line);
-    string temp, value;
+  // the latest version whose values are all synced
+  uint64_t GetDurableVersion();
 
-    getline(ss, temp, ',');  // 版本号
-    getline(ss, temp, ',');  // 键
-    getline(ss, value);      // 值
+  // index the values of at least min_value_size bytes in a table of
+  // table_entries slots (rounded up to a power of two, 32 bytes each) by the
+  // hash of the value, a slot keeps the last value written with its hash.
+  // no table_entries turn deduplication off.
+  void SetDedup(size_t table_entries,
+                size_t min_value_size = kDefaultDedupMinValueSize);
 
-    return value;
-  }
+  // keep values of at most max_size bytes, up to kMaxInlineValueSize, in
+  // their locations from now on. 0 writes a record for every value.
+  void SetInlineValueSize(size_t max_size);
 
-  string ReadValueV1(const tuple<uint64_t, uint64_t, uint64_t>& location) {
-    uint64_t fileID, offset, size;
-    tie(fileID, offset, size) = location;
+  // which reads check the checksums of their records, see ChecksumPolicy.
+  // VerifyRecord always checks it.
+  void SetChecksumVerify(ChecksumVerify mode, uint32_t sample_rate);
 
-    ifstream file(file_path_ + "data_file_" + to_string(fileID) + ".dat");
-    if (!file) {
-      throw runtime_error("Cannot open file");
-    }
+  // compress the data files retired from now on with codec, in blocks of
+  // about block_size bytes of records. false if codec is not built in.
+  bool SetCompression(CompressionCodec codec,
+                      size_t block_size = kDefaultBlockSize);
 
-    file.seekg(offset, ios::beg);  // locate the correct offset
+  // bytes of decompressed blocks kept for reads
+  void SetBlockCacheBudget(size_t bytes);
 
-    string line;
-    getline(file, line);
+  // bytes per second the background thread reads and writes to compress and
+  // collect data files, 0 for no limit
+  void SetRewriteRateLimit(uint64_t bytes_per_second);
 
-    stringstream ss(line);
-    string temp, value;
+  // queue the retired data files of which at least dead_ratio of the stored
+  // record bytes are not in live for rewriting by the background thread, and
+  // return their number. live must hold every record the retained versions
+  // locate. called by the writer between commits, the values of the data
+  // files found by deduplication are forgotten, since they may not be live.
+  size_t CollectGarbage(LiveRecords& live,
+                        double dead_ratio = kDefaultGcDeadRatio);
 
-    getline(ss, temp, ',');
-    getline(ss, temp, ',');
-    getline(ss, value);
+  GcStats GetGcStats() const;
 
-    file.close();
+  DedupStats GetDedupStats() const;
+
+  // the read mappings of older data files are evicted in LRU order once there
+  // are more than max_segments of them or they map more than max_bytes
+  void SetReadMapBudget(size_t max_segments, size_t max_bytes);
 
-    return value;
-  }
 
   // string ReadValueFromBuffer(
   //     const tuple<uint64_t, uint64_t, uint64_t>& location) {
@@ -239,6 +325,53 @@ class VDLS {
   // }
 
  private:
+  // a data file being rewritten block by block, with all records of a plain
+  // file up to length when it is compressed or the given records when it is
+  // collected
+  struct RewriteTask {
+    uint64_t fileID;
+    shared_ptr<const Segment> source;
+    bool all_records;
+    uint64_t length;
+    vector<pair<uint64_t, uint64_t>> records;
+    uint64_t position;  // offset or index of the next record
+    CompressionCodec codec;
+    size_t block_size;
+    uint64_t physical_offset;
+    vector<Block> blocks;
+    int fd;
+  };
+
+  // a slot of the deduplication table, a slot without a record is empty
+  struct DedupEntry {
+    uint64_t value_hash;
+    tuple<uint64_t, uint64_t, uint64_t> location;
+  };
+
+  // a range of a data file for the background thread to sync. the jobs run
+  // in order, version is durable once its job is done (0 for none).
+  struct SyncJob {
+    shared_ptr<Segment> segment;
+    uint64_t fileID;
+    uint64_t from;
+    uint64_t to;
+    bool retire;  // a data file retired by RollOver, cut it to its length
+    uint64_t version;
+  };
+
+  // neighbouring records of a data file that are read together, with the
+  // indexes of their values in the batch
+  struct ReadRun {
+    shared_ptr<const Segment> segment;
+    uint64_t fileID;
+    uint64_t offset;
+    uint64_t length;
+    vector<pair<size_t, tuple<uint64_t, uint64_t, uint64_t>>> records;
+    vector<string>* values;
+    shared_ptr<ReadBatch> batch;
+    bool mapped;  // read through the mapping instead of pread
+  };
+
   string file_path_;
   uint64_t current_fileID_;
   uint64_t current_offset_;
@@ -248,63 +381,220 @@ class VDLS {
   // int64_t buffer_offset_;
   // const uint64_t MaxBufferSize = 12 * 1024 * 1024;  // 12MB
   // uint64_t BufferSize;
-  void* write_map_;
-  void* read_map_;
-  int64_t read_map_fileID_;
-
-  void OpenAndMapWriteFile() {
-    string filename =
-        file_path_ + "data_file_" + to_string(current_fileID_) + ".dat";
-
-    // 打开或创建文件
-    int fd = open(filename.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-    if (fd == -1) {
-      throw runtime_error("Cannot open or create file: " + filename);
-    }
-
-    // 确保文件至少有 MaxFileSize 大小
-    ftruncate(fd, MaxFileSize);
-
-    // 内存映射文件为写映射区域
-    write_map_ =
-        mmap(nullptr, MaxFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (write_map_ == MAP_FAILED) {
-      close(fd);
-      throw runtime_error("Memory map for writing failed: " + filename);
-    }
-
-    // 关闭文件描述符，因为已经映射了文件
-    close(fd);
-  }
+  // the current data file, readers share it with the writer
+  shared_ptr<Segment> write_segment_;
+  // read mappings of older data files by fileID, most recently used first
+  list<pair<uint64_t, shared_ptr<const Segment>>> read_maps_;
+  unordered_map<uint64_t,
+                list<pair<uint64_t, shared_ptr<const Segment>>>::iterator>
+      read_map_index_;
+  size_t max_read_segments_;
+  size_t max_read_map_bytes_;
+  size_t read_map_bytes_;
+  // data files retired by RollOver until the background thread synced them
+  unordered_map<uint64_t, shared_ptr<const Segment>> retiring_segments_;
+  // guards the mappings and current_fileID_ for readers
+  mutex read_mutex_;
+
+  // the background thread and the work it shares with the writer
+  thread background_thread_;
+  mutex background_mutex_;
+  condition_variable background_cv_;
+  condition_variable segment_ready_cv_;
+  shared_ptr<Segment> next_segment_;  // mapping of data file next_fileID_
+  uint64_t next_fileID_;
+  deque<SyncJob> sync_queue_;
+  exception_ptr background_error_;
+  bool stop_background_;
+
+  // durability, guarded by background_mutex_ as well
+  DurabilityPolicy durability_;
+  chrono::milliseconds sync_interval_;
+  SyncJob pending_sync_;  // the last committed version, not queued yet
+  bool has_pending_sync_;
+  uint64_t queued_fileID_;  // the queued syncs reach up to this offset
+  uint64_t queued_offset_;
+  uint64_t written_version_;
+  uint64_t durable_version_;
+  condition_variable durable_cv_;
+
+  // the manifest, only written by the background thread after it is opened
+  static constexpr size_t kManifestSlotSize = 64;
+  static constexpr uint64_t kManifestMagic = 0x314e414d534c4456ULL;  // VDLSMAN1
+  uint64_t synced_version_;  // synced, but maybe not in the manifest yet
+  int manifest_fd_;
+  uint64_t manifest_seq_;
+
+  // deduplication, only used by the writer
+  vector<DedupEntry> dedup_table_;
+  size_t dedup_min_value_size_;
+  size_t inline_value_size_;  // 0 keeps every value in a record
+  ChecksumPolicy checksum_policy_;
+  atomic<uint64_t> dedup_hits_;
+  atomic<uint64_t> dedup_saved_bytes_;
+
+  // rewrites of data files by the background thread, guarded by
+  // background_mutex_, and the decompressed blocks by segment id << 32 | block
+  static constexpr size_t kFooterSize = 32;
+  static constexpr size_t kBlockEntrySize = 24;
+  static constexpr uint64_t kCompressedMagic = 0x314b4c42534c4456ULL;  // VDLSBLK1
+  CompressionCodec compression_codec_;
+  size_t compression_block_size_;
+  deque<RewriteTask> rewrite_queue_;
+  list<pair<uint64_t, shared_ptr<const string>>> block_cache_;
+  unordered_map<uint64_t,
+                list<pair<uint64_t, shared_ptr<const string>>>::iterator>
+      block_cache_index_;
+  size_t block_cache_bytes_;
+  size_t max_block_cache_bytes_;
+  mutex block_cache_mutex_;
+  atomic<uint64_t> next_segment_id_;
+  uint64_t rewrite_rate_;
+  chrono::steady_clock::time_point rewrite_ready_time_;
+  atomic<uint64_t> gc_files_;
+  atomic<uint64_t> gc_reclaimed_bytes_;
+
+  // the read threads, started by the first batch, and their runs
+  vector<thread> read_threads_;
+  deque<ReadRun> read_queue_;
+  mutex read_queue_mutex_;
+  condition_variable read_queue_cv_;
+  size_t num_read_threads_;
+  bool stop_reads_;
+
+  ValueView ReadValueView(const tuple<uint64_t, uint64_t, uint64_t>& location,
+                          shared_ptr<const Segment> segment);
+
+  // the value of the record at location, its header must match the size.
+  // the checksum is checked if the checksum policy picks the read.
+  string_view RecordValue(const char* record,
+                          const tuple<uint64_t, uint64_t, uint64_t>& location);
+
+  // whether the checksum of a record matches its header, key and value
+  static bool RecordChecksumMatches(const char* record, size_t data_size);
+
+  // split the sorted locations into runs and hand them to the read threads.
+  // the caller copies the runs that are in memory, and reads the first of
+  // the others if read_first is set and all of them if there are no read
+  // threads.
+  shared_ptr<ReadBatch> SubmitReads(
+      const vector<tuple<uint64_t, uint64_t, uint64_t>>& locations,
+      vector<string>& values, bool read_first);
+
+  // mark the runs in [begin, end) of a plain data file whose pages are all
+  // in memory, one mincore covers the pages of all of them
+  static void MarkResidentRuns(vector<ReadRun>& runs, size_t begin,
+                               size_t end);
+
+  // the io_uring of a read thread, empty unless built with
+  // LETUS_WITH_IO_URING
+  struct IoRing;
+
+  void ReadLoop();
+
+  // read the runs a read thread took off the queue, on ring if there is one.
+  // false if the ring failed, the runs are then read with pread.
+  bool ReadRuns(vector<ReadRun>& runs, IoRing* ring);
+
+  // read the records of run into the values of its batch, an error is
+  // handed to the batch
+  void ReadRunValues(ReadRun& run);
+
+  // copy the values of the records of run out of buffer, which holds the
+  // bytes of the run
+  void CopyRunValues(ReadRun& run, const char* buffer);
+
+  // the read threads finish the queued runs before they stop
+  void StopReadThreads();
+
+  // the record at location in segment, or in the decompressed block of it,
+  // which holder keeps. nullptr if the location is outside of the file.
+  const char* FindRecord(const tuple<uint64_t, uint64_t, uint64_t>& location,
+                         shared_ptr<const Segment> segment,
+                         shared_ptr<const void>& holder);
+
+  shared_ptr<const string> GetBlock(size_t index, const Segment& segment);
+
+  void EvictBlocks();
+
+  bool IsInlineCandidate(const string& value) const;
+
+  bool IsDedupCandidate(const string& value) const;
+
+  // the location of a record with the same value, the bytes are compared
+  // since different values may share a hash
+  bool FindDuplicate(const string& value, uint64_t value_hash,
+                     tuple<uint64_t, uint64_t, uint64_t>& location);
+
+  void AddDedupEntry(uint64_t value_hash,
+                     const tuple<uint64_t, uint64_t, uint64_t>& location);
+
+  // write a record at record and return the end of it
+  static char* WriteRecord(char* record, uint64_t version, const string& key,
+                           const string& value);
 
-  void OpenAndMapReadFile(uint64_t fileID) {
-    string filename = file_path_ + "data_file_" + to_string(fileID) + ".dat";
-
-    // 打开文件
-    int fd = open(filename.c_str(), O_RDONLY);
-    if (fd == -1) {
-      throw runtime_error("Cannot open file for reading: " + filename);
-    }
-
-    // // 获取文件大小
-    // struct stat sb;
-    // if (fstat(fd, &sb) == -1) {
-    //     close(fd);
-    //     throw runtime_error("Cannot get file size: " + filename);
-    // }
-    // // 内存映射文件为读映射区域，根据实际文件大小映射
-    // read_map_ = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
-
-    // 直接映射MaxFileSize文件大小
-    read_map_ = mmap(nullptr, MaxFileSize, PROT_READ, MAP_SHARED, fd, 0);
-    if (read_map_ == MAP_FAILED) {
-      close(fd);
-      throw runtime_error("Memory map for reading failed: " + filename);
-    }
-
-    // 关闭文件描述符，因为已经映射了文件
-    close(fd);
-  }
+  // the mapping to read a data file from
+  shared_ptr<const Segment> GetSegment(uint64_t fileID);
+
+  void EvictReadMaps();
+
+  // go on with the next data file, the background thread has prepared it
+  // and syncs the retired one
+  void RollOver();
+
+  // queue the sync of the last committed version, background_mutex_ is held
+  void QueuePendingSync();
+
+  // the range synced by the queued jobs of the same file is skipped
+  void QueueSync(SyncJob job);
+
+  void BackgroundLoop();
+
+  // sync the range of the job. a retired data file is then cut to the bytes
+  // written and readers map it at its length through the read mappings.
+  void Sync(const SyncJob& job);
+
+  // write the next block of records of the task, or write the index and
+  // footer and replace the data file by the rewritten one. true when done,
+  // bytes are the record bytes moved.
+  bool RewriteBlock(RewriteTask& task, uint64_t& bytes);
+
+  // the next record of the task, false after the last one
+  bool PeekRecord(const RewriteTask& task, uint64_t& offset, uint64_t& size);
+
+  void AbandonRewrite(RewriteTask& task);
+
+  static void ReadAll(int fd, char* data, size_t size, uint64_t offset,
+                      uint64_t fileID);
+
+  static void WriteAll(int fd, const char* data, size_t size,
+                       const string& filename);
+
+  // load the last slot of the manifest with a valid checksum, the manifest
+  // is created if the directory has none
+  void OpenManifest();
+
+  void WriteManifest(uint64_t fileID, uint64_t offset, uint64_t version);
+
+  // the end of the complete records from offset on in a data file mapped for
+  // writing, a torn record ends the scan and is written over. the manifest
+  // lags behind the records unless every version is synced, so the scan
+  // goes on to the end of the file.
+  uint64_t ScanTail(const Segment& segment, uint64_t offset);
+
+  // the manifest records a rollover after the retired data file is synced.
+  // if the writer went on in the next data file before that, its records
+  // are kept and the retired file is synced and cut now.
+  void RecoverRollOvers();
+
+  // map a data file for writing, the next data file is allocated on disk and
+  // its pages are faulted in up front
+  shared_ptr<Segment> OpenAndMapWriteFile(uint64_t fileID, bool populate);
+
+  // map a data file for reading, its compressed version if there is one
+  shared_ptr<const Segment> OpenAndMapReadFile(uint64_t fileID);
+
+  shared_ptr<const Segment> OpenAndMapCompressedFile(uint64_t fileID);
 };
 
-#endif
\ No newline at end of file
+#endif
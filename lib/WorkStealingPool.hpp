@@ -0,0 +1,217 @@
+#ifndef _WORKSTEALINGPOOL_HPP_
+#define _WORKSTEALINGPOOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed-size worker pool running one tree-shaped job at a time. a task may
+// spawn more tasks, which go to the deque of the thread running it. a thread
+// takes its newest task first (depth first) and steals the oldest task of
+// another thread when its own deque is empty. like ThreadPool, the caller of
+// Run works as well, so a pool of size 1 runs everything inline.
+class WorkStealingPool {
+ public:
+  using Task = std::function<void()>;
+
+  explicit WorkStealingPool(size_t num_threads = 1)
+      : num_threads_(num_threads == 0 ? 1 : num_threads),
+        pending_(0),
+        queued_(0),
+        idle_(0),
+        failed_(false),
+        generation_(0),
+        running_workers_(0),
+        stop_(false) {
+    for (size_t i = 0; i < num_threads_; i++) {
+      queues_.emplace_back(new Queue());
+    }
+    for (size_t i = 1; i < num_threads_; i++) {
+      workers_.emplace_back([this, i]() { WorkerLoop(i); });
+    }
+  }
+
+  ~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    job_cv_.notify_all();
+    for (auto &worker : workers_) {
+      worker.join();
+    }
+  }
+
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  size_t Size() const { return num_threads_; }
+
+  // run task and every task spawned below it, and return after all of them
+  // finished. after the first exception thrown by a task the tasks not
+  // started yet are dropped, and the exception is rethrown to the caller.
+  void Run(Task task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      failed_.store(false);
+      error_ = nullptr;
+    }
+    Push(0, std::move(task));
+    if (!workers_.empty()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_workers_ = workers_.size();
+        generation_++;
+      }
+      job_cv_.notify_all();
+    }
+
+    Work(0);  // the calling thread works as well
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this]() { return running_workers_ == 0; });
+    if (error_) {
+      std::exception_ptr error = error_;
+      error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+  // queue a task of the running job, called by its tasks
+  void Spawn(Task task) {
+    const Worker &worker = CurrentWorker();
+    Push(worker.pool == this ? worker.index : 0, std::move(task));
+  }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // the pool and deque of the calling thread while it runs tasks
+  struct Worker {
+    WorkStealingPool *pool;
+    size_t index;
+  };
+
+  static Worker &CurrentWorker() {
+    static thread_local Worker worker{nullptr, 0};
+    return worker;
+  }
+
+  void Push(size_t index, Task task) {
+    pending_.fetch_add(1);
+    {
+      std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+      queues_[index]->tasks.push_back(std::move(task));
+    }
+    queued_.fetch_add(1);
+    if (idle_.load() > 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      work_cv_.notify_one();
+    }
+  }
+
+  // the newest task of the own deque, else the oldest one of another deque
+  bool Pop(size_t index, Task &task) {
+    for (size_t i = 0; i < num_threads_; i++) {
+      size_t victim = (index + i) % num_threads_;
+      Queue &queue = *queues_[victim];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tasks.empty()) {
+        continue;
+      }
+      if (i == 0) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+      } else {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      }
+      queued_.fetch_sub(1);
+      return true;
+    }
+    return false;
+  }
+
+  // run tasks until every task of the job finished
+  void Work(size_t index) {
+    Worker &worker = CurrentWorker();
+    Worker outer = worker;
+    worker = {this, index};
+    while (pending_.load() > 0) {
+      Task task;
+      if (!Pop(index, task)) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.fetch_add(1);
+        work_cv_.wait(lock, [this]() {
+          return queued_.load() > 0 || pending_.load() == 0;
+        });
+        idle_.fetch_sub(1);
+        continue;
+      }
+      if (!failed_.load()) {
+        try {
+          task();
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (!error_) error_ = std::current_exception();
+          failed_.store(true);
+        }
+      }
+      task = nullptr;
+      if (pending_.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        work_cv_.notify_all();
+      }
+    }
+    worker = outer;
+  }
+
+  void WorkerLoop(size_t index) {
+    uint64_t seen_generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        job_cv_.wait(lock, [&]() {
+          return stop_ || generation_ != seen_generation;
+        });
+        if (stop_) return;
+        seen_generation = generation_;
+      }
+      Work(index);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--running_workers_ == 0) {
+          done_cv_.notify_one();
+        }
+      }
+    }
+  }
+
+  const size_t num_threads_;
+  std::vector<std::unique_ptr<Queue>> queues_;  // one per thread
+  std::vector<std::thread> workers_;
+  std::atomic<size_t> pending_;  // tasks queued or running
+  std::atomic<size_t> queued_;   // tasks in the deques
+  std::atomic<size_t> idle_;     // threads waiting for a task
+  std::atomic<bool> failed_;
+  std::mutex mutex_;
+  std::condition_variable job_cv_;   // workers wait for a new job
+  std::condition_variable work_cv_;  // threads of the job wait for tasks
+  std::condition_variable done_cv_;  // caller waits for the workers
+  uint64_t generation_;
+  size_t running_workers_;
+  std::exception_ptr error_;
+  bool stop_;
+};
+
+#endif
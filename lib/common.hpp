@@ -1,10 +1,28 @@
 #ifndef _COMMON_H_
 #define _COMMON_H_
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <string>
 
+#include "Crc32c.hpp"
+
 static constexpr int PAGE_SIZE = 12288;  // 每个页面的大小为12KB
+// the last 4 bytes of a page hold the CRC32C of the bytes before them
+static constexpr int PAGE_CHECKSUM_OFFSET = PAGE_SIZE - sizeof(uint32_t);
+
+// write the CRC32C of the first size - 4 bytes of a page or block into its
+// last 4 bytes
+inline void SealChecksum(char* data, size_t size) {
+  uint32_t checksum = Crc32c(data, size - sizeof(uint32_t));
+  memcpy(data + size - sizeof(uint32_t), &checksum, sizeof(uint32_t));
+}
+
+inline bool ChecksumMatches(const char* data, size_t size) {
+  uint32_t checksum;
+  memcpy(&checksum, data + size - sizeof(uint32_t), sizeof(uint32_t));
+  return checksum == Crc32c(data, size - sizeof(uint32_t));
+}
 
 // PageKey结构体
 struct PageKey {
@@ -0,0 +1,120 @@
+#include "Codec.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#ifdef LETUS_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef LETUS_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef LETUS_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+bool CodecAvailable(CompressionCodec codec) {
+  switch (codec) {
+    case CompressionCodec::kNone:
+      return true;
+#ifdef LETUS_WITH_LZ4
+    case CompressionCodec::kLz4:
+      return true;
+#endif
+#ifdef LETUS_WITH_ZSTD
+    case CompressionCodec::kZstd:
+      return true;
+#endif
+#ifdef LETUS_WITH_ZLIB
+    case CompressionCodec::kZlib:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+void Compress(CompressionCodec codec, const char *data, size_t size,
+              std::string &out) {
+  switch (codec) {
+    case CompressionCodec::kNone:
+      out.assign(data, size);
+      return;
+#ifdef LETUS_WITH_LZ4
+    case CompressionCodec::kLz4: {
+      out.resize(LZ4_compressBound(size));
+      int n = LZ4_compress_default(data, &out[0], size, out.size());
+      if (n <= 0) {
+        throw std::runtime_error("LZ4 compression failed");
+      }
+      out.resize(n);
+      return;
+    }
+#endif
+#ifdef LETUS_WITH_ZSTD
+    case CompressionCodec::kZstd: {
+      out.resize(ZSTD_compressBound(size));
+      size_t n = ZSTD_compress(&out[0], out.size(), data, size, 1);
+      if (ZSTD_isError(n)) {
+        throw std::runtime_error("zstd compression failed");
+      }
+      out.resize(n);
+      return;
+    }
+#endif
+#ifdef LETUS_WITH_ZLIB
+    case CompressionCodec::kZlib: {
+      uLongf n = compressBound(size);
+      out.resize(n);
+      if (compress2(reinterpret_cast<Bytef *>(&out[0]), &n,
+                    reinterpret_cast<const Bytef *>(data), size,
+                    Z_BEST_SPEED) != Z_OK) {
+        throw std::runtime_error("zlib compression failed");
+      }
+      out.resize(n);
+      return;
+    }
+#endif
+    default:
+      throw std::runtime_error("Compression codec is not built in");
+  }
+}
+
+void Decompress(CompressionCodec codec, const char *data, size_t size,
+                char *out, size_t raw_size) {
+  bool ok = false;
+  switch (codec) {
+    case CompressionCodec::kNone:
+      ok = size == raw_size;
+      if (ok) {
+        memcpy(out, data, size);
+      }
+      break;
+#ifdef LETUS_WITH_LZ4
+    case CompressionCodec::kLz4:
+      ok = LZ4_decompress_safe(data, out, size, raw_size) ==
+           static_cast<int>(raw_size);
+      break;
+#endif
+#ifdef LETUS_WITH_ZSTD
+    case CompressionCodec::kZstd:
+      ok = ZSTD_decompress(out, raw_size, data, size) == raw_size;
+      break;
+#endif
+#ifdef LETUS_WITH_ZLIB
+    case CompressionCodec::kZlib: {
+      uLongf n = raw_size;
+      ok = uncompress(reinterpret_cast<Bytef *>(out), &n,
+                      reinterpret_cast<const Bytef *>(data), size) == Z_OK &&
+           n == raw_size;
+      break;
+    }
+#endif
+    default:
+      throw std::runtime_error("Compression codec is not built in");
+  }
+  if (!ok) {
+    throw std::runtime_error("Corrupted compressed block");
+  }
+}
+
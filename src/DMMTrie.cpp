@@ -1,11 +1,15 @@
 #include "DMMTrie.hpp"
 
-#include <openssl/evp.h>
-#include <openssl/sha.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <list>
@@ -20,31 +24,14 @@
 
 using namespace std;
 
-// string HashFunction(const string &input) {  // hash function SHA-256
-//   EVP_MD_CTX *ctx = EVP_MD_CTX_new();       // create SHA-256 context
-
-//   // initialize SHA-256 hash computation
-//   EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
-
-//   // update the hash with input string
-//   EVP_DigestUpdate(ctx, input.c_str(), input.size());
-
-//   unsigned char hash[EVP_MAX_MD_SIZE];
-//   unsigned int hash_len = 0;
-
-//   EVP_DigestFinal_ex(ctx, hash, &hash_len);
-
-//   EVP_DigestFinal_ex(ctx, hash, &hash_len);
-//   EVP_MD_CTX_free(ctx);
-
-//   return string(reinterpret_cast<char *>(hash), hash_len);
-// }
+string HashFunction(const string &input) {
+  return HashFunction(input.data(), input.size());
+}
 
-string HashFunction(const string &input) { // SHA 1
-  unsigned char hash[SHA_DIGEST_LENGTH];
-  SHA1(reinterpret_cast<const unsigned char*>(input.c_str()),
-        input.size(), hash);
-  return string(reinterpret_cast<char *>(hash), SHA_DIGEST_LENGTH);
+string HashFunction(const char *input, size_t size) {
+  unsigned char hash[HASH_SIZE];
+  TrieHash::Digest(input, size, hash);
+  return string(reinterpret_cast<char *>(hash), HASH_SIZE);
 }
 
 auto CompareStrings = [](const std::string &a, const std::string &b) {
@@ -84,10 +71,16 @@ int DMMTrieProof::serial_size() {
   for (NodeProof elem: proofs) {
     size += elem.serial_size(); // size of each node proof
   }
-  size += 32; // size of the root hash value
+  size += HASH_SIZE; // size of the root hash value
   return size;
 }
 
+// heap bytes of a string, short strings are stored in the string itself
+static size_t StringHeapSize(const string &s) {
+  static const size_t inline_capacity = string().capacity();
+  return s.capacity() > inline_capacity ? s.capacity() + 1 : 0;
+}
+
 void Node::CalculateHash() {}
 void Node::AddChild(int index, Node *child, uint64_t version,
                     const string &hash) {}
@@ -98,6 +91,7 @@ string Node::GetChildHash(int index) {}
 uint64_t Node::GetChildVersion(int index) {}
 void Node::UpdateNode() {}
 void Node::SetLocation(tuple<uint64_t, uint64_t, uint64_t> location) {}
+size_t Node::HeapSize() const { return 0; }
 NodeProof Node::GetNodeProof(int level, int index) {}
 
 LeafNode::LeafNode(uint64_t V, const string &k,
@@ -112,7 +106,7 @@ void LeafNode::CalculateHash(const string &value) {
 
 /* serialized leaf node format (size in bytes):
    | is_leaf_node (1) | version (8) | key_size (8 in 64-bit system) | key
-   (key_size) | location(8, 8, 8) | hash (32) |
+   (key_size) | location(8, 8, 8) | hash (HASH_SIZE) |
 */
 void LeafNode::SerializeTo(char *buffer, size_t &current_size,
                            bool is_root) const {
@@ -139,7 +133,7 @@ void LeafNode::SerializeTo(char *buffer, size_t &current_size,
          sizeof(uint64_t));  // size
   current_size += sizeof(uint64_t);
 
-  memcpy(buffer + current_size, hash_.c_str(), hash_.size());
+  WriteHash(buffer + current_size, hash_);
   current_size += HASH_SIZE;
 }
 
@@ -166,7 +160,7 @@ void LeafNode::DeserializeFrom(char *buffer, size_t &current_size,
   current_size += sizeof(uint64_t);
   location_ = make_tuple(fileID, offset, size);
 
-  hash_ = string(buffer + current_size, HASH_SIZE);  // deserialize hash
+  hash_ = ReadHash(buffer + current_size);  // deserialize hash
   current_size += HASH_SIZE;
 }
 
@@ -198,6 +192,10 @@ void LeafNode::SetLocation(tuple<uint64_t, uint64_t, uint64_t> location) {
   location_ = location;
 }
 
+size_t LeafNode::HeapSize() const {
+  return StringHeapSize(key_) + StringHeapSize(hash_);
+}
+
 string LeafNode::GetHash() { return hash_; }
 uint64_t LeafNode::GetVersion() { return version_; }
 void LeafNode::SetVersion(uint64_t version) { version_ = version; }
@@ -206,63 +204,64 @@ void LeafNode::SetHash(string hash) { hash_ = hash; }
 bool LeafNode::IsLeaf() const { return is_leaf_; }
 
 IndexNode::IndexNode(uint64_t V, const string &h, uint16_t b)
-    : version_(V), hash_(h), bitmap_(b), is_leaf_(false) {
-  for (size_t i = 0; i < DMM_NODE_FANOUT; i++) {
-    children_[i] =
-        make_tuple(0, "", nullptr);  // initialize children to default
-  }
+    : version_(V), hash_(h), bitmap_(b), hash_bitmap_(0), is_leaf_(false) {
+  // initialize children to default
+  memset(child_versions_, 0, sizeof(child_versions_));
+  memset(child_nodes_, 0, sizeof(child_nodes_));
+  memset(child_hashes_, 0, sizeof(child_hashes_));
 }
 
-IndexNode::IndexNode(
-    uint64_t version, const string &hash, uint16_t bitmap,
-    const array<tuple<uint64_t, string, Node *>, DMM_NODE_FANOUT> &children)
-    : version_(version),
-      hash_(hash),
-      bitmap_(bitmap),
-      children_(children),
-      is_leaf_(false) {}
-
-IndexNode::IndexNode(const IndexNode &other)
+IndexNode::IndexNode(const IndexNode &other, Arena &arena)
     : version_(other.version_),
       hash_(other.hash_),
       bitmap_(other.bitmap_),
+      hash_bitmap_(other.hash_bitmap_),
       is_leaf_(other.is_leaf_) {
-  // Deep copy children array
+  memcpy(child_versions_, other.child_versions_, sizeof(child_versions_));
+  memcpy(child_hashes_, other.child_hashes_, sizeof(child_hashes_));
+  // Deep copy children nodes
   for (size_t i = 0; i < DMM_NODE_FANOUT; i++) {
-    if (other.HasChild(i)) {
-      Node *child = other.GetChild(i);
-      if (child != nullptr) {
-        if (child->IsLeaf()) {
-          children_[i] =
-              make_tuple(get<0>(other.children_[i]), get<1>(other.children_[i]),
-                         new LeafNode(*dynamic_cast<LeafNode *>(child)));
-        } else {
-          children_[i] =
-              make_tuple(get<0>(other.children_[i]), get<1>(other.children_[i]),
-                         new IndexNode(*dynamic_cast<IndexNode *>(child)));
-        }
-      } else {
-        children_[i] = make_tuple(get<0>(other.children_[i]),
-                                  get<1>(other.children_[i]), nullptr);
-      }
-
+    Node *child = other.HasChild(i) ? other.child_nodes_[i] : nullptr;
+    if (child == nullptr) {
+      child_nodes_[i] = nullptr;
+    } else if (child->IsLeaf()) {
+      child_nodes_[i] = arena.New<LeafNode>(*static_cast<LeafNode *>(child));
     } else {
-      children_[i] = make_tuple(0, "", nullptr);
+      child_nodes_[i] =
+          arena.New<IndexNode>(*static_cast<IndexNode *>(child), arena);
     }
   }
 }
 
 void IndexNode::CalculateHash() {
-  string concatenated_hash;
+  // non-empty children hashes are concatenated into a fixed buffer, empty
+  // hashes of deleted or missing children contribute nothing
+  char buffer[DMM_NODE_FANOUT * HASH_SIZE];
+  size_t size = 0;
   for (int i = 0; i < DMM_NODE_FANOUT; i++) {
-    concatenated_hash += get<1>(children_[i]);
+    if (hash_bitmap_ & (1 << i)) {
+      memcpy(buffer + size, child_hashes_[i], HASH_SIZE);
+      size += HASH_SIZE;
+    }
+  }
+  hash_ = HashFunction(buffer, size);
+}
+
+void IndexNode::SetChildHash(int index, const string &hash) {
+  if (hash.empty()) {
+    memset(child_hashes_[index], 0, HASH_SIZE);
+    hash_bitmap_ &= ~(1 << index);
+  } else if (hash.size() == HASH_SIZE) {
+    memcpy(child_hashes_[index], hash.data(), HASH_SIZE);
+    hash_bitmap_ |= (1 << index);
+  } else {
+    throw runtime_error("child hash size doesn't match HASH_SIZE");
   }
-  hash_ = HashFunction(concatenated_hash);
 }
 
 /* serialized index node format (size in bytes):
-   | is_leaf_node (1) | version (8) | hash (32) | bitmap (2) | Vc (8) | Hc
-   (32) | Vc (8) | Hc (32) | ... | child 1 | child 2 | ...
+   | is_leaf_node (1) | version (8) | hash (HASH_SIZE) | bitmap (2) | Vc (8) |
+   Hc (HASH_SIZE) | Vc (8) | Hc (HASH_SIZE) | ... | child 1 | child 2 | ...
    the function doesn't serialize pointer and doesn't serialize empty child
    nodes
 */
@@ -275,7 +274,7 @@ void IndexNode::SerializeTo(char *buffer, size_t &current_size,
   memcpy(buffer + current_size, &version_, sizeof(uint64_t));
   current_size += sizeof(uint64_t);
 
-  memcpy(buffer + current_size, hash_.c_str(), hash_.size());
+  WriteHash(buffer + current_size, hash_);
   current_size += HASH_SIZE;
 
   memcpy(buffer + current_size, &bitmap_, sizeof(uint16_t));
@@ -283,12 +282,10 @@ void IndexNode::SerializeTo(char *buffer, size_t &current_size,
 
   for (int i = 0; i < DMM_NODE_FANOUT; i++) {
     if (bitmap_ & (1 << i)) {
-      uint64_t child_version = get<0>(children_[i]);
-      string child_hash = get<1>(children_[i]);
-
-      memcpy(buffer + current_size, &child_version, sizeof(uint64_t));
+      memcpy(buffer + current_size, &child_versions_[i], sizeof(uint64_t));
       current_size += sizeof(uint64_t);
-      memcpy(buffer + current_size, child_hash.c_str(), child_hash.size());
+      // empty hashes are kept as zeros in child_hashes_
+      memcpy(buffer + current_size, child_hashes_[i], HASH_SIZE);
       current_size += HASH_SIZE;
     }
   }
@@ -297,7 +294,7 @@ void IndexNode::SerializeTo(char *buffer, size_t &current_size,
                   // its children
     for (int i = 0; i < DMM_NODE_FANOUT; i++) {
       if (bitmap_ & (1 << i)) {  // only serialize children that exists
-        Node *child = get<2>(children_[i]);
+        Node *child = child_nodes_[i];
         child->SerializeTo(buffer, current_size, false);
       }
     }
@@ -309,7 +306,7 @@ void IndexNode::DeserializeFrom(char *buffer, size_t &current_size,
   version_ = *(reinterpret_cast<uint64_t *>(buffer + current_size));
   current_size += sizeof(uint64_t);
 
-  hash_ = string(buffer + current_size, HASH_SIZE);
+  hash_ = ReadHash(buffer + current_size);
   current_size += HASH_SIZE;
 
   bitmap_ = *(reinterpret_cast<uint16_t *>(buffer + current_size));
@@ -317,20 +314,22 @@ void IndexNode::DeserializeFrom(char *buffer, size_t &current_size,
 
   for (int i = 0; i < DMM_NODE_FANOUT; i++) {
     if (bitmap_ & (1 << i)) {
-      uint64_t child_version =
+      child_versions_[i] =
           *(reinterpret_cast<uint64_t *>(buffer + current_size));
       current_size += sizeof(uint64_t);
-      string child_hash(buffer + current_size, HASH_SIZE);
+      memcpy(child_hashes_[i], buffer + current_size, HASH_SIZE);
+      if (!IsEmptyHash(buffer + current_size)) {
+        hash_bitmap_ |= (1 << i);
+      }
       current_size += HASH_SIZE;
-
-      children_[i] = make_tuple(child_version, child_hash, nullptr);
+      child_nodes_[i] = nullptr;
     }
   }
+  // children of a root node are deserialized by DeserializeChildren
+}
 
-  if (!is_root) {  // indexnode is in second level of a page, return
-    return;
-  }
-
+void IndexNode::DeserializeChildren(char *buffer, size_t &current_size,
+                                    Arena &arena) {
   for (int i = 0; i < DMM_NODE_FANOUT; i++) {
     if (bitmap_ & (1 << i)) {
       // serialized data only stores children that exists
@@ -338,42 +337,26 @@ void IndexNode::DeserializeFrom(char *buffer, size_t &current_size,
           *(reinterpret_cast<bool *>(buffer + current_size));
       current_size += sizeof(bool);
 
+      Node *child;
       if (child_is_leaf_node) {  // second level of page is leafnode
-        Node *child = new LeafNode();
-        child->DeserializeFrom(buffer, current_size, false);
-        this->AddChild(i, child);  // add pointer to children in indexnode
-      } else {                     // second level of page is indexnode
-        Node *child = new IndexNode();
-        child->DeserializeFrom(buffer, current_size, false);
-        this->AddChild(i, child);
+        child = arena.New<LeafNode>();
+      } else {  // second level of page is indexnode
+        child = arena.New<IndexNode>();
       }
+      child->DeserializeFrom(buffer, current_size, false);
+      // only set the pointer, version and hash of the child were already
+      // read from the child table of this node
+      child_nodes_[i] = child;
     }
   }
 }
 
-void IndexNode::UpdateNode(uint64_t version, int index,
-                           const string &child_hash, uint8_t location_in_page,
-                           DeltaPage *deltapage) {
-  version_ = version;
-  bitmap_ |= (1 << index);
-  get<0>(children_[index]) = version;
-  get<1>(children_[index]) = child_hash;
-
-  string concatenated_hash;
-  for (int i = 0; i < DMM_NODE_FANOUT; i++) {
-    concatenated_hash += get<1>(children_[i]);
-  }
-  hash_ = HashFunction(concatenated_hash);
-  if (deltapage != nullptr) {
-    deltapage->AddIndexNodeUpdate(location_in_page, version, hash_, index,
-                                  child_hash);
-  }
-}
-
 void IndexNode::AddChild(int index, Node *child, uint64_t version,
                          const string &hash) {
   if (index >= 0 && index < DMM_NODE_FANOUT) {
-    children_[index] = make_tuple(version, hash, child);
+    child_versions_[index] = version;
+    child_nodes_[index] = child;
+    SetChildHash(index, hash);
     bitmap_ |= (1 << index);  // update bitmap
   } else
     throw runtime_error("AddChild out of range.");
@@ -382,7 +365,7 @@ void IndexNode::AddChild(int index, Node *child, uint64_t version,
 Node *IndexNode::GetChild(int index) const {
   if (index >= 0 && index < DMM_NODE_FANOUT) {
     if (bitmap_ & (1 << index)) {
-      return get<2>(children_[index]);
+      return child_nodes_[index];
     } else
       throw runtime_error("GetChild: child doesn't exist");
   } else
@@ -395,18 +378,25 @@ bool IndexNode::HasChild(int index) const {
 
 void IndexNode::SetChild(int index, uint64_t version, string hash) {
   if (index >= 0 && index < DMM_NODE_FANOUT) {
-    get<0>(children_[index]) = version;
-    get<1>(children_[index]) = hash;
+    child_versions_[index] = version;
+    SetChildHash(index, hash);
     bitmap_ |= (1 << index);  // update bitmap
   } else
     throw runtime_error("SetChild out of range.");
 }
 
-string IndexNode::GetChildHash(int index) { return get<1>(children_[index]); }
+string IndexNode::GetChildHash(int index) {
+  if (!(hash_bitmap_ & (1 << index))) {
+    return "";
+  }
+  return string(child_hashes_[index], HASH_SIZE);
+}
 uint64_t IndexNode::GetChildVersion(int index) {
-  return get<0>(children_[index]);
+  return child_versions_[index];
 }
 
+size_t IndexNode::HeapSize() const { return StringHeapSize(hash_); }
+
 string IndexNode::GetHash() { return hash_; }
 uint64_t IndexNode::GetVersion() { return version_; }
 void IndexNode::SetVersion(uint64_t version) { version_ = version; }
@@ -540,7 +530,7 @@ DeltaPage::DeltaItem::DeltaItem(char *buffer, size_t &current_size) {
   current_size += sizeof(bool);
   version = *(reinterpret_cast<uint64_t *>(buffer + current_size));
   current_size += sizeof(uint64_t);
-  hash = string(buffer + current_size, HASH_SIZE);
+  hash = ReadHash(buffer + current_size);
   current_size += HASH_SIZE;
 
   if (is_leaf_node) {
@@ -556,7 +546,7 @@ DeltaPage::DeltaItem::DeltaItem(char *buffer, size_t &current_size) {
       throw runtime_error("index out of range");
     }
     current_size += sizeof(uint8_t);
-    child_hash = string(buffer + current_size, HASH_SIZE);
+    child_hash = ReadHash(buffer + current_size);
     current_size += HASH_SIZE;
   }
 }
@@ -581,7 +571,7 @@ void DeltaPage::DeltaItem::SerializeTo(char *buffer,
   // uint32_t hash_length = hash.length();
   // memcpy(buffer + current_size, &hash_length, sizeof(uint32_t));
   // current_size += sizeof(uint32_t);
-  memcpy(buffer + current_size, hash.c_str(), HASH_SIZE);
+  WriteHash(buffer + current_size, hash);
   current_size += HASH_SIZE;
 
   if (is_leaf_node) {
@@ -600,7 +590,7 @@ void DeltaPage::DeltaItem::SerializeTo(char *buffer,
     }
     current_size += sizeof(uint8_t);
     // Write child_hash length and child_hash
-    memcpy(buffer + current_size, child_hash.c_str(), HASH_SIZE);
+    WriteHash(buffer + current_size, child_hash);
     current_size += HASH_SIZE;
   }
 }
@@ -611,7 +601,9 @@ void DeltaPage::DeltaItem::SerializeTo(std::ofstream &out) const {
   out.write(reinterpret_cast<const char *>(&is_leaf_node),
             sizeof(is_leaf_node));
   out.write(reinterpret_cast<const char *>(&version), sizeof(version));
-  out.write(hash.c_str(), HASH_SIZE);
+  char hash_buffer[HASH_SIZE];
+  WriteHash(hash_buffer, hash);
+  out.write(hash_buffer, HASH_SIZE);
 
   if (is_leaf_node) {
     out.write(reinterpret_cast<const char *>(&fileID), sizeof(fileID));
@@ -622,7 +614,9 @@ void DeltaPage::DeltaItem::SerializeTo(std::ofstream &out) const {
     if (index >= DMM_NODE_FANOUT) {
       throw runtime_error("index out of range");
     }
-    out.write(child_hash.c_str(), HASH_SIZE);
+    char child_hash_buffer[HASH_SIZE];
+    WriteHash(child_hash_buffer, child_hash);
+    out.write(child_hash_buffer, HASH_SIZE);
   }
 }
 
@@ -640,7 +634,7 @@ bool DeltaPage::DeltaItem::Deserialize(std::ifstream &in) {
     // Read hash
     char hash_buffer[HASH_SIZE];
     in.read(hash_buffer, HASH_SIZE);
-    hash = string(hash_buffer, HASH_SIZE);
+    hash = ReadHash(hash_buffer);
 
     if (is_leaf_node) {
       // Read leaf node specific fields
@@ -660,7 +654,7 @@ bool DeltaPage::DeltaItem::Deserialize(std::ifstream &in) {
       }
       char child_hash_buffer[HASH_SIZE];
       in.read(child_hash_buffer, HASH_SIZE);
-      child_hash = string(child_hash_buffer, HASH_SIZE);
+      child_hash = ReadHash(child_hash_buffer);
 
       // Initialize unused leaf node fields
       fileID = 0;
@@ -754,6 +748,17 @@ void DeltaPage::AddLeafNodeUpdate(uint8_t location, uint64_t version,
   ++b_update_count_;
 }
 
+shared_ptr<DeltaPage> DeltaPage::Freeze(const PageKey &pagekey) {
+  auto frozen =
+      make_shared<DeltaPage>(last_pagekey_, update_count_, b_update_count_);
+  frozen->SetPageKey(pagekey);
+  frozen->deltaitems_ = move(deltaitems_);
+  ClearDeltaPage();  // delete all DeltaItems in DeltaPage
+  // record the PageKey of DeltaPage passed to LSVPS
+  SetLastPageKey(pagekey);
+  return frozen;
+}
+
 void DeltaPage::SerializeTo() {
   char *buffer = this->GetData();
   memset(buffer, 0, PAGE_SIZE);
@@ -774,7 +779,7 @@ void DeltaPage::SerializeTo() {
   current_size += sizeof(uint16_t);
 
   for (const auto &item : deltaitems_) {
-    if (current_size + sizeof(DeltaItem) > PAGE_SIZE) {  // exceeds page size
+    if (current_size + sizeof(DeltaItem) > PAGE_CHECKSUM_OFFSET) {
       throw overflow_error(
           "DeltaPage exceeds PAGE_SIZE during serialization._");
     }
@@ -802,7 +807,7 @@ uint16_t DeltaPage::GetBasePageUpdateCount() { return b_update_count_; }
 void DeltaPage::ClearBasePageUpdateCount() { b_update_count_ = 0; }
 
 BasePage::BasePage(DMMTrie *trie, Node *root, const string &pid)
-    : trie_(trie), root_(root), Page({0, 0, false, pid}) {
+    : Page({0, 0, false, pid}), trie_(trie), root_(root) {
   // #ifdef DEBUG
   //   cout << "new BasePage" << endl;
   // #endif
@@ -812,12 +817,22 @@ BasePage::BasePage(const BasePage &other) : Page(other), trie_(other.trie_) {
   // #ifdef DEBUG
   //   cout << "new BasePage" << endl;
   // #endif
-  // Deep copy the root node
+  // Deep copy the root node, all nodes fit in one chunk of the arena
   if (other.root_) {
     if (other.root_->IsLeaf()) {
-      root_ = new LeafNode(*dynamic_cast<LeafNode *>(other.root_));
+      arena_.Reserve(sizeof(LeafNode));
+      root_ = NewNode<LeafNode>(*static_cast<LeafNode *>(other.root_));
     } else {
-      root_ = new IndexNode(*dynamic_cast<IndexNode *>(other.root_));
+      size_t bytes = sizeof(IndexNode);
+      for (int i = 0; i < DMM_NODE_FANOUT; i++) {
+        Node *child =
+            other.root_->HasChild(i) ? other.root_->GetChild(i) : nullptr;
+        if (child != nullptr) {
+          bytes += child->IsLeaf() ? sizeof(LeafNode) : sizeof(IndexNode);
+        }
+      }
+      arena_.Reserve(bytes);
+      root_ = NewNode<IndexNode>(*static_cast<IndexNode *>(other.root_), arena_);
     }
   } else {
     root_ = nullptr;
@@ -854,11 +869,19 @@ BasePage::BasePage(DMMTrie *trie, char *buffer) : trie_(trie) {
   current_size += sizeof(bool);
 
   if (is_leaf_node) {  // the root node of page is leafnode
-    root_ = new LeafNode();
+    arena_.Reserve(sizeof(LeafNode));
+    root_ = NewNode<LeafNode>();
     root_->DeserializeFrom(buffer, current_size, true);
   } else {  // the root node of page is indexnode
-    root_ = new IndexNode();
-    root_->DeserializeFrom(buffer, current_size, true);
+    // reserve for the root and one indexnode per child in bitmap, which is
+    // an upper bound as leafnodes are smaller
+    uint16_t bitmap = *(reinterpret_cast<uint16_t *>(
+        buffer + current_size + sizeof(uint64_t) + HASH_SIZE));
+    arena_.Reserve((1 + __builtin_popcount(bitmap)) * sizeof(IndexNode));
+    IndexNode *root = NewNode<IndexNode>();
+    root->DeserializeFrom(buffer, current_size, true);
+    root->DeserializeChildren(buffer, current_size, arena_);
+    root_ = root;
   }
 
   // 反序列化完成后，更新 PageKey
@@ -867,23 +890,25 @@ BasePage::BasePage(DMMTrie *trie, char *buffer) : trie_(trie) {
 }
 
 BasePage::BasePage(DMMTrie *trie, string key, string pid, string nibbles)
-    : trie_(trie), Page({0, 0, false, pid}) {
+    : Page({0, 0, false, pid}), trie_(trie) {
   // #ifdef DEBUG
   //   cout << "new BasePage" << endl;
   // #endif
   if (nibbles.size() == 0) {  // leafnode
-    root_ = new LeafNode(0, key, {}, "");
+    root_ = NewNode<LeafNode>(0, key, tuple<uint64_t, uint64_t, uint64_t>{},
+                              "");
   } else if (nibbles.size() == 1) {  // indexnode->leafnode
-    Node *child_node = new LeafNode(0, key, {}, "");
-    root_ = new IndexNode(0, "", 0);
+    Node *child_node = NewNode<LeafNode>(
+        0, key, tuple<uint64_t, uint64_t, uint64_t>{}, "");
+    root_ = NewNode<IndexNode>(0, "", 0);
 
     int index = GetIndex(nibbles[0]);
     root_->AddChild(index, child_node, 0, "");
   } else {  // indexnode->indexnode
     int index = GetIndex(nibbles[1]);
     // second level of indexnode should route its child by bitmap
-    Node *child_node = new IndexNode(0, "", 1 << index);
-    root_ = new IndexNode(0, "", 0);
+    Node *child_node = NewNode<IndexNode>(0, "", 1 << index);
+    root_ = NewNode<IndexNode>(0, "", 0);
 
     index = GetIndex(nibbles[0]);
     root_->AddChild(index, child_node, 0, "");
@@ -894,12 +919,37 @@ BasePage::~BasePage() {
   // #ifdef DEBUG
   //   cout << "delete BasePage" << endl;
   // #endif
-  for (int i = 0; i < DMM_NODE_FANOUT; i++) {
-    if (root_->HasChild(i)) {
-      delete root_->GetChild(i);
+  DestroyNodes();
+}
+
+template <typename T, typename... Args>
+T *BasePage::NewNode(Args &&...args) {
+  return arena_.New<T>(std::forward<Args>(args)...);
+}
+
+void BasePage::DestroyNodes() {
+  // nodes from the arena only need their destructors, the memory is freed
+  // with the arena. a root handed to the constructor is owned with new.
+  auto destroy = [this](Node *node) {
+    if (arena_.Owns(node)) {
+      node->~Node();
+    } else {
+      delete node;
+    }
+  };
+  if (root_ == nullptr) {
+    return;
+  }
+  if (!root_->IsLeaf()) {
+    for (int i = 0; i < DMM_NODE_FANOUT; i++) {
+      Node *child = root_->HasChild(i) ? root_->GetChild(i) : nullptr;
+      if (child != nullptr) {
+        destroy(child);
+      }
     }
   }
-  delete root_;
+  destroy(root_);
+  root_ = nullptr;
 }
 
 /* serialized BasePage format (size in bytes):
@@ -928,92 +978,149 @@ void BasePage::SerializeTo() {
   current_size += pid_size;
 
   root_->SerializeTo(buffer, current_size, true);  // serialize nodes
+  if (current_size > PAGE_CHECKSUM_OFFSET) {  // overlaps the page checksum
+    throw overflow_error("BasePage exceeds PAGE_SIZE during serialization");
+  }
 }
 
-void BasePage::UpdatePage(uint64_t version,
-                          tuple<uint64_t, uint64_t, uint64_t> location,
-                          const string &value, const string &nibbles,
-                          const string &child_hash, DeltaPage *deltapage,
-                          PageKey pagekey) {
-  // parameter "nibbles" are the first two nibbles after pid
-  if (nibbles.size() == 0) {
-    // page has one leafnode, eg. page "abcdef" for key "abcdef"
-    if (!root_) {
-      root_ = new LeafNode(0, pagekey.pid, {}, "");
+bool BasePage::UpdatePage(uint64_t version, const vector<NibbleUpdate> &updates,
+                          DeltaPage *deltapage, PageKey pagekey) {
+  // all updates of the page are applied first and every touched index node is
+  // hashed once afterwards, instead of rehashing the path for each nibble
+  static const string empty_value;
+  IndexNode *dirty_nodes[DMM_NODE_FANOUT];
+  size_t dirty_count = 0;
+  uint16_t dirty_bitmap = 0;
+
+  for (const auto &update : updates) {
+    // "nibbles" are the first two nibbles after pid
+    const string &nibbles = update.nibbles;
+    const string &value = update.value ? *update.value : empty_value;
+    if (nibbles.size() == 0) {
+      // page has one leafnode, eg. page "abcdef" for key "abcdef"
+      if (!root_) {
+        root_ = NewNode<LeafNode>(0, pagekey.pid,
+                                  tuple<uint64_t, uint64_t, uint64_t>{}, "");
+      }
+      static_cast<LeafNode *>(root_)->UpdateNode(version, update.location,
+                                                 value, 0, nullptr);
+      continue;
     }
-    static_cast<LeafNode *>(root_)->UpdateNode(version, location, value, 0,
-                                               deltapage);
-  } else if (nibbles.size() == 1) {
-    // page has one indexnode and one level of leafnodes, eg. page "abcd" for
-    // key "abcde"
+
     if (!root_) {
-      root_ = new IndexNode(0, "", 0);
+      root_ = NewNode<IndexNode>(0, "", 0);
     }
     int index = GetIndex(nibbles[0]);
-    if (!root_->HasChild(index)) {
-      Node *child_node =
-          new LeafNode(0, pagekey.pid + to_string(index), {}, "");
-      root_->AddChild(index, child_node, 0, "");
+    if (nibbles.size() == 1) {
+      // page has one indexnode and one level of leafnodes, eg. page "abcd" for
+      // key "abcde"
+      if (!root_->HasChild(index)) {
+        Node *child_node =
+            NewNode<LeafNode>(0, pagekey.pid + to_string(index),
+                              tuple<uint64_t, uint64_t, uint64_t>{}, "");
+        root_->AddChild(index, child_node, 0, "");
+      }
+      static_cast<LeafNode *>(root_->GetChild(index))
+          ->UpdateNode(version, update.location, value, index + 1, nullptr);
+    } else {
+      // page has two levels of indexnodes , eg. page "ab" for key "abcdef"
+      int child_index = GetIndex(nibbles[1]);
+      if (!root_->HasChild(index)) {
+        Node *child_node = NewNode<IndexNode>(0, "", 1 << child_index);
+        root_->AddChild(index, child_node, 0, "");
+      }
+      IndexNode *child_node = static_cast<IndexNode *>(root_->GetChild(index));
+      child_node->SetVersion(version);
+      child_node->SetChild(child_index, version, update.child_hash);
+      if (!(dirty_bitmap & (1 << index))) {
+        dirty_bitmap |= (1 << index);
+        dirty_nodes[dirty_count++] = child_node;
+      }
     }
-    static_cast<LeafNode *>(root_->GetChild(index))
-        ->UpdateNode(version, location, value, index + 1, deltapage);
+    root_->SetChild(index, version, "");
+  }
 
-    string child_hash_2 = root_->GetChild(index)->GetHash();
-    static_cast<IndexNode *>(root_)->UpdateNode(version, index, child_hash_2, 0,
-                                                deltapage);
-  } else {
-    // page has two levels of indexnodes , eg. page "ab" for key "abcdef"
-    if (!root_) {
-      root_ = new IndexNode(0, "", 0);
+  if (!root_->IsLeaf()) {
+    for (size_t i = 0; i < dirty_count; i++) {
+      dirty_nodes[i]->CalculateHash();
     }
-    int index = GetIndex(nibbles[0]), child_index = GetIndex(nibbles[1]);
-    if (!root_->HasChild(index)) {
-      Node *child_node = new IndexNode(0, "", 1 << child_index);
-      root_->AddChild(index, child_node, 0, "");
+    IndexNode *root = static_cast<IndexNode *>(root_);
+    for (const auto &update : updates) {
+      int index = GetIndex(update.nibbles[0]);
+      root->SetChild(index, version, root->GetChild(index)->GetHash());
     }
-    static_cast<IndexNode *>(root_->GetChild(index))
-        ->UpdateNode(version, child_index, child_hash, index + 1, deltapage);
-
-    string child_hash_2 = root_->GetChild(index)->GetHash();
-    static_cast<IndexNode *>(root_)->UpdateNode(version, index, child_hash_2, 0,
-                                                deltapage);
+    root->SetVersion(version);
+    root->CalculateHash();
   }
 
   this->SetPageKey(pagekey);
-  if (deltapage != nullptr) {
-    PageKey deltapage_pagekey = {version, 0, true, pagekey.pid};
-    deltapage->SetPageKey(deltapage_pagekey);
+  if (deltapage == nullptr) {
+    pair<uint64_t, uint64_t> page_version = trie_->GetPageVersion(pagekey);
+    trie_->UpdatePageVersion(pagekey, version, page_version.second);
+    return false;
+  }
+
+  // record the updates in the deltapage, one nibble at a time so that the
+  // freeze and checkpoint thresholds are checked as before
+  PageKey deltapage_pagekey = {version, 0, true, pagekey.pid};
+  deltapage->SetPageKey(deltapage_pagekey);
+  bool checkpoint = false, checkpointed = false;
+  for (const auto &update : updates) {
+    const string &nibbles = update.nibbles;
+    if (nibbles.size() == 0) {
+      const auto &location = update.location;
+      deltapage->AddLeafNodeUpdate(0, version, root_->GetHash(),
+                                   get<0>(location), get<1>(location),
+                                   get<2>(location));
+    } else {
+      int index = GetIndex(nibbles[0]);
+      Node *child_node = root_->GetChild(index);
+      if (nibbles.size() == 1) {
+        const auto &location = update.location;
+        deltapage->AddLeafNodeUpdate(index + 1, version, child_node->GetHash(),
+                                     get<0>(location), get<1>(location),
+                                     get<2>(location));
+      } else {
+        deltapage->AddIndexNodeUpdate(index + 1, version, child_node->GetHash(),
+                                      GetIndex(nibbles[1]), update.child_hash);
+      }
+      deltapage->AddIndexNodeUpdate(0, version, root_->GetHash(), index,
+                                    child_node->GetHash());
+    }
 
     if (deltapage->GetDeltaPageUpdateCount() >= Td_) {
       // When a DeltaPage accumulates 𝑇𝑑 updates, it is frozen and a new active
       // one is initiated
 
-      DeltaPage *deltapage_copy = new DeltaPage(*deltapage);
-      deltapage_copy->SerializeTo();
-      // store frozen deltapage in cache
-      trie_->WritePageCache(deltapage_pagekey, deltapage_copy);
-
-      deltapage->ClearDeltaPage();  // delete all DeltaItems in DeltaPage
-      // record the PageKey of DeltaPage passed to LSVPS
-      deltapage->SetLastPageKey(deltapage_pagekey);
+      // store frozen deltapage in cache, LSVPS serializes it when flushing
+      trie_->WritePageCache(deltapage_pagekey,
+                            deltapage->Freeze(deltapage_pagekey));
       trie_->AddDeltaPageVersion(pagekey.pid, version);
     }
     if (deltapage->GetBasePageUpdateCount() >= Tb_) {
-      // Each page generates a checkpoint as BasePage after every 𝑇𝑏 updates
-      BasePage *basepage_copy =
-          new BasePage(*this);  // not deep copy!!!!!!!!!!!!!!!!!!!!!!!!!
-      basepage_copy->SerializeTo();
-      trie_->WritePageCache(pagekey, basepage_copy);  // store basepage in cache
-
+      // Each page generates a checkpoint as BasePage after every 𝑇𝑏 updates.
+      // all updates are applied already, so the page itself is the checkpoint
+      const vector<DeltaPage::DeltaItem> &items = deltapage->GetDeltaItems();
+      if (!items.empty() && items.front().version < version) {
+        // updates of older versions still replay on the previous checkpoint
+        trie_->WritePageCache(deltapage_pagekey,
+                              deltapage->Freeze(deltapage_pagekey));
+        trie_->AddDeltaPageVersion(pagekey.pid, version);
+      }
       trie_->UpdatePageVersion(pagekey, version, version);
       deltapage->ClearBasePageUpdateCount();
       deltapage->SetLastPageKey(pagekey);
-      return;
+      checkpoint = checkpointed = true;
+    } else {
+      checkpoint = false;
     }
   }
 
-  pair<uint64_t, uint64_t> page_version = trie_->GetPageVersion(pagekey);
-  trie_->UpdatePageVersion(pagekey, version, page_version.second);
+  if (!checkpoint) {
+    pair<uint64_t, uint64_t> page_version = trie_->GetPageVersion(pagekey);
+    trie_->UpdatePageVersion(pagekey, version, page_version.second);
+  }
+  return checkpointed;
 }
 
 void BasePage::UpdateDeltaItem(const DeltaPage::DeltaItem &deltaitem) {
@@ -1022,9 +1129,9 @@ void BasePage::UpdateDeltaItem(const DeltaPage::DeltaItem &deltaitem) {
   if (root_ == nullptr) {
     // create root if replay function in LSVPS has no basepage to start from
     if (deltaitem.location_in_page == 0 && deltaitem.is_leaf_node == true) {
-      root_ = new LeafNode();
+      root_ = NewNode<LeafNode>();
     } else {
-      root_ = new IndexNode();
+      root_ = NewNode<IndexNode>();
     }
   }
 
@@ -1032,7 +1139,7 @@ void BasePage::UpdateDeltaItem(const DeltaPage::DeltaItem &deltaitem) {
     if (deltaitem.location_in_page == 0) {
       node = root_;
     } else if (!root_->HasChild(deltaitem.location_in_page - 1)) {
-      node = new LeafNode();
+      node = NewNode<LeafNode>();
       root_->AddChild(deltaitem.location_in_page - 1, node, 0, "");
     } else {
       node = root_->GetChild(deltaitem.location_in_page - 1);
@@ -1046,7 +1153,7 @@ void BasePage::UpdateDeltaItem(const DeltaPage::DeltaItem &deltaitem) {
     if (deltaitem.location_in_page == 0) {
       node = root_;
     } else if (!root_->HasChild(deltaitem.location_in_page - 1)) {
-      node = new IndexNode();
+      node = NewNode<IndexNode>();
       root_->AddChild(deltaitem.location_in_page - 1, node, 0, "");
     } else {
       node = root_->GetChild(deltaitem.location_in_page - 1);
@@ -1063,15 +1170,159 @@ void BasePage::UpdateDeltaItem(const DeltaPage::DeltaItem &deltaitem) {
 
 Node *BasePage::GetRoot() const { return root_; }
 
+size_t BasePage::GetMemorySize() const {
+  size_t size = sizeof(BasePage) + arena_.MemoryUsage() +
+                StringHeapSize(GetPageKey().pid);
+  if (GetData() != nullptr) {
+    size += PAGE_SIZE;
+  }
+  if (root_ == nullptr) {
+    return size;
+  }
+  size += root_->HeapSize();
+  for (int i = 0; i < DMM_NODE_FANOUT; i++) {
+    if (root_->HasChild(i)) {
+      size += root_->GetChild(i)->HeapSize();
+    }
+  }
+  return size;
+}
+
+template <typename T>
+static T LoadField(const char *p) {
+  T value;
+  memcpy(&value, p, sizeof(T));
+  return value;
+}
+
+NodeView::NodeView(const char *data, const char *end, bool is_root)
+    : data_(data), end_(end), is_root_(is_root) {}
+
+bool NodeView::IsLeaf() const { return LoadField<bool>(data_); }
+
+uint64_t NodeView::GetVersion() const {
+  return LoadField<uint64_t>(data_ + sizeof(bool));
+}
+
+string NodeView::GetHash() const {
+  // see LeafNode::SerializeTo and IndexNode::SerializeTo for the layouts
+  if (IsLeaf()) {
+    size_t key_size = LoadField<size_t>(data_ + 9);
+    return ReadHash(data_ + 17 + key_size + 3 * sizeof(uint64_t));
+  }
+  return ReadHash(data_ + 9);
+}
+
+uint16_t NodeView::GetBitmap() const {
+  return IsLeaf() ? 0 : LoadField<uint16_t>(data_ + 9 + HASH_SIZE);
+}
+
+bool NodeView::HasChild(int index) const {
+  return GetBitmap() & (1 << index) ? true : false;
+}
+
+const char *NodeView::ChildEntry(int index) const {
+  uint16_t bitmap = GetBitmap();
+  int rank = __builtin_popcount(bitmap & ((1u << index) - 1));
+  return data_ + 11 + HASH_SIZE + rank * (sizeof(uint64_t) + HASH_SIZE);
+}
+
+NodeView NodeView::GetChild(int index) const {
+  if (index < 0 || index >= DMM_NODE_FANOUT) {
+    throw runtime_error("GetChild out of range.");
+  }
+  if (!is_root_ || !HasChild(index)) {
+    throw runtime_error("GetChild: child doesn't exist");
+  }
+  // children are serialized one after another behind the child table
+  uint16_t bitmap = GetBitmap();
+  const char *child = ChildEntry(DMM_NODE_FANOUT);
+  for (int i = 0; i < index; i++) {
+    if (bitmap & (1 << i)) {
+      child += NodeView(child, end_).SerializedSize();
+      if (child >= end_) {
+        throw runtime_error("NodeView: child out of page");
+      }
+    }
+  }
+  return NodeView(child, end_);
+}
+
+string NodeView::GetChildHash(int index) const {
+  if (!HasChild(index)) {
+    return "";
+  }
+  return ReadHash(ChildEntry(index) + sizeof(uint64_t));
+}
+
+uint64_t NodeView::GetChildVersion(int index) const {
+  if (!HasChild(index)) {
+    return 0;
+  }
+  return LoadField<uint64_t>(ChildEntry(index));
+}
+
+tuple<uint64_t, uint64_t, uint64_t> NodeView::GetLocation() const {
+  if (!IsLeaf()) {
+    return {};
+  }
+  size_t key_size = LoadField<size_t>(data_ + 9);
+  const char *location = data_ + 17 + key_size;
+  return make_tuple(LoadField<uint64_t>(location),
+                    LoadField<uint64_t>(location + sizeof(uint64_t)),
+                    LoadField<uint64_t>(location + 2 * sizeof(uint64_t)));
+}
+
+NodeProof NodeView::GetNodeProof(int level, int index) const {
+  NodeProof node_proof = {level, index, GetBitmap()};
+  for (int i = 0; i < DMM_NODE_FANOUT; i++) {
+    node_proof.sibling_hash.push_back(GetChildHash(i));
+  }
+  return node_proof;
+}
+
+size_t NodeView::SerializedSize() const {
+  if (IsLeaf()) {
+    return 17 + LoadField<size_t>(data_ + 9) + 3 * sizeof(uint64_t) +
+           HASH_SIZE;
+  }
+  // the children of a root node are not part of its size
+  return ChildEntry(DMM_NODE_FANOUT) - data_;
+}
+
+BasePageView::BasePageView(const char *buffer)
+    : buffer_(buffer), root_offset_(0) {
+  if (buffer_ != nullptr) {
+    // | version (8) | tid (8) | tp (1) | pid_size (8) | pid | root node |
+    root_offset_ = 25 + LoadField<size_t>(buffer_ + 17);
+  }
+}
+
+uint64_t BasePageView::GetVersion() const {
+  return LoadField<uint64_t>(buffer_);
+}
+
+string BasePageView::GetPid() const {
+  return string(buffer_ + 25, root_offset_ - 25);
+}
+
+NodeView BasePageView::GetRoot() const {
+  return NodeView(buffer_ + root_offset_, buffer_ + PAGE_SIZE, true);
+}
+
 DMMTrie::DMMTrie(uint64_t tid, LSVPS *page_store, VDLS *value_store,
                  uint64_t current_version)
-    : tid(tid),
-      page_store_(page_store),
+    : page_store_(page_store),
       value_store_(value_store),
+      tid(tid),
+      root_page_(nullptr),
       current_version_(current_version),
-      root_page_(nullptr) {
-  lru_cache_.clear();
-  pagekeys_.clear();
+      committed_version_(current_version),
+      concurrent_reads_(false),
+      commit_pool_(new ThreadPool(1)),
+      verify_pool_(new WorkStealingPool(1)),
+      verify_memory_budget_(kDefaultVerifyMemoryBudget),
+      verify_rate_limit_(0) {
   active_deltapages_.clear();
   page_versions_.clear();
   page_cache_.clear();
@@ -1080,15 +1331,8 @@ DMMTrie::DMMTrie(uint64_t tid, LSVPS *page_store, VDLS *value_store,
 }
 
 DMMTrie::~DMMTrie() {
-  while (lru_cache_.size()) {  // cache is full
-    PageKey last_key = pagekeys_.back().first;
-    auto last_iter = lru_cache_.find(last_key);
-    delete last_iter->second->second;  // release memory of basepage
-
-    // remove the page whose pagekey is at the tail of list
-    lru_cache_.erase(last_key);
-    pagekeys_.pop_back();
-  }
+  // pages are released with their last handle
+  cache_.Clear();
 }
 
 bool DMMTrie::Put(uint64_t tid, uint64_t version, const string &key,
@@ -1102,50 +1346,114 @@ bool DMMTrie::Put(uint64_t tid, uint64_t version, const string &key,
     return false;
   }
   current_version_ = version;
-  put_cache_[key] = value;
+  put_cache_[key].value = value;
+  return true;
+}
+
+// descend the two levels of a page along key from nibble i. returns false if
+// the key doesn't exist, otherwise either the location of the leafnode is set
+// or page_version is updated to the version of the child page. NodeRef is a
+// Node * of a BasePage or a NodeView of a serialized one.
+static tuple<uint64_t, uint64_t, uint64_t> LeafLocation(Node *node) {
+  return static_cast<LeafNode *>(node)->GetLocation();
+}
+
+static tuple<uint64_t, uint64_t, uint64_t> LeafLocation(const NodeView &node) {
+  return node.GetLocation();
+}
+
+// the hash a leafnode keeps for its value. a deleted key keeps an empty value
+// and an empty hash, as LeafNode::UpdateNode stores it
+static string ValueHash(const VDLS::ValueView &view) {
+  return view.value.empty()
+             ? ""
+             : HashFunction(view.value.data(), view.value.size());
+}
+
+// the nibbles of the entry at slot below the pid of its page
+static string EntryNibbles(bool root_is_leaf, bool is_leaf, int slot) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  if (root_is_leaf) {
+    return "";
+  }
+  string nibbles(1, kHexDigits[slot / DMM_NODE_FANOUT]);
+  if (!is_leaf) {
+    nibbles += kHexDigits[slot % DMM_NODE_FANOUT];
+  }
+  return nibbles;
+}
+
+template <typename NodeRef>
+static bool DescendPage(NodeRef root, const string &key, size_t i,
+                        uint64_t &page_version, bool &found_leaf,
+                        tuple<uint64_t, uint64_t, uint64_t> &location,
+                        vector<NodeProof> *proofs) {
+  if (root->IsLeaf()) {  // first level is leafnode
+    found_leaf = true;
+    location = LeafLocation(root);
+    return true;
+  }
+  // first level in page is indexnode
+  int index = GetIndex(key[i]);
+  if (!root->HasChild(index)) {
+    return false;
+  }
+  if (proofs != nullptr) {
+    proofs->push_back(root->GetNodeProof(i, index));
+  }
+  auto child = root->GetChild(index);
+  if (!child->IsLeaf()) {
+    // second level is indexnode
+    // TODO: child的版本比Root高是正常的吗？
+    if (i + 1 >= key.size()) {
+      return false;
+    }
+    int child_index = GetIndex(key[i + 1]);
+    if (proofs != nullptr) {
+      proofs->push_back(child->GetNodeProof(i + 1, child_index));
+    }
+    page_version = child->GetChildVersion(child_index);
+  } else {  // second level is leafnode
+    found_leaf = true;
+    location = LeafLocation(child);
+  }
   return true;
 }
 
 string DMMTrie::Get(uint64_t tid, uint64_t version, const string &key) {
-  string nibble_path = key;
+  version = ReadVersion(version);
   uint64_t page_version = version;
-  LeafNode *leafnode = nullptr;
+  bool found_leaf = false;
+  tuple<uint64_t, uint64_t, uint64_t> location;
+  char buffer[PAGE_SIZE];  // serialized page read without deserializing
   for (int i = 0; i <= key.size(); i += 2) {
-    string pid = nibble_path.substr(0, i);
-    BasePage *page =
-        GetPage({page_version, 0, false, pid});  // false means basepage
-    if (page == nullptr || page->GetRoot() == nullptr) {
+    string pid = key.substr(0, i);
+    shared_ptr<BasePage> page;
+    BasePageView view;
+    if (!ReadPage({page_version, 0, false, pid}, buffer, page, view)) {
       cout << "Key " << key << " not found at version " << version << endl;
       return "";
     }
-
-    if (!page->GetRoot()->IsLeaf()) {  // first level in page is indexnode
-
-      if (!page->GetRoot()->HasChild(GetIndex(nibble_path[i]))) {
-        cout << "Child not found" << endl;
-        cout << "Key " << key << " not found at version " << version << endl;
-        return "";
-      }
-      if (!page->GetRoot()->GetChild(GetIndex(nibble_path[i]))->IsLeaf()) {
-        // second level is indexnode
-        // TODO: child的版本比Root高是正常的吗？
-        page_version = page->GetRoot()
-                           ->GetChild(GetIndex(nibble_path[i]))
-                           ->GetChildVersion(GetIndex(nibble_path[i + 1]));
-      } else {  // second level is leafnode
-        leafnode = static_cast<LeafNode *>(
-            page->GetRoot()->GetChild(GetIndex(nibble_path[i])));
-      }
-    } else {  // first level is leafnode
-      leafnode = static_cast<LeafNode *>(page->GetRoot());
+    bool exist = page != nullptr
+                     ? DescendPage(page->GetRoot(), key, i, page_version,
+                                   found_leaf, location, nullptr)
+                     : DescendPage(view.GetRoot(), key, i, page_version,
+                                   found_leaf, location, nullptr);
+    if (!exist) {
+      cout << "Child not found" << endl;
+      cout << "Key " << key << " not found at version " << version << endl;
+      return "";
     }
   }
-  tuple<uint64_t, uint64_t, uint64_t> location = leafnode->GetLocation();
+  if (!found_leaf) {
+    cout << "Key " << key << " not found at version " << version << endl;
+    return "";
+  }
 #ifdef DEBUG
   cout << "location:" << get<0>(location) << " " << get<1>(location) << " "
        << get<2>(location) << endl;
 #endif
-  string value = value_store_->ReadValue(leafnode->GetLocation());
+  string value = value_store_->ReadValue(location);
 #ifdef DEBUG
   cout << "Key " << key << " has value " << value << " at version " << version
        << endl;
@@ -1153,13 +1461,109 @@ string DMMTrie::Get(uint64_t tid, uint64_t version, const string &key) {
   return value;
 }
 
+vector<string> DMMTrie::MultiGet(uint64_t tid, uint64_t version,
+                                 const vector<string> &keys) {
+  version = ReadVersion(version);
+  MultiGetBatch batch{keys, {}, {}, {}};
+  batch.locations.resize(keys.size());
+  batch.found.resize(keys.size(), false);
+  vector<size_t> members(keys.size());
+  for (size_t k = 0; k < keys.size(); k++) {
+    members[k] = k;
+  }
+  sort(members.begin(), members.end(),
+       [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+  if (!members.empty()) {
+    MultiGetPage(batch, {version, 0, false, ""}, members);
+  }
+
+  vector<tuple<uint64_t, uint64_t, uint64_t>> locations;
+  vector<size_t> owners;
+  for (size_t k = 0; k < keys.size(); k++) {
+    if (batch.found[k]) {
+      locations.push_back(batch.locations[k]);
+      owners.push_back(k);
+    }
+  }
+  vector<string> values = value_store_->ReadValues(locations);
+  vector<string> result(keys.size());
+  for (size_t j = 0; j < owners.size(); j++) {
+    result[owners[j]] = move(values[j]);
+  }
+  return result;
+}
+
+void DMMTrie::MultiGetPage(MultiGetBatch &batch, const PageKey &pagekey,
+                           const vector<size_t> &members) {
+  size_t i = pagekey.pid.size();
+  // the buffer of a level stays valid while the deeper levels are walked
+  if (batch.buffers.size() <= i / 2) {
+    batch.buffers.resize(i / 2 + 1);
+  }
+  vector<char> &buffer = batch.buffers[i / 2];
+  buffer.resize(PAGE_SIZE);
+  shared_ptr<BasePage> page;
+  BasePageView view;
+  if (!ReadPage(pagekey, buffer.data(), page, view)) {
+    return;
+  }
+
+  // sorted keys that continue in the same child page are adjacent
+  vector<pair<PageKey, vector<size_t>>> children;
+  for (size_t k : members) {
+    const string &key = batch.keys[k];
+    uint64_t page_version = pagekey.version;
+    bool found_leaf = false;
+    tuple<uint64_t, uint64_t, uint64_t> location;
+    bool exist = page != nullptr
+                     ? DescendPage(page->GetRoot(), key, i, page_version,
+                                   found_leaf, location, nullptr)
+                     : DescendPage(view.GetRoot(), key, i, page_version,
+                                   found_leaf, location, nullptr);
+    if (!exist) {
+      continue;
+    }
+    if (found_leaf) {
+      batch.found[k] = true;
+      batch.locations[k] = location;
+      continue;
+    }
+    if (i + 2 > key.size()) {
+      continue;  // the key ends in the page without a leaf
+    }
+    if (children.empty() ||
+        children.back().first.pid.compare(0, i + 2, key, 0, i + 2) != 0) {
+      children.push_back({{page_version, 0, false, key.substr(0, i + 2)}, {}});
+    }
+    children.back().second.push_back(k);
+  }
+  for (const auto &child : children) {
+    MultiGetPage(batch, child.first, child.second);
+  }
+}
+
+unique_ptr<DMMTrieIterator> DMMTrie::NewIterator(uint64_t tid,
+                                                 uint64_t version,
+                                                 const string &begin,
+                                                 const string &end) {
+  return unique_ptr<DMMTrieIterator>(
+      new DMMTrieIterator(this, ReadVersion(version), begin, end));
+}
+
+unique_ptr<DMMTrieScrubber> DMMTrie::NewScrubber(
+    uint64_t tid, uint64_t version, const string &root_hash,
+    const string &checkpoint_path) {
+  return unique_ptr<DMMTrieScrubber>(new DMMTrieScrubber(
+      this, tid, ReadVersion(version), root_hash, checkpoint_path));
+}
+
 void DMMTrie::Delete(uint64_t tid, uint64_t version, const string &key) {
   if (version < current_version_) {  // version invalid
     cout << "Version " << version << " is outdated!" << endl;
     return;
   }
   current_version_ = version;
-  put_cache_[key] = "";
+  put_cache_[key].value = "";
 }
 
 // deprecated
@@ -1170,107 +1574,67 @@ void DMMTrie::CalcRootHash(uint64_t tid, uint64_t version) {
     // cout << "Commit version incompatible" << endl;
   }
 
-  map<string, set<string>, decltype(CompareStrings)> updates(CompareStrings);
-
+  // the values of the version are written to VDLS as one batch in key order
+  vector<pair<const string *, const string *>> records;
+  records.reserve(put_cache_.size());
   for (const auto &it : put_cache_) {
-    for (int i = it.first.size() % 2 == 0 ? it.first.size()
-                                          : it.first.size() - 1;
-         i >= 0; i -= 2) {
-      // store the pid and nibbles of each page updated in every put
-      updates[it.first.substr(0, i)].insert(it.first.substr(i, 2));
-    }
+    records.emplace_back(&it.first, &it.second.value);
+  }
+  vector<tuple<uint64_t, uint64_t, uint64_t>> locations =
+      value_store_->WriteValues(version, records);
+  size_t record_index = 0;
+  for (auto &it : put_cache_) {
+    it.second.location = locations[record_index++];
   }
+  // under group commit the values are synced while the pages are updated
+  value_store_->CommitVersion(version);
 
-  // unordered_map<string, DeltaPage *> active_deltapages;
-  set<string> pids;
+  map<string, set<string>, decltype(CompareStrings)> updates(CompareStrings);
 
   for (const auto &it : put_cache_) {
     for (int i = it.first.size() % 2 == 0 ? it.first.size()
                                           : it.first.size() - 1;
          i >= 0; i -= 2) {
-      pids.insert(it.first.substr(0, i));
+      // store the pid and nibbles of each page updated in every put
+      updates[it.first.substr(0, i)].insert(it.first.substr(i, 2));
     }
   }
 
-  // get the needed active deltapages from LSVPS
-  // for (string pid : pids) {
-  //   active_deltapages[pid] = page_store_->GetActiveDeltaPage(pid);
-  // }
-
-  for (const auto &it : updates) {
-    string pid = it.first;
-    bool if_exceed = false;
-    // get the latest version number of a page
-    uint64_t page_version = GetPageVersion({0, 0, false, pid}).first;
-    PageKey pagekey = {version, 0, false, pid},
-            old_pagekey = {page_version, 0, false, pid};
-    BasePage *page = GetPage(old_pagekey);  // load the page into lru cache
-
-    if (page == nullptr) {
-      // GetPage returns nullptr means that the pid is new
-      page = new BasePage(this, nullptr, pid);
-      PutPage(pagekey, page);  // add the newly generated page into cache
-    }
-
-    // DeltaPage *deltapage = GetDeltaPage(pid);
-
-    DeltaPage *deltapage = page_store_->GetActiveDeltaPage(pid);
-
-    if (2 * it.second.size() + deltapage->GetDeltaPageUpdateCount() >=
-        2 * Td_) {
-      // the updates in page is more than the capacity of two deltapages
-      if_exceed = true;
-      if (deltapage->GetDeltaPageUpdateCount() != 0) {
-        PageKey deltapage_pagekey = {version, 0, true, pagekey.pid};
-
-        DeltaPage *deltapage_copy = new DeltaPage(*deltapage);
-        deltapage_copy->SetPageKey(deltapage_pagekey);
-        deltapage_copy->SerializeTo();
-        // store frozen deltapage in cache
-        WritePageCache(deltapage_pagekey, deltapage_copy);
-
-        deltapage->ClearDeltaPage();  // delete all DeltaItems in DeltaPage
-        // record the PageKey of DeltaPage passed to LSVPS
-        deltapage->SetLastPageKey(deltapage_pagekey);
-        AddDeltaPageVersion(pagekey.pid, version);
-      }
-    }
-
-    for (const auto &nibbles : it.second) {
-      // path is key when page is leaf page, pid of child page when page is
-      // index page
-      string path = pid + nibbles;
-      tuple<uint64_t, uint64_t, uint64_t> location;
-      string value, child_hash;
-      if (nibbles.size() == 2) {  // indexnode + indexnode
-        child_hash = GetPage({version, 0, false, path})->GetRoot()->GetHash();
-      } else {  // (indexnode + leafnode) or leafnode
-        value = put_cache_[path];
-        location = value_store_->WriteValue(version, path, value);
-      }
-      if (if_exceed) {
-        page->UpdatePage(version, location, value, nibbles, child_hash, nullptr,
-                         pagekey);
-      } else {
-        page->UpdatePage(version, location, value, nibbles, child_hash,
-                         deltapage, pagekey);
+  // updates are sorted deepest pid first, and a page only depends on the
+  // child pages one level deeper, so all pages of the same pid length form a
+  // stage that can be updated in parallel. a stage is split into chunks to
+  // bound the pages it holds at a time.
+  // the store lock is released between chunks, so that readers which miss
+  // the cache wait for one chunk at most
+  unique_lock<shared_mutex> store_lock(store_mutex_);
+  // the pages frozen by the commit are handed over only when it finishes, but
+  // they are needed if a page is evicted from the cache and loaded meanwhile
+  unique_ptr<LSVPS::PendingPageScope> pending_pages(
+      new LSVPS::PendingPageScope(page_store_, page_cache_, page_meta_mutex_));
+  auto it = updates.begin();
+  while (it != updates.end()) {
+    size_t depth = it->first.size();
+    vector<PageUpdate> stage;
+    size_t touched_pages = 0;
+    for (; it != updates.end() && it->first.size() == depth; ++it) {
+      size_t cost = 1 + it->second.size();  // the page and its child pages
+      if (!stage.empty() && touched_pages + cost > kStageChunkPages) {
+        RunPageUpdates(stage, version);
+        stage.clear();
+        touched_pages = 0;
+        store_lock.unlock();
+        store_lock.lock();
       }
+      stage.push_back(PreparePageUpdate(it->first, it->second, version));
+      touched_pages += cost;
     }
-
-    if (if_exceed) {
-      BasePage *basepage_copy = new BasePage(*page);
-      basepage_copy->SerializeTo();
-      WritePageCache(pagekey, basepage_copy);  // store basepage in cache
-
-      UpdatePageVersion(pagekey, version, version);
-      deltapage->ClearBasePageUpdateCount();
-      deltapage->SetLastPageKey(pagekey);
-    }
-    UpdatePageKey(old_pagekey, pagekey);
-    // deltapage->SerializeTo();
-    page_store_->StoreActiveDeltaPage(deltapage);
+    RunPageUpdates(stage, version);
+    store_lock.unlock();
+    store_lock.lock();
   }
 
+  // the pages are handed over as they are, checkpoints stay shared with the
+  // page cache until the trie modifies them again
   for (const auto &it : page_cache_) {
     page_store_->StorePage(it.second);
 #ifdef DEBUG
@@ -1283,19 +1647,20 @@ void DMMTrie::CalcRootHash(uint64_t tid, uint64_t version) {
   // for (const auto &it : active_deltapages) {
   //   page_store_->StoreActiveDeltaPage(it.second);
   // }
-  for (auto &pair : page_cache_) {
-    delete pair.second;
-  }
+  pending_pages.reset();
   page_cache_.clear();
   put_cache_.clear();
+  committed_version_ = version;  // publish the version to readers
+  store_lock.unlock();
 #ifdef DEBUG
   cout << "Version " << version << " committed" << endl;
   cout << "Active delta pages: " << active_deltapages_.size() << endl;
   cout << "Active delta page size: " << sizeof(active_deltapages_.end()->second)
        << endl;
-  cout << "LRU pages:" << lru_cache_.size() << endl;
+  PageCache::Stats cache_stats = cache_.GetStats();
+  cout << "cached pages:" << cache_stats.pages << " (" << cache_stats.bytes
+       << " bytes)" << endl;
   cout << "page_cache_:" << page_cache_.size() << endl;
-  cout << "pagekeys_:" << pagekeys_.size() << endl;
 
   std::ifstream file("/proc/self/status");
   std::string line;
@@ -1311,57 +1676,139 @@ void DMMTrie::CalcRootHash(uint64_t tid, uint64_t version) {
     }
   }
 #endif
+  if (value_store_->GetDurability() ==
+      VDLS::DurabilityPolicy::kGroupCommit) {
+    value_store_->WaitDurable(version);
+  }
 }
 
-string DMMTrie::GetRootHash(uint64_t tid, uint64_t version) {
-  return GetPage({version, tid, false, ""})->GetRoot()->GetHash();
-}
-
-DMMTrieProof DMMTrie::GetProof(uint64_t tid, uint64_t version,
-                               const string &key) {
-  DMMTrieProof merkle_proof;
-  string nibble_path = key;
-  uint64_t page_version = version;
-  LeafNode *leafnode = nullptr;
-  for (int i = 0; i < key.size() + 1; i += 2) {
-    string pid = nibble_path.substr(0, i);
-    BasePage *page =
-        GetPage({page_version, 0, false, pid});  // false means basepage
-    if (page == nullptr || page->GetRoot() == nullptr) {
-      cout << "Key " << key << " not found at version " << version << endl;
-      merkle_proof.value = "";
-      return merkle_proof;
+DMMTrie::PageUpdate DMMTrie::PreparePageUpdate(const string &pid,
+                                               const set<string> &nibbles,
+                                               uint64_t version) {
+  PageUpdate update;
+  update.pagekey = {version, 0, false, pid};
+
+  for (const auto &nibble : nibbles) {
+    // path is key when page is leaf page, pid of child page when page is
+    // index page
+    string path = pid + nibble;
+    NibbleUpdate nibble_update{nibble, {}, nullptr, ""};
+    if (nibble.size() == 2) {  // indexnode + indexnode
+      nibble_update.child_hash =
+          GetPage({version, 0, false, path})->GetRoot()->GetHash();
+    } else {  // (indexnode + leafnode) or leafnode
+      const PendingValue &pending = put_cache_[path];
+      nibble_update.value = &pending.value;
+      nibble_update.location = pending.location;
     }
+    update.nibble_updates.push_back(move(nibble_update));
+  }
 
-    if (!page->GetRoot()->IsLeaf()) {
-
-      if (!page->GetRoot()->HasChild(GetIndex(nibble_path[i]))) {
+  // get the latest version number of a page
+  uint64_t page_version = GetPageVersion({0, 0, false, pid}).first;
+  update.old_pagekey = {page_version, 0, false, pid};
+  // load the page into page cache
+  update.page = GetPageForWrite(update.old_pagekey);
+  if (update.page == nullptr) {
+    // GetPage returns nullptr means that the pid is new
+    update.page = make_shared<BasePage>(this, nullptr, pid);
+    PutPage(update.pagekey, update.page);  // add the newly generated page
+  }
 
-        cout << "Key " << key << " not found at version " << version << endl;
-        merkle_proof.value = "";
-        return merkle_proof;
-      }
-      // first level in page is indexnode
-      merkle_proof.proofs.push_back(
-          page->GetRoot()->GetNodeProof(i, GetIndex(nibble_path[i])));
-      if (!page->GetRoot()->GetChild(GetIndex(nibble_path[i]))->IsLeaf()) {
-        // second level is indexnode
-        merkle_proof.proofs.push_back(
-            page->GetRoot()
-                ->GetChild(GetIndex(nibble_path[i]))
-                ->GetNodeProof(i + 1, GetIndex(nibble_path[i + 1])));
-        page_version = page->GetRoot()
-                           ->GetChild(GetIndex(nibble_path[i]))
-                           ->GetChildVersion(GetIndex(nibble_path[i + 1]));
-      } else {  // second level is leafnode
-        leafnode = static_cast<LeafNode *>(
-            page->GetRoot()->GetChild(GetIndex(nibble_path[i])));
-      }
-    } else {  // first level is leafnode
-      leafnode = static_cast<LeafNode *>(page->GetRoot());
+  DeltaPage *deltapage = page_store_->GetActiveDeltaPage(pid);
+  page_store_->PinActiveDeltaPage(pid);
+  update.deltapage = deltapage;
+  update.if_exceed = false;
+
+  if (2 * nibbles.size() + deltapage->GetDeltaPageUpdateCount() >= 2 * Td_) {
+    // the updates in page is more than the capacity of two deltapages
+    update.if_exceed = true;
+    // the page of this version becomes a checkpoint. an older version finds
+    // its page through the deltapage frozen here, so it is frozen even if it
+    // is empty, unless no page of the pid was written before.
+    if (deltapage->GetDeltaPageUpdateCount() != 0 ||
+        deltapage->GetLastPageKey().version != 0) {
+      PageKey deltapage_pagekey = {version, 0, true, pid};
+      // store frozen deltapage in cache
+      WritePageCache(deltapage_pagekey, deltapage->Freeze(deltapage_pagekey));
+      AddDeltaPageVersion(pid, version);
     }
   }
-  merkle_proof.value = value_store_->ReadValue(leafnode->GetLocation());
+  return update;
+}
+
+void DMMTrie::ApplyPageUpdate(PageUpdate &update, uint64_t version) {
+  DeltaPage *deltapage = update.if_exceed ? nullptr : update.deltapage;
+  bool checkpoint = update.page->UpdatePage(version, update.nibble_updates,
+                                            deltapage, update.pagekey);
+
+  if (checkpoint || update.if_exceed) {
+    // store basepage in cache, it is shared and not copied
+    WritePageCache(update.pagekey, update.page);
+  }
+  if (update.if_exceed) {
+    UpdatePageVersion(update.pagekey, version, version);
+    update.deltapage->ClearBasePageUpdateCount();
+    update.deltapage->SetLastPageKey(update.pagekey);
+  }
+}
+
+void DMMTrie::RunPageUpdates(vector<PageUpdate> &stage, uint64_t version) {
+  // pages of a stage are independent, only the shared version maps and
+  // page_cache_ are touched concurrently and they are guarded by a mutex
+  commit_pool_->ParallelFor(stage.size(), [&](size_t i) {
+    ApplyPageUpdate(stage[i], version);
+  });
+
+  for (auto &update : stage) {
+    if (concurrent_reads_) {
+      // publish the new version of the page, readers may still use the old
+      PutPage(update.pagekey, update.page);
+    } else {
+      UpdatePageKey(update.old_pagekey, update.pagekey);
+    }
+    // deltapage->SerializeTo();
+    page_store_->StoreActiveDeltaPage(update.deltapage);
+    page_store_->UnpinActiveDeltaPage(update.pagekey.pid);
+  }
+}
+
+string DMMTrie::GetRootHash(uint64_t tid, uint64_t version) {
+  return ReadPage({ReadVersion(version), tid, false, ""})->GetRoot()->GetHash();
+}
+
+DMMTrieProof DMMTrie::GetProof(uint64_t tid, uint64_t version,
+                               const string &key) {
+  DMMTrieProof merkle_proof;
+  version = ReadVersion(version);
+  uint64_t page_version = version;
+  bool found_leaf = false;
+  tuple<uint64_t, uint64_t, uint64_t> location;
+  char buffer[PAGE_SIZE];
+  for (int i = 0; i < key.size() + 1; i += 2) {
+    string pid = key.substr(0, i);
+    shared_ptr<BasePage> page;
+    BasePageView view;
+    bool exist = ReadPage({page_version, 0, false, pid}, buffer, page, view);
+    if (exist) {
+      exist = page != nullptr
+                  ? DescendPage(page->GetRoot(), key, i, page_version,
+                                found_leaf, location, &merkle_proof.proofs)
+                  : DescendPage(view.GetRoot(), key, i, page_version,
+                                found_leaf, location, &merkle_proof.proofs);
+    }
+    if (!exist) {
+      cout << "Key " << key << " not found at version " << version << endl;
+      merkle_proof.value = "";
+      return merkle_proof;
+    }
+  }
+  if (!found_leaf) {
+    cout << "Key " << key << " not found at version " << version << endl;
+    merkle_proof.value = "";
+    return merkle_proof;
+  }
+  merkle_proof.value = value_store_->ReadValue(location);
   reverse(merkle_proof.proofs.begin(), merkle_proof.proofs.end());
   return merkle_proof;
 }
@@ -1385,21 +1832,28 @@ bool DMMTrie::Verify(uint64_t tid, const string &key, const string &value,
 }
 
 bool DMMTrie::Verify(uint64_t tid, uint64_t version, string root_hash) {
-  return RecursiveVerify({version, tid, false, ""}) == root_hash;
+  PageKey pagekey{ReadVersion(version), tid, false, ""};
+  unique_lock<mutex> lock(verify_mutex_);
+  if (verify_pool_->Size() > 1) {
+    return ParallelVerify(pagekey) == root_hash;
+  }
+  lock.unlock();
+  return RecursiveVerify(pagekey) == root_hash;
 }
 
 string DMMTrie::RecursiveVerify(PageKey pagekey) {
-  BasePage *page = GetPage(pagekey);
+  // the handle keeps the page alive while child pages evict it from the cache
+  shared_ptr<BasePage> page = ReadPage(pagekey);
   if (page == nullptr) {
     return "";
   }
 
   if (page->GetRoot()->IsLeaf()) {
     // first level is indexnode
-    string value = value_store_->ReadValue(
+    VDLS::ValueView view = value_store_->ReadValueView(
         static_cast<LeafNode *>(page->GetRoot())->GetLocation());
     // return HashFunction(pagekey.pid + value);
-    return HashFunction(value);
+    return ValueHash(view);
   }
 
   string concatenated_hash;
@@ -1416,22 +1870,218 @@ string DMMTrie::RecursiveVerify(PageKey pagekey) {
           continue;
         }
         // call RecusiveVerify to calculate hash in child page
-        child_concatenated_hash +=
-            RecursiveVerify({pagekey.version, pagekey.tid, false,
-                             pagekey.pid + to_string(i) + to_string(j)});
+        child_concatenated_hash += RecursiveVerify(
+            {child->GetChildVersion(j), pagekey.tid, false,
+             pagekey.pid +
+                 EntryNibbles(false, false, i * DMM_NODE_FANOUT + j)});
       }
       concatenated_hash += HashFunction(child_concatenated_hash);
     } else {
-      string value = value_store_->ReadValue(
+      VDLS::ValueView view = value_store_->ReadValueView(
           static_cast<LeafNode *>(child)->GetLocation());
       // concatenated_hash += HashFunction(pagekey.pid + to_string(i) + value);
-      concatenated_hash += HashFunction(value);
+      concatenated_hash += ValueHash(view);
     }
   }
   return HashFunction(concatenated_hash);
 }
 
-void DMMTrie::Flush(uint64_t tid, uint64_t version) { page_store_->Flush(); }
+// the leaf hashes of a page and the keys of its child pages, in the order
+// RecursiveVerify concatenates their hashes
+struct DMMTrie::VerifyLayout {
+  enum class Child { kNone, kLeaf, kIndex };
+
+  bool root_is_leaf;
+  string root_hash;  // of a page whose root is a leaf
+  Child kinds[DMM_NODE_FANOUT];
+  string leaf_hashes[DMM_NODE_FANOUT];
+  // child pages below the index node i end at child_ends[i]
+  size_t child_ends[DMM_NODE_FANOUT];
+  vector<PageKey> child_pages;
+};
+
+// a page waiting for the hashes of its child pages
+struct DMMTrie::VerifyFrame {
+  VerifyLayout layout;
+  vector<string> child_hashes;
+  atomic<size_t> remaining;  // child pages not hashed yet
+  shared_ptr<VerifyFrame> parent;
+  size_t slot;   // in the child pages of parent
+  size_t bytes;  // charged to the memory budget
+};
+
+struct DMMTrie::VerifyJob {
+  size_t memory_budget;
+  atomic<size_t> frame_bytes;
+  chrono::nanoseconds read_interval;  // zero for no limit
+  mutex read_mutex;
+  chrono::steady_clock::time_point next_read;
+  string hash;  // of the root page
+};
+
+string DMMTrie::ParallelVerify(const PageKey &pagekey) {
+  VerifyJob job;
+  job.memory_budget = verify_memory_budget_;
+  job.frame_bytes = 0;
+  job.read_interval = chrono::nanoseconds(
+      verify_rate_limit_ == 0 ? 0 : 1000000000 / verify_rate_limit_);
+  job.next_read = chrono::steady_clock::now();
+  verify_pool_->Run([&]() { VerifyPageTask(job, pagekey, nullptr, 0); });
+  return job.hash;
+}
+
+bool DMMTrie::ReadVerifyLayout(VerifyJob &job, const PageKey &pagekey,
+                               VerifyLayout &layout) {
+  if (job.read_interval.count() > 0) {
+    chrono::steady_clock::time_point read_time;
+    {
+      lock_guard<mutex> lock(job.read_mutex);
+      read_time = max(job.next_read, chrono::steady_clock::now());
+      job.next_read = read_time + job.read_interval;
+    }
+    this_thread::sleep_until(read_time);
+  }
+  // the layout is taken out of the page before any child page is read
+  static thread_local vector<char> buffer(PAGE_SIZE);
+  shared_ptr<BasePage> page;
+  BasePageView view;
+  if (!ReadPage(pagekey, buffer.data(), page, view)) {
+    return false;
+  }
+  auto hash_leaf = [&](const tuple<uint64_t, uint64_t, uint64_t> &location) {
+    return ValueHash(value_store_->ReadValueView(location));
+  };
+  auto read = [&](auto root) {
+    layout.root_is_leaf = root->IsLeaf();
+    if (layout.root_is_leaf) {
+      layout.root_hash = hash_leaf(LeafLocation(root));
+      return;
+    }
+    for (int i = 0; i < DMM_NODE_FANOUT; i++) {
+      layout.kinds[i] = VerifyLayout::Child::kNone;
+      if (root->HasChild(i)) {
+        auto child = root->GetChild(i);
+        if (child->IsLeaf()) {
+          layout.kinds[i] = VerifyLayout::Child::kLeaf;
+          layout.leaf_hashes[i] = hash_leaf(LeafLocation(child));
+        } else {
+          layout.kinds[i] = VerifyLayout::Child::kIndex;
+          for (int j = 0; j < DMM_NODE_FANOUT; j++) {
+            if (child->HasChild(j)) {
+              layout.child_pages.push_back(
+                  {child->GetChildVersion(j), pagekey.tid, false,
+                   pagekey.pid +
+                       EntryNibbles(false, false, i * DMM_NODE_FANOUT + j)});
+            }
+          }
+        }
+      }
+      layout.child_ends[i] = layout.child_pages.size();
+    }
+  };
+  if (page != nullptr) {
+    read(page->GetRoot());
+  } else {
+    read(view.GetRoot());
+  }
+  return true;
+}
+
+string DMMTrie::HashVerifyLayout(const VerifyLayout &layout,
+                                 const vector<string> &child_hashes) {
+  if (layout.root_is_leaf) {
+    return layout.root_hash;
+  }
+  string concatenated_hash;
+  size_t child_begin = 0;
+  for (int i = 0; i < DMM_NODE_FANOUT; i++) {
+    if (layout.kinds[i] == VerifyLayout::Child::kLeaf) {
+      concatenated_hash += layout.leaf_hashes[i];
+    } else if (layout.kinds[i] == VerifyLayout::Child::kIndex) {
+      string child_concatenated_hash;
+      for (size_t k = child_begin; k < layout.child_ends[i]; k++) {
+        child_concatenated_hash += child_hashes[k];
+      }
+      concatenated_hash += HashFunction(child_concatenated_hash);
+    }
+    child_begin = layout.child_ends[i];
+  }
+  return HashFunction(concatenated_hash);
+}
+
+void DMMTrie::VerifyPageTask(VerifyJob &job, const PageKey &pagekey,
+                             shared_ptr<VerifyFrame> parent, size_t slot) {
+  shared_ptr<VerifyFrame> frame = make_shared<VerifyFrame>();
+  VerifyLayout &layout = frame->layout;
+  if (!ReadVerifyLayout(job, pagekey, layout)) {
+    FinishVerifyPage(job, move(parent), slot, "");
+    return;
+  }
+  size_t num_children = layout.root_is_leaf ? 0 : layout.child_pages.size();
+  size_t bytes = sizeof(VerifyFrame) + pagekey.pid.size() * num_children +
+                 (sizeof(PageKey) + sizeof(string) + HASH_SIZE) * num_children;
+  if (num_children == 0 ||
+      job.frame_bytes.load() + bytes > job.memory_budget) {
+    // over the budget, the subtree is verified by this thread
+    vector<string> child_hashes;
+    for (size_t k = 0; k < num_children; k++) {
+      child_hashes.push_back(VerifySubtree(job, layout.child_pages[k]));
+    }
+    FinishVerifyPage(job, move(parent), slot,
+                     HashVerifyLayout(layout, child_hashes));
+    return;
+  }
+  job.frame_bytes += bytes;
+  frame->child_hashes.resize(num_children);
+  frame->remaining = num_children;
+  frame->parent = move(parent);
+  frame->slot = slot;
+  frame->bytes = bytes;
+  // the newest task is taken first, so the child pages start in pid order
+  for (size_t k = num_children; k-- > 0;) {
+    verify_pool_->Spawn([this, &job, frame, k]() {
+      VerifyPageTask(job, frame->layout.child_pages[k], frame, k);
+    });
+  }
+}
+
+string DMMTrie::VerifySubtree(VerifyJob &job, const PageKey &pagekey) {
+  VerifyLayout layout;
+  if (!ReadVerifyLayout(job, pagekey, layout)) {
+    return "";
+  }
+  vector<string> child_hashes;
+  if (!layout.root_is_leaf) {
+    for (const PageKey &child_page : layout.child_pages) {
+      child_hashes.push_back(VerifySubtree(job, child_page));
+    }
+  }
+  return HashVerifyLayout(layout, child_hashes);
+}
+
+void DMMTrie::FinishVerifyPage(VerifyJob &job, shared_ptr<VerifyFrame> parent,
+                               size_t slot, string hash) {
+  while (parent != nullptr) {
+    parent->child_hashes[slot] = move(hash);
+    if (parent->remaining.fetch_sub(1) != 1) {
+      return;
+    }
+    // the last child page hashes the page
+    hash = HashVerifyLayout(parent->layout, parent->child_hashes);
+    job.frame_bytes -= parent->bytes;
+    slot = parent->slot;
+    shared_ptr<VerifyFrame> grandparent = parent->parent;
+    parent = move(grandparent);
+  }
+  job.hash = move(hash);
+}
+
+void DMMTrie::Flush(uint64_t tid, uint64_t version) {
+  // the values go to disk before the pages that locate them
+  value_store_->WaitDurable(version);
+  unique_lock<shared_mutex> lock(store_mutex_);
+  page_store_->Flush();
+}
 
 void DMMTrie::Revert(uint64_t tid, uint64_t version) {}
 
@@ -1448,6 +2098,7 @@ DeltaPage *DMMTrie::GetDeltaPage(const string &pid) {
 }
 
 pair<uint64_t, uint64_t> DMMTrie::GetPageVersion(PageKey pagekey) {
+  lock_guard<mutex> lock(page_meta_mutex_);
   auto it = page_versions_.find(pagekey.pid);
   if (it != page_versions_.end()) {
     return it->second;
@@ -1456,6 +2107,7 @@ pair<uint64_t, uint64_t> DMMTrie::GetPageVersion(PageKey pagekey) {
 }
 
 PageKey DMMTrie::GetLatestBasePageKey(PageKey pagekey) const {
+  lock_guard<mutex> lock(page_meta_mutex_);
   auto it = page_versions_.find(pagekey.pid);
   if (it != page_versions_.end()) {
     return {it->second.second, pagekey.tid, false, pagekey.pid};
@@ -1465,18 +2117,23 @@ PageKey DMMTrie::GetLatestBasePageKey(PageKey pagekey) const {
 
 void DMMTrie::UpdatePageVersion(PageKey pagekey, uint64_t current_version,
                                 uint64_t latest_basepage_version) {
+  lock_guard<mutex> lock(page_meta_mutex_);
   page_versions_[pagekey.pid] = {current_version, latest_basepage_version};
 }
 
-void DMMTrie::WritePageCache(PageKey pagekey, Page *page) {
-  page_cache_[pagekey] = page;
+void DMMTrie::WritePageCache(PageKey pagekey, shared_ptr<Page> page) {
+  lock_guard<mutex> lock(page_meta_mutex_);
+  page_cache_[pagekey] = move(page);
 }
 
+
 void DMMTrie::AddDeltaPageVersion(const string &pid, uint64_t version) {
+  lock_guard<mutex> lock(page_meta_mutex_);
   deltapage_versions_[pid].push_back(version);
 }
 
 uint64_t DMMTrie::GetVersionUpperbound(const string &pid, uint64_t version) {
+  lock_guard<mutex> lock(page_meta_mutex_);
   if (deltapage_versions_.find(pid) == deltapage_versions_.end()) {
     return 0;  // no deltapage of this pid
   }
@@ -1490,61 +2147,869 @@ uint64_t DMMTrie::GetVersionUpperbound(const string &pid, uint64_t version) {
   return *it;
 }
 
-BasePage *DMMTrie::GetPage(
+void DMMTrie::SetCommitThreads(size_t num_threads) {
+  commit_pool_.reset(new ThreadPool(num_threads));
+}
+
+void DMMTrie::SetVerifyThreads(size_t num_threads) {
+  lock_guard<mutex> lock(verify_mutex_);
+  verify_pool_.reset(new WorkStealingPool(num_threads));
+}
+
+void DMMTrie::SetVerifyBudget(size_t memory_bytes, uint64_t pages_per_second) {
+  lock_guard<mutex> lock(verify_mutex_);
+  verify_memory_budget_ = memory_bytes;
+  verify_rate_limit_ = pages_per_second;
+}
+
+void DMMTrie::SetConcurrentReads(bool enable) { concurrent_reads_ = enable; }
+
+uint64_t DMMTrie::GetCommittedVersion() const { return committed_version_; }
+
+void DMMTrie::SetCacheBudget(size_t bytes) { cache_.SetBudget(bytes); }
+
+void DMMTrie::SetDurability(VDLS::DurabilityPolicy policy,
+                            uint64_t interval_ms) {
+  value_store_->SetDurability(policy, interval_ms);
+}
+
+uint64_t DMMTrie::GetDurableVersion() const {
+  return value_store_->GetDurableVersion();
+}
+
+void DMMTrie::SetValueDedup(size_t table_entries, size_t min_value_size) {
+  value_store_->SetDedup(table_entries, min_value_size);
+}
+
+VDLS::DedupStats DMMTrie::GetValueDedupStats() const {
+  return value_store_->GetDedupStats();
+}
+
+bool DMMTrie::SetValueCompression(CompressionCodec codec, size_t block_size) {
+  return value_store_->SetCompression(codec, block_size);
+}
+
+void DMMTrie::SetValueReadThreads(size_t num_threads) {
+  value_store_->SetReadThreads(num_threads);
+}
+
+void DMMTrie::SetValueInlineSize(size_t max_size) {
+  value_store_->SetInlineValueSize(max_size);
+}
+
+void DMMTrie::SetChecksumVerify(ChecksumVerify mode, uint32_t sample_rate) {
+  value_store_->SetChecksumVerify(mode, sample_rate);
+  page_store_->SetChecksumVerify(mode, sample_rate);
+}
+
+void DMMTrie::SetPinnedCacheLevels(size_t levels) {
+  cache_.SetPinnedLevels(levels);
+}
+
+PageCache::Stats DMMTrie::GetCacheStats() const { return cache_.GetStats(); }
+
+shared_ptr<BasePage> DMMTrie::GetPage(
     const PageKey &pagekey) {  // get a page by its pagekey
-  auto it = lru_cache_.find(pagekey);
-  if (it != lru_cache_.end()) {  // page is in cache
-    // move the accessed page to the front
-    pagekeys_.splice(pagekeys_.begin(), pagekeys_, it->second);
-    it->second = pagekeys_.begin();  // update iterator
-    return it->second->second;
+  shared_ptr<BasePage> cached_page = GetCachedPage(pagekey);
+  if (cached_page != nullptr) {
+    return cached_page;
   }
   // page is not in cache, fetch it from LSVPS
-  BasePage *page = page_store_->LoadPage(pagekey);
+  shared_ptr<BasePage> page = page_store_->LoadPage(pagekey);
   if (!page) {  // page is not found in disk
     return nullptr;
   }
   // if (!page->GetRoot()) {  // page is not found in disk
   //   return nullptr;
   // }
-  PutPage(pagekey, page);
-  return page;
+  return cache_.PutIfAbsent(pagekey, move(page));
 }
 
-void DMMTrie::PutPage(const PageKey &pagekey,
-                      BasePage *page) {        // add page to cache
-  if (lru_cache_.size() >= max_cache_size_) {  // cache is full
-    PageKey last_key = pagekeys_.back().first;
-    auto last_iter = lru_cache_.find(last_key);
-    delete last_iter->second->second;  // release memory of basepage
+shared_ptr<BasePage> DMMTrie::GetCachedPage(const PageKey &pagekey) {
+  return cache_.Get(pagekey);
+}
 
-    // remove the page whose pagekey is at the tail of list
-    lru_cache_.erase(last_key);
-    pagekeys_.pop_back();
+shared_ptr<BasePage> DMMTrie::GetPageForWrite(const PageKey &pagekey) {
+  shared_ptr<BasePage> page = GetPage(pagekey);
+  if (page == nullptr) {
+    return nullptr;
+  }
+  if (concurrent_reads_) {
+    // readers may hold the cached page, the copy replaces it when the new
+    // version is published
+    return make_shared<BasePage>(*page);
   }
-  auto it = lru_cache_.find(pagekey);
-  if (it != lru_cache_.end()) {
-    delete it->second->second;
-    pagekeys_.erase(it->second);
-    lru_cache_.erase(it);
+  // the page may be a checkpoint still buffered by LSVPS or the page of an
+  // older version handed out by it, modify a private copy then. besides this
+  // function only the page cache may hold a handle, unless it evicted the
+  // page already.
+  if (page.use_count() > (cache_.Holds(pagekey, page.get()) ? 2 : 1)) {
+    page = make_shared<BasePage>(*page);
+    PutPage(pagekey, page);
   }
-  // insert the pair of PageKey and BasePage* to the front
-  pagekeys_.push_front(make_pair(pagekey, page));
-  lru_cache_[pagekey] = pagekeys_.begin();
+  return page;
+}
+
+bool DMMTrie::ReadPage(const PageKey &pagekey, char *buffer,
+                       shared_ptr<BasePage> &page, BasePageView &view) {
+  page = GetCachedPage(pagekey);
+  if (page == nullptr) {
+    {
+      shared_lock<shared_mutex> lock(store_mutex_);
+      page = page_store_->LoadPage(pagekey, buffer);
+    }
+    if (page == nullptr) {  // LSVPS handed out the serialized page
+      view = BasePageView(buffer);
+      return true;
+    }
+    // a commit or a prefetch may have cached the page meanwhile, the cached
+    // one is kept
+    page = cache_.PutIfAbsent(pagekey, move(page));
+  }
+  return page->GetRoot() != nullptr;
+}
+
+shared_ptr<BasePage> DMMTrie::ReadPage(const PageKey &pagekey) {
+  shared_ptr<BasePage> page = GetCachedPage(pagekey);
+  if (page == nullptr) {
+    {
+      shared_lock<shared_mutex> lock(store_mutex_);
+      page = page_store_->LoadPage(pagekey);
+    }
+    if (page != nullptr) {
+      page = cache_.PutIfAbsent(pagekey, move(page));
+    }
+  }
+  return page;
+}
+
+uint64_t DMMTrie::ReadVersion(uint64_t version) const {
+  // pages of a version being committed are not complete yet
+  uint64_t committed_version = committed_version_;
+  return concurrent_reads_ && version > committed_version ? committed_version
+                                                          : version;
+}
+
+void DMMTrie::PutPage(const PageKey &pagekey,
+                      shared_ptr<BasePage> page) {  // add page to cache
+  cache_.Put(pagekey, move(page));
 }
 
 void DMMTrie::UpdatePageKey(
     const PageKey &old_pagekey,
-    const PageKey &new_pagekey) {  // update pagekey in lru cache
-  auto it = lru_cache_.find(old_pagekey);
-  if (it != lru_cache_.end()) {
-    // save the basepage indexed by old pagekey
-    BasePage *basepage = it->second->second;
+    const PageKey &new_pagekey) {  // update pagekey in page cache
+  cache_.Rekey(old_pagekey, new_pagekey);
+}
+
+// the entries of a page in key order: a leaf root is slot 0, a leaf child of
+// the root is slot a * 16 and the child page below nibbles a and b is slot
+// a * 16 + b. NextEntry returns the first entry from slot on, kEntrySlots if there
+// is none, PrevEntry the last entry up to slot, -1 if there is none, so slots
+// are signed.
+static constexpr int kEntryFanout = static_cast<int>(DMM_NODE_FANOUT);
+static constexpr int kEntrySlots = kEntryFanout * kEntryFanout;
+
+template <typename NodeRef>
+static int NextEntry(NodeRef root, int slot) {
+  if (slot >= kEntrySlots) {
+    return kEntrySlots;
+  }
+  if (root->IsLeaf()) {
+    return slot <= 0 ? 0 : kEntrySlots;
+  }
+  for (int a = slot / kEntryFanout; a < kEntryFanout; a++) {
+    if (!root->HasChild(a)) {
+      continue;
+    }
+    int b = a == slot / kEntryFanout ? slot % kEntryFanout : 0;
+    auto child = root->GetChild(a);
+    if (child->IsLeaf()) {
+      if (b == 0) {
+        return a * kEntryFanout;
+      }
+      continue;
+    }
+    for (; b < kEntryFanout; b++) {
+      if (child->HasChild(b)) {
+        return a * kEntryFanout + b;
+      }
+    }
+  }
+  return kEntrySlots;
+}
+
+template <typename NodeRef>
+static int PrevEntry(NodeRef root, int slot) {
+  if (slot < 0) {
+    return -1;
+  }
+  if (root->IsLeaf()) {
+    return 0;
+  }
+  for (int a = slot / kEntryFanout; a >= 0; a--) {
+    if (!root->HasChild(a)) {
+      continue;
+    }
+    int b = a == slot / kEntryFanout ? slot % kEntryFanout : kEntryFanout - 1;
+    auto child = root->GetChild(a);
+    if (child->IsLeaf()) {
+      return a * kEntryFanout;
+    }
+    for (; b >= 0; b--) {
+      if (child->HasChild(b)) {
+        return a * kEntryFanout + b;
+      }
+    }
+  }
+  return -1;
+}
+
+// returns true if the entry at slot is a leaf and sets its location, otherwise
+// sets the version of the child page
+template <typename NodeRef>
+static bool EntryAt(NodeRef root, int slot, uint64_t &page_version,
+                    tuple<uint64_t, uint64_t, uint64_t> &location) {
+  if (root->IsLeaf()) {
+    location = LeafLocation(root);
+    return true;
+  }
+  auto child = root->GetChild(slot / DMM_NODE_FANOUT);
+  if (child->IsLeaf()) {
+    location = LeafLocation(child);
+    return true;
+  }
+  page_version = child->GetChildVersion(slot % DMM_NODE_FANOUT);
+  return false;
+}
+
+void DMMTrie::SetGcRateLimit(uint64_t bytes_per_second) {
+  value_store_->SetRewriteRateLimit(bytes_per_second);
+}
+
+size_t DMMTrie::CollectGarbage(uint64_t tid, uint64_t oldest_version) {
+  // versions share most of their pages, every page is walked once
+  VDLS::LiveRecords live;
+  set<pair<string, uint64_t>> visited;
+  vector<char> buffer(PAGE_SIZE);
+  uint64_t newest_version = committed_version_;
+  for (uint64_t version = oldest_version; version <= newest_version;
+       version++) {
+    CollectLiveValues({version, tid, false, ""}, visited, buffer, live);
+  }
+  return value_store_->CollectGarbage(live);
+}
+
+void DMMTrie::CollectLiveValues(const PageKey &pagekey,
+                                set<pair<string, uint64_t>> &visited,
+                                vector<char> &buffer,
+                                VDLS::LiveRecords &live) {
+  shared_ptr<BasePage> page;
+  BasePageView view;
+  if (!ReadPage(pagekey, buffer.data(), page, view)) {
+    return;
+  }
+  // child versions name the page exactly, a page shared by several versions
+  // of the trie is only walked once
+  if (!visited.insert({pagekey.pid, pagekey.version}).second) {
+    return;
+  }
+  vector<PageKey> children;
+  auto collect = [&](auto root) {
+    for (int slot = NextEntry(root, 0); slot < kEntrySlots;
+         slot = NextEntry(root, slot + 1)) {
+      uint64_t child_version;
+      tuple<uint64_t, uint64_t, uint64_t> location;
+      if (EntryAt(root, slot, child_version, location)) {
+        if (!VDLS::IsInline(location)) {
+          live[get<0>(location)].emplace_back(get<1>(location),
+                                              get<2>(location));
+        }
+      } else {
+        children.push_back({child_version, pagekey.tid, false,
+                            pagekey.pid + EntryNibbles(false, false, slot)});
+      }
+    }
+  };
+  if (page != nullptr) {
+    collect(page->GetRoot());
+  } else {
+    collect(view.GetRoot());
+  }
+  // the buffer is reused by the child pages once the entries are collected
+  page.reset();
+  for (const PageKey &child : children) {
+    CollectLiveValues(child, visited, buffer, live);
+  }
+}
+
+DMMTrieScrubber::DMMTrieScrubber(DMMTrie *trie, uint64_t tid,
+                                 uint64_t version, const string &root_hash,
+                                 const string &checkpoint_path)
+    : trie_(trie),
+      tid_(tid),
+      version_(version),
+      root_hash_(root_hash),
+      checkpoint_path_(checkpoint_path),
+      buffer_(PAGE_SIZE),
+      stop_(false),
+      rate_limit_(kDefaultRateLimit),
+      status_{State::kIdle, "", 0, 0, "", ""},
+      cursor_valid_(false) {
+  LoadCheckpoint();
+}
+
+DMMTrieScrubber::~DMMTrieScrubber() { Stop(); }
+
+void DMMTrieScrubber::SetRateLimit(uint64_t pages_per_second) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    rate_limit_ = pages_per_second;
+  }
+  cv_.notify_all();
+}
+
+void DMMTrieScrubber::Start() {
+  lock_guard<mutex> join_lock(join_mutex_);
+  lock_guard<mutex> lock(mutex_);
+  if (status_.state != State::kIdle || scrub_thread_.joinable()) {
+    return;  // running or done
+  }
+  stop_ = false;
+  status_.state = State::kRunning;
+  scrub_thread_ = thread(&DMMTrieScrubber::ScrubLoop, this);
+}
+
+void DMMTrieScrubber::Stop() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  Join();
+}
+
+DMMTrieScrubber::Status DMMTrieScrubber::Wait() {
+  Join();
+  return GetStatus();
+}
+
+void DMMTrieScrubber::Join() {
+  // Wait and Stop may run on different threads, only one of them joins
+  lock_guard<mutex> lock(join_mutex_);
+  if (scrub_thread_.joinable()) {
+    scrub_thread_.join();
+  }
+}
+
+DMMTrieScrubber::Status DMMTrieScrubber::GetStatus() const {
+  lock_guard<mutex> lock(mutex_);
+  return status_;
+}
+
+void DMMTrieScrubber::ScrubLoop() {
+  // every page and value read by the scrub checks its checksum
+  ChecksumPolicy::ScrubScope scope;
+  vector<Task> tasks{{{version_, tid_, false, ""}, root_hash_}};
+  auto ready_time = chrono::steady_clock::now();
+  uint64_t unsaved = 0;
+  bool passed = true;
+  while (!tasks.empty()) {
+    {
+      unique_lock<mutex> lock(mutex_);
+      while (!stop_ && rate_limit_ > 0 &&
+             chrono::steady_clock::now() < ready_time) {
+        cv_.wait_until(lock, ready_time);
+      }
+      if (stop_) {
+        passed = false;
+        break;
+      }
+    }
+    Task task = move(tasks.back());
+    tasks.pop_back();
+    bool checked = false;
+    if (!ScrubPage(task, tasks, checked)) {
+      passed = false;
+      break;
+    }
+    if (checked) {
+      lock_guard<mutex> lock(mutex_);
+      if (rate_limit_ > 0) {
+        ready_time = max(ready_time, chrono::steady_clock::now()) +
+                     chrono::microseconds(1000000 / rate_limit_);
+      }
+    }
+    if (checked && ++unsaved >= kCheckpointInterval) {
+      WriteCheckpoint();
+      unsaved = 0;
+    }
+  }
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (passed) {
+      status_.state = State::kPassed;
+    } else if (status_.state == State::kRunning) {  // stopped
+      status_.state = State::kIdle;
+    }
+  }
+  WriteCheckpoint();
+}
+
+bool DMMTrieScrubber::ScrubPage(const Task &task, vector<Task> &tasks,
+                                bool &checked) {
+  const string &pid = task.pagekey.pid;
+  shared_ptr<BasePage> page;
+  BasePageView view;
+  try {
+    // read past the page cache, the page isn't put into it
+    shared_lock<shared_mutex> lock(trie_->store_mutex_);
+    page = trie_->page_store_->LoadPage(task.pagekey, buffer_.data());
+  } catch (const exception &e) {
+    return Diverge(pid, e.what());
+  }
+  if (page == nullptr) {  // LSVPS handed out the serialized page
+    view = BasePageView(buffer_.data());
+  } else if (page->GetRoot() == nullptr) {
+    return Diverge(pid, "page not found");
+  }
+  // only this thread changes the cursor
+  const string &cursor = status_.cursor;
+  checked = !cursor_valid_ || pid > cursor;
+  uint64_t values = 0;
+  auto scrub = [&](auto root) {
+    // the child pages are popped in pid order, which is the order of keys
+    size_t first_child = tasks.size();
+    for (int slot = NextEntry(root, 0); slot < kEntrySlots;
+         slot = NextEntry(root, slot + 1)) {
+      auto child = root->IsLeaf() ? root : root->GetChild(slot / DMM_NODE_FANOUT);
+      if (child->IsLeaf()) {
+        continue;
+      }
+      string child_pid = pid + EntryNibbles(false, false, slot);
+      if (!cursor_valid_ || child_pid > cursor ||
+          cursor.compare(0, child_pid.size(), child_pid) == 0) {
+        int index = slot % DMM_NODE_FANOUT;
+        tasks.push_back({{child->GetChildVersion(index), tid_, false, child_pid},
+                         child->GetChildHash(index)});
+      }
+    }
+    reverse(tasks.begin() + first_child, tasks.end());
+    string hash;
+    return !checked ||
+           DeriveHash(root, true, pid, task.expected_hash, hash, values);
+  };
+  if (!(page != nullptr ? scrub(page->GetRoot()) : scrub(view.GetRoot()))) {
+    return false;
+  }
+  if (checked) {
+    lock_guard<mutex> lock(mutex_);
+    status_.cursor = pid;
+    status_.pages++;
+    status_.values += values;
+    cursor_valid_ = true;
+  }
+  return true;
+}
+
+template <typename NodeRef>
+bool DMMTrieScrubber::DeriveHash(NodeRef node, bool is_root, const string &pid,
+                                 const string &expected_hash, string &hash,
+                                 uint64_t &values) {
+  if (node->IsLeaf()) {
+    try {
+      VDLS::ValueView view =
+          trie_->value_store_->ReadValueView(LeafLocation(node));
+      hash = ValueHash(view);
+    } catch (const exception &e) {
+      return Diverge(pid, e.what());
+    }
+    values++;
+  } else {
+    string concatenated_hash;
+    for (int i = 0; i < DMM_NODE_FANOUT; i++) {
+      if (!node->HasChild(i)) {
+        continue;
+      }
+      string child_hash;
+      if (!is_root) {  // the child page is checked against it later
+        child_hash = node->GetChildHash(i);
+      } else if (!DeriveHash(node->GetChild(i), false,
+                             pid + EntryNibbles(false, true, i * DMM_NODE_FANOUT),
+                             node->GetChildHash(i), child_hash, values)) {
+        return false;
+      }
+      concatenated_hash += child_hash;
+    }
+    hash = HashFunction(concatenated_hash);
+  }
+  if (hash != node->GetHash()) {
+    return Diverge(pid, "node hash doesn't match its children");
+  }
+  if (hash != expected_hash) {
+    return Diverge(pid, "node hash doesn't match its parent");
+  }
+  return true;
+}
+
+bool DMMTrieScrubber::Diverge(const string &pid, const string &error) {
+  lock_guard<mutex> lock(mutex_);
+  status_.state = State::kDiverged;
+  status_.divergent_pid = pid;
+  status_.error = error;
+  return false;
+}
+
+/* checkpoint file format:
+   | magic (8) | version (8) | pages (8) | values (8) | state (4) |
+   cursor_valid (1) | root hash, cursor, divergent pid and error, each as
+   size (8) and bytes | crc32c (4) | */
+bool DMMTrieScrubber::LoadCheckpoint() {
+  ifstream in(checkpoint_path_, ios::binary);
+  if (!in) {
+    return false;
+  }
+  string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  if (data.size() < 37 + 4 * sizeof(uint64_t) + sizeof(uint32_t) ||
+      !ChecksumMatches(data.data(), data.size())) {
+    return false;
+  }
+  size_t offset = 0;
+  auto read = [&](void *out, size_t size) {
+    if (offset + size > data.size() - sizeof(uint32_t)) {
+      return false;
+    }
+    memcpy(out, data.data() + offset, size);
+    offset += size;
+    return true;
+  };
+  auto read_string = [&](string &out) {
+    uint64_t size;
+    if (!read(&size, sizeof(size)) ||
+        size > data.size() - sizeof(uint32_t) - offset) {
+      return false;
+    }
+    out.assign(data.data() + offset, size);
+    offset += size;
+    return true;
+  };
+  uint64_t magic, version;
+  uint32_t state;
+  bool cursor_valid;
+  Status status{State::kIdle, "", 0, 0, "", ""};
+  string root_hash;
+  if (!read(&magic, sizeof(magic)) || magic != kCheckpointMagic ||
+      !read(&version, sizeof(version)) || !read(&status.pages, 8) ||
+      !read(&status.values, 8) || !read(&state, sizeof(state)) ||
+      !read(&cursor_valid, sizeof(cursor_valid)) || !read_string(root_hash) ||
+      !read_string(status.cursor) || !read_string(status.divergent_pid) ||
+      !read_string(status.error)) {
+    return false;
+  }
+  // a checkpoint of another scrub is started over
+  if (version != version_ || root_hash != root_hash_ ||
+      state > static_cast<uint32_t>(State::kDiverged)) {
+    return false;
+  }
+  status.state = static_cast<State>(state);
+  if (status.state == State::kRunning) {
+    status.state = State::kIdle;
+  }
+  lock_guard<mutex> lock(mutex_);
+  status_ = status;
+  cursor_valid_ = cursor_valid;
+  return true;
+}
+
+void DMMTrieScrubber::WriteCheckpoint() {
+  string data;
+  auto append = [&](const void *in, size_t size) {
+    data.append(static_cast<const char *>(in), size);
+  };
+  auto append_string = [&](const string &in) {
+    uint64_t size = in.size();
+    append(&size, sizeof(size));
+    data += in;
+  };
+  {
+    lock_guard<mutex> lock(mutex_);
+    uint32_t state = static_cast<uint32_t>(status_.state);
+    append(&kCheckpointMagic, sizeof(kCheckpointMagic));
+    append(&version_, sizeof(version_));
+    append(&status_.pages, sizeof(status_.pages));
+    append(&status_.values, sizeof(status_.values));
+    append(&state, sizeof(state));
+    append(&cursor_valid_, sizeof(cursor_valid_));
+    append_string(root_hash_);
+    append_string(status_.cursor);
+    append_string(status_.divergent_pid);
+    append_string(status_.error);
+  }
+  data.resize(data.size() + sizeof(uint32_t));
+  SealChecksum(&data[0], data.size());
+  // the old checkpoint is replaced only by a complete new one, and the new
+  // one is on disk before the rename is
+  string temp_path = checkpoint_path_ + ".tmp";
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                S_IRUSR | S_IWUSR);
+  bool written = fd != -1 &&
+                 write(fd, data.data(), data.size()) ==
+                     static_cast<ssize_t>(data.size()) &&
+                 fsync(fd) == 0;
+  if (fd != -1) {
+    close(fd);
+  }
+  if (!written || rename(temp_path.c_str(), checkpoint_path_.c_str()) == -1) {
+    cerr << "Failed to write scrub checkpoint " << temp_path << endl;
+    return;
+  }
+  string dir = filesystem::path(checkpoint_path_).parent_path().string();
+  int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir_fd != -1) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+}
+
+DMMTrieIterator::DMMTrieIterator(DMMTrie *trie, uint64_t version,
+                                 const string &begin, const string &end)
+    : trie_(trie),
+      version_(version),
+      begin_(begin),
+      end_(end),
+      valid_(false),
+      stop_prefetch_(false) {}
+
+DMMTrieIterator::~DMMTrieIterator() {
+  {
+    lock_guard<mutex> lock(prefetch_mutex_);
+    stop_prefetch_ = true;
+  }
+  prefetch_cv_.notify_one();
+  if (prefetch_thread_.joinable()) {
+    prefetch_thread_.join();
+  }
+}
+
+bool DMMTrieIterator::Valid() const { return valid_; }
+
+void DMMTrieIterator::SeekToFirst() { Seek(begin_); }
+
+void DMMTrieIterator::SeekToLast() {
+  valid_ = SeekLast() && key_ >= begin_;
+}
+
+void DMMTrieIterator::Seek(const string &key) {
+  valid_ = SeekFrom(max(key, begin_)) && (end_.empty() || key_ < end_);
+}
+
+void DMMTrieIterator::Next() {
+  if (!valid_) {
+    return;
+  }
+  Step(stack_.back(), true);
+  valid_ = Settle(true) && (end_.empty() || key_ < end_);
+}
 
-    pagekeys_.erase(it->second);  // delete old pagekey item
-    lru_cache_.erase(it);
+void DMMTrieIterator::Prev() {
+  if (!valid_) {
+    return;
+  }
+  Step(stack_.back(), false);
+  valid_ = Settle(false) && key_ >= begin_;
+}
+
+const string &DMMTrieIterator::Key() const { return key_; }
+
+string DMMTrieIterator::Value() const {
+  return trie_->value_store_->ReadValue(location_);
+}
 
-    pagekeys_.push_front(make_pair(new_pagekey, basepage));
-    lru_cache_[new_pagekey] = pagekeys_.begin();
+bool DMMTrieIterator::PushPage(const PageKey &pagekey) {
+  size_t level = pagekey.pid.size() / 2;
+  if (buffers_.size() <= level) {
+    buffers_.resize(level + 1);
   }
-}
\ No newline at end of file
+  buffers_[level].resize(PAGE_SIZE);
+  Frame frame{pagekey, nullptr, BasePageView(), 0};
+  if (!trie_->ReadPage(pagekey, buffers_[level].data(), frame.page,
+                       frame.view)) {
+    return false;
+  }
+  stack_.push_back(move(frame));
+  return true;
+}
+
+bool DMMTrieIterator::SeekFrom(const string &key) {
+  stack_.clear();
+  if (!PushPage({version_, 0, false, ""})) {
+    return false;
+  }
+  // follow the pages whose pid is a prefix of key, the first entry not less
+  // than key is below the last one
+  while (true) {
+    Frame &frame = stack_.back();
+    const string &pid = frame.pagekey.pid;
+    size_t i = pid.size();
+    if (key.size() <= i) {  // every key of the page is not less than key
+      frame.slot = frame.page != nullptr
+                       ? NextEntry(frame.page->GetRoot(), 0)
+                       : NextEntry(frame.view.GetRoot(), 0);
+      return Settle(true);
+    }
+    int a = GetIndex(key[i]);
+    int b = key.size() > i + 1 ? GetIndex(key[i + 1]) : 0;
+    if (a < 0 || b < 0) {
+      throw runtime_error("iterator keys must be hex strings");
+    }
+    int slot = a * DMM_NODE_FANOUT + b;
+    int entry = frame.page != nullptr ? NextEntry(frame.page->GetRoot(), slot)
+                                      : NextEntry(frame.view.GetRoot(), slot);
+    frame.slot = entry;
+    if (entry != slot) {
+      return Settle(true);
+    }
+    uint64_t page_version = 0;
+    tuple<uint64_t, uint64_t, uint64_t> location;
+    bool root_is_leaf = frame.page != nullptr
+                            ? frame.page->GetRoot()->IsLeaf()
+                            : frame.view.GetRoot().IsLeaf();
+    bool is_leaf =
+        frame.page != nullptr
+            ? EntryAt(frame.page->GetRoot(), slot, page_version, location)
+            : EntryAt(frame.view.GetRoot(), slot, page_version, location);
+    string entry_key = pid + EntryNibbles(root_is_leaf, is_leaf, slot);
+    if (is_leaf || key.size() == i + 1) {
+      // a leaf that equals key or is a prefix of it, or a child page whose
+      // keys are all greater than key
+      if (entry_key < key) {
+        Step(frame, true);
+      }
+      return Settle(true);
+    }
+    if (!PushPage({page_version, 0, false, entry_key})) {
+      Step(frame, true);
+      return Settle(true);
+    }
+  }
+}
+
+bool DMMTrieIterator::SeekLast() {
+  // the last key before end, or the last key of the trie
+  if (!end_.empty() && SeekFrom(end_)) {
+    Step(stack_.back(), false);
+    return Settle(false);
+  }
+  stack_.clear();
+  if (!PushPage({version_, 0, false, ""})) {
+    return false;
+  }
+  Frame &frame = stack_.back();
+  frame.slot = frame.page != nullptr
+                   ? PrevEntry(frame.page->GetRoot(), kEntrySlots - 1)
+                   : PrevEntry(frame.view.GetRoot(), kEntrySlots - 1);
+  return Settle(false);
+}
+
+void DMMTrieIterator::Step(Frame &frame, bool forward) {
+  if (frame.page != nullptr) {
+    frame.slot = forward ? NextEntry(frame.page->GetRoot(), frame.slot + 1)
+                         : PrevEntry(frame.page->GetRoot(), frame.slot - 1);
+  } else {
+    frame.slot = forward ? NextEntry(frame.view.GetRoot(), frame.slot + 1)
+                         : PrevEntry(frame.view.GetRoot(), frame.slot - 1);
+  }
+}
+
+bool DMMTrieIterator::Settle(bool forward) {
+  while (!stack_.empty()) {
+    Frame &frame = stack_.back();
+    if (frame.slot < 0 || frame.slot >= kEntrySlots) {  // the page is done
+      stack_.pop_back();
+      if (!stack_.empty()) {
+        Step(stack_.back(), forward);
+      }
+      continue;
+    }
+    uint64_t page_version = 0;
+    bool root_is_leaf, is_leaf;
+    if (frame.page != nullptr) {
+      root_is_leaf = frame.page->GetRoot()->IsLeaf();
+      is_leaf = EntryAt(frame.page->GetRoot(), frame.slot, page_version,
+                        location_);
+    } else {
+      root_is_leaf = frame.view.GetRoot().IsLeaf();
+      is_leaf =
+          EntryAt(frame.view.GetRoot(), frame.slot, page_version, location_);
+    }
+    string entry_key =
+        frame.pagekey.pid + EntryNibbles(root_is_leaf, is_leaf, frame.slot);
+    if (is_leaf) {
+      key_ = move(entry_key);
+      return true;
+    }
+
+    // the sibling page the scan enters after this one
+    Frame sibling = frame;
+    Step(sibling, forward);
+    if (sibling.slot >= 0 && sibling.slot < kEntrySlots) {
+      uint64_t sibling_version = 0;
+      tuple<uint64_t, uint64_t, uint64_t> sibling_location;
+      bool sibling_is_leaf =
+          sibling.page != nullptr
+              ? EntryAt(sibling.page->GetRoot(), sibling.slot,
+                        sibling_version, sibling_location)
+              : EntryAt(sibling.view.GetRoot(), sibling.slot,
+                        sibling_version, sibling_location);
+      if (!sibling_is_leaf) {
+        Prefetch({sibling_version, 0, false,
+                  sibling.pagekey.pid +
+                      EntryNibbles(false, false, sibling.slot)});
+      }
+    }
+
+    if (!PushPage({page_version, 0, false, entry_key})) {
+      Step(stack_.back(), forward);
+      continue;
+    }
+    Frame &child = stack_.back();
+    if (child.page != nullptr) {
+      child.slot = forward ? NextEntry(child.page->GetRoot(), 0)
+                           : PrevEntry(child.page->GetRoot(), kEntrySlots - 1);
+    } else {
+      child.slot = forward ? NextEntry(child.view.GetRoot(), 0)
+                           : PrevEntry(child.view.GetRoot(), kEntrySlots - 1);
+    }
+  }
+  return false;
+}
+
+void DMMTrieIterator::Prefetch(const PageKey &pagekey) {
+  {
+    lock_guard<mutex> lock(prefetch_mutex_);
+    if (prefetch_queue_.size() >= kPrefetchQueueSize) {
+      prefetch_queue_.pop_front();  // the scan has moved past it
+    }
+    prefetch_queue_.push_back(pagekey);
+  }
+  if (!prefetch_thread_.joinable()) {
+    prefetch_thread_ = thread([this]() { PrefetchLoop(); });
+  }
+  prefetch_cv_.notify_one();
+}
+
+void DMMTrieIterator::PrefetchLoop() {
+  unique_lock<mutex> lock(prefetch_mutex_);
+  while (true) {
+    prefetch_cv_.wait(lock, [this]() {
+      return stop_prefetch_ || !prefetch_queue_.empty();
+    });
+    if (stop_prefetch_) {
+      return;
+    }
+    PageKey pagekey = prefetch_queue_.front();
+    prefetch_queue_.pop_front();
+    lock.unlock();
+    trie_->ReadPage(pagekey);  // the page is kept by the page cache
+    lock.lock();
+  }
+}
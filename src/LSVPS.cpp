@@ -4,6 +4,7 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <stack>
 
 #include "common.hpp"
@@ -31,8 +32,8 @@ const std::vector<IndexBlock::Mapping> &IndexBlock::GetMappings() const {
 
 bool IndexBlock::SerializeTo(std::ofstream &out) const {
   try {
-    // Save the starting position of this LookupBlock
-    std::streampos startPos = out.tellp();
+    // the block is built in memory and ends with its checksum
+    std::ostringstream block;
     // 写入 mappings 数量
     uint32_t count = static_cast<uint32_t>(mappings_.size());
 #ifdef DEBUG
@@ -44,40 +45,36 @@ bool IndexBlock::SerializeTo(std::ofstream &out) const {
       return false;
     }
 
-    out.write(reinterpret_cast<const char *>(&count), sizeof(count));
-    if (!out.good()) {
+    block.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    if (!block.good()) {
       std::cerr << "Error writing count" << std::endl;
       return false;
     }
 
     // 写入每个 mapping
     for (const auto &mapping : mappings_) {
-      if (!mapping.pagekey.SerializeTo(out)) {
+      if (!mapping.pagekey.SerializeTo(block)) {
         std::cerr << "Error serializing pagekey" << std::endl;
         return false;
       }
-      out.write(reinterpret_cast<const char *>(&mapping.location),
-                sizeof(mapping.location));
-      if (!out.good()) {
+      block.write(reinterpret_cast<const char *>(&mapping.location),
+                  sizeof(mapping.location));
+      if (!block.good()) {
         std::cerr << "Error writing location" << std::endl;
         return false;
       }
     }
 
-    std::streampos currentPos = out.tellp();
-    if (currentPos == std::streampos(-1)) return false;
-
-    size_t blockPos = static_cast<size_t>(currentPos - startPos);
-
-    if (blockPos > INDEXBLOCK_SIZE) {
+    std::string data = block.str();
+    if (data.size() > INDEXBLOCK_SIZE - sizeof(uint32_t)) {
       std::cerr << "Error: written_size exceeds INDEXBLOCK_SIZE" << std::endl;
       return false;
     }
 
-    // 写入填充
-    char padding[INDEXBLOCK_SIZE] = {0};
-    size_t padding_size = INDEXBLOCK_SIZE - blockPos;
-    out.write(padding, padding_size);
+    // 写入填充和校验和
+    data.resize(INDEXBLOCK_SIZE, '\0');
+    SealChecksum(&data[0], INDEXBLOCK_SIZE);
+    out.write(data.data(), INDEXBLOCK_SIZE);
 
     return out.good();
   } catch (const std::exception &e) {
@@ -86,16 +83,27 @@ bool IndexBlock::SerializeTo(std::ofstream &out) const {
   }
 }
 
-bool IndexBlock::Deserialize(std::ifstream &in) {
+bool IndexBlock::Deserialize(std::istream &in, bool verify) {
   try {
+    std::string data(INDEXBLOCK_SIZE, '\0');
+    in.read(&data[0], INDEXBLOCK_SIZE);
+    if (!in.good()) {
+      std::cerr << "Error reading IndexBlock" << std::endl;
+      return false;
+    }
+    if (verify && !ChecksumMatches(data.data(), INDEXBLOCK_SIZE)) {
+      std::cerr << "Error: checksum mismatch in IndexBlock" << std::endl;
+      return false;
+    }
+    std::istringstream block(data);
+
     // 读取 mappings 数量
-    std::streampos startPos = in.tellg();
     uint32_t count = 0;
-    in.read(reinterpret_cast<char *>(&count), sizeof(count));
+    block.read(reinterpret_cast<char *>(&count), sizeof(count));
 #ifdef DEBUG
     std::cout << "Deserializing IndexBlock with count: " << count << std::endl;
 #endif
-    if (!in.good()) {
+    if (!block.good()) {
       std::cerr << "Error reading count" << std::endl;
       return false;
     }
@@ -111,15 +119,15 @@ bool IndexBlock::Deserialize(std::ifstream &in) {
 
     for (uint32_t i = 0; i < count; ++i) {
       Mapping mapping;
-      if (!mapping.pagekey.Deserialize(in)) {
+      if (!mapping.pagekey.Deserialize(block)) {
         std::cerr << "Error deserializing pagekey at index " << i << std::endl;
         return false;
       }
 
-      in.read(reinterpret_cast<char *>(&mapping.location),
-              sizeof(mapping.location));
+      block.read(reinterpret_cast<char *>(&mapping.location),
+                 sizeof(mapping.location));
 
-      if (!in.good()) {
+      if (!block.good()) {
         std::cerr << "Error reading location at index " << i << std::endl;
         return false;
       }
@@ -127,19 +135,14 @@ bool IndexBlock::Deserialize(std::ifstream &in) {
       mappings_.push_back(mapping);
     }
 
-    // 验证和跳过填充
-    std::streampos currentPos = in.tellg();
-    if (currentPos == std::streampos(-1)) return false;
-
-    size_t blockPos = static_cast<size_t>(currentPos - startPos);
-    if (blockPos > INDEXBLOCK_SIZE) {
+    // the mappings must end before the checksum
+    std::streampos currentPos = block.tellg();
+    if (currentPos == std::streampos(-1) ||
+        static_cast<size_t>(currentPos) > INDEXBLOCK_SIZE - sizeof(uint32_t)) {
       std::cerr << "Error: read_size exceeds INDEXBLOCK_SIZE" << std::endl;
       return false;
     }
-
-    size_t remaining = INDEXBLOCK_SIZE - blockPos;
-    in.seekg(remaining, std::ios::cur);
-    return in.good();
+    return true;
   } catch (const std::exception &e) {
     std::cerr << "Exception in Deserialize: " << e.what() << std::endl;
     return false;
@@ -148,10 +151,14 @@ bool IndexBlock::Deserialize(std::ifstream &in) {
 
 bool LookupBlock::SerializeTo(std::ostream &out) const {
   try {
-    // Save the starting position of this LookupBlock
-    std::streampos startPos = out.tellp();
-
     if (!out.good()) return false;
+    // the block is built in memory and ends with its checksum
+    std::ostringstream block;
+    block.write(reinterpret_cast<const char *>(&LSVPS_FORMAT_MAGIC),
+                sizeof(LSVPS_FORMAT_MAGIC));
+    block.write(reinterpret_cast<const char *>(&LSVPS_FORMAT_VERSION),
+                sizeof(LSVPS_FORMAT_VERSION));
+    block.write(reinterpret_cast<const char *>(&hash_id), sizeof(hash_id));
 
     // 1. 写入 entries 数量
     if (entries.size() > std::numeric_limits<uint32_t>::max()) {
@@ -159,42 +166,36 @@ bool LookupBlock::SerializeTo(std::ostream &out) const {
       return false;
     }
     uint32_t entriesSize = static_cast<uint32_t>(entries.size());
-    out.write(reinterpret_cast<const char *>(&entriesSize),
-              sizeof(entriesSize));
-    if (!out.good()) {
+    block.write(reinterpret_cast<const char *>(&entriesSize),
+                sizeof(entriesSize));
+    if (!block.good()) {
       std::cerr << "Error: fail to write entriesSize" << std::endl;
       return false;
     }
 
     // 2. 写入所有 entries
     for (const auto &entry : entries) {
-      if (!entry.first.SerializeTo(out)) {
+      if (!entry.first.SerializeTo(block)) {
         std::cerr << "Error: fail to write entry page key" << std::endl;
         return false;
       }
-      out.write(reinterpret_cast<const char *>(&entry.second), sizeof(size_t));
-      if (!out.good()) {
+      block.write(reinterpret_cast<const char *>(&entry.second),
+                  sizeof(size_t));
+      if (!block.good()) {
         std::cerr << "Error: fail to write entry location" << std::endl;
         return false;
       }
     }
 
-    // 3. Calculate position within the LookupBlock
-    std::streampos currentPos = out.tellp();
-    if (currentPos == std::streampos(-1)) {
-      std::cerr << "Error: fail to get current position" << std::endl;
-      return false;
-    }
-
-    size_t blockPos = static_cast<size_t>(currentPos - startPos);
-    if (blockPos > BLOCK_SIZE) {
+    // 3. 填充到块大小，最后4字节写入校验和
+    std::string data = block.str();
+    if (data.size() > BLOCK_SIZE - sizeof(uint32_t)) {
       std::cerr << "Error: read_size exceeds BLOCK_SIZE" << std::endl;
       return false;
     }
-
-    size_t padding_size = BLOCK_SIZE - blockPos;
-    std::vector<char> padding(padding_size, 0);
-    out.write(padding.data(), padding_size);
+    data.resize(BLOCK_SIZE, '\0');
+    SealChecksum(&data[0], BLOCK_SIZE);
+    out.write(data.data(), BLOCK_SIZE);
 
     return out.good();
   } catch (const std::exception &) {
@@ -203,19 +204,42 @@ bool LookupBlock::SerializeTo(std::ostream &out) const {
   }
 }
 
-bool LookupBlock::Deserialize(std::istream &in) {
+bool LookupBlock::Deserialize(std::istream &in, bool verify) {
   try {
-    //  Save the starting position of this LookupBlock
-    std::streampos startPos = in.tellg();
     if (!in.good()) return false;
+    std::string data(BLOCK_SIZE, '\0');
+    in.read(&data[0], BLOCK_SIZE);
+    if (!in.good()) return false;
+    // the format is checked first, older blocks have no checksum either
+    uint64_t magic;
+    uint32_t format_version;
+    memcpy(&magic, data.data(), sizeof(magic));
+    memcpy(&format_version, data.data() + sizeof(magic),
+           sizeof(format_version));
+    format_supported =
+        magic == LSVPS_FORMAT_MAGIC && format_version == LSVPS_FORMAT_VERSION;
+    if (!format_supported) {
+      return false;
+    }
+    memcpy(&hash_id, data.data() + sizeof(magic) + sizeof(format_version),
+           sizeof(hash_id));
+    if (hash_id != TrieHash::kId) {
+      return false;
+    }
+    if (verify && !ChecksumMatches(data.data(), BLOCK_SIZE)) {
+      std::cerr << "Error: checksum mismatch in LookupBlock" << std::endl;
+      return false;
+    }
+    std::istringstream block(data);
+    block.seekg(sizeof(magic) + sizeof(format_version) + sizeof(hash_id));
     // 清空现有条目
     entries.clear();
 
     // 读取条目数量
     uint32_t entriesSize;
-    in.read(reinterpret_cast<char *>(&entriesSize), sizeof(entriesSize));
+    block.read(reinterpret_cast<char *>(&entriesSize), sizeof(entriesSize));
 
-    if (!in.good() || entriesSize > 10000) {  // 使用更保守的限制
+    if (!block.good() || entriesSize > 10000) {  // 使用更保守的限制
       return false;
     }
 
@@ -227,25 +251,18 @@ bool LookupBlock::Deserialize(std::istream &in) {
       PageKey key;
       size_t location;
 
-      if (!key.Deserialize(in)) return false;
+      if (!key.Deserialize(block)) return false;
 
-      in.read(reinterpret_cast<char *>(&location), sizeof(location));
-      if (!in.good()) return false;
+      block.read(reinterpret_cast<char *>(&location), sizeof(location));
+      if (!block.good()) return false;
 
       entries.emplace_back(std::move(key), location);
     }
 
-    // 3. Calculate position within the LookupBlock and skip padding
-    std::streampos currentPos = in.tellg();
-    if (currentPos == std::streampos(-1)) return false;
-
-    size_t blockPos = static_cast<size_t>(currentPos - startPos);
-    if (blockPos > BLOCK_SIZE) return false;
-
-    size_t remaining = BLOCK_SIZE - blockPos;
-    in.seekg(remaining, std::ios::cur);
-
-    return in.good();
+    // 3. the entries must end before the checksum
+    std::streampos currentPos = block.tellg();
+    return currentPos != std::streampos(-1) &&
+           static_cast<size_t>(currentPos) <= BLOCK_SIZE - sizeof(uint32_t);
   } catch (const std::exception &) {
     return false;
   }
@@ -257,9 +274,110 @@ Page *LSVPS::PageQuery(uint64_t version) {
 /*新增逻辑：先判断该版本与latestbasepageversion的关系保证这个在unprecise的查找中一定可以找到大于他的page，
 如果该版本大于latestbasepage，basepage可以直接取latestbasepage否则就进行pagelookup
 可以保证找到pagekey大于他的（起码有latestbasepage）*/
-BasePage *LSVPS::LoadPage(const PageKey &pagekey) {
+std::shared_ptr<BasePage> LSVPS::LoadPage(const PageKey &pagekey) {
+  return LoadPage(pagekey, nullptr);
+}
+
+std::shared_ptr<BasePage> LSVPS::LoadPage(const PageKey &pagekey,
+                                          char *view_buffer) {
+  // the active deltapage must stay in the pool while it is replayed, even if
+  // other readers load pages meanwhile
+  PinActiveDeltaPage(pagekey.pid);
+  try {
+    std::shared_ptr<BasePage> basepage = loadPage(pagekey, view_buffer);
+    UnpinActiveDeltaPage(pagekey.pid);
+    return basepage;
+  } catch (...) {
+    UnpinActiveDeltaPage(pagekey.pid);
+    throw;
+  }
+}
+
+std::shared_ptr<BasePage> LSVPS::loadPage(const PageKey &pagekey,
+                                          char *view_buffer) {
   std::stack<const DeltaPage *> delta_pages;
-  BasePage *basepage;
+  std::vector<std::shared_ptr<Page>> chain_pages;
+  std::shared_ptr<BasePage> basepage;
+  PageKey current_pagekey =
+      resolvePageChain(pagekey, delta_pages, chain_pages);
+  bool replay = current_pagekey.version != 0 &&
+                hasDeltaToReplay(pagekey, current_pagekey, delta_pages);
+  if (view_buffer != nullptr && current_pagekey.version != 0 && !replay &&
+      findPageInMemory(current_pagekey) == nullptr) {
+    // the basepage on disk is the page itself, hand out its bytes
+    auto file_iterator = findIndexFile(current_pagekey);
+    PageKey true_pagekey;
+    if (file_iterator != index_files_.end() &&
+        readPageData(file_iterator, current_pagekey, view_buffer,
+                     true_pagekey)) {
+      return nullptr;
+    }
+  }
+  if (current_pagekey.version == 0)
+    basepage = std::make_shared<BasePage>(trie_, nullptr, pagekey.pid);
+  else {
+    std::shared_ptr<Page> page = findPageInMemory(current_pagekey);
+    if (page != nullptr) {
+      // pages in memory are shared, they are copied only if deltas change them
+      basepage = std::dynamic_pointer_cast<BasePage>(page);
+      if (basepage != nullptr && !replay) {
+        return basepage;
+      }
+      if (basepage != nullptr) {
+        basepage = std::make_shared<BasePage>(*basepage);
+      }
+    } else {
+      // a page read from disk is private, replay on it directly
+      basepage =
+          std::dynamic_pointer_cast<BasePage>(readPageFromDisk(current_pagekey));
+    }
+    if (basepage == nullptr) {
+      std::cerr << "Error: BasePage not found for PageKey: " << current_pagekey
+                << std::endl;
+      throw std::runtime_error("BasePage not found for the given PageKey");
+    }
+  }
+  while (!delta_pages.empty()) {
+    applyDelta(basepage.get(), delta_pages.top(), pagekey);
+    delta_pages.pop();
+  }
+  /* if (basepage->GetPageKey().version < pagekey.version) {
+    // TODO: 拿到的版本比要的版本小 不是有可能最新版本就是比这个版本小吗？
+    std::cerr << "Error: Requested version " << pagekey.version
+              << " not found. Latest available version is "
+              << basepage->GetPageKey().version << std::endl;
+    return nullptr;  // the version is not found
+  } */
+  return basepage;
+}
+
+bool LSVPS::hasDeltaToReplay(
+    const PageKey &pagekey, const PageKey &base_pagekey,
+    std::stack<const DeltaPage *> delta_pages) const {
+  // the basepage already contains the updates up to its version, only later
+  // deltas visible at the requested version change it
+  while (!delta_pages.empty()) {
+    for (const auto &item : delta_pages.top()->GetDeltaItems()) {
+      if (item.version > pagekey.version) break;
+      if (item.version > base_pagekey.version) return true;
+    }
+    delta_pages.pop();
+  }
+  return false;
+}
+
+PageKey LSVPS::resolvePageChain(
+    const PageKey &pagekey, std::stack<const DeltaPage *> &delta_pages,
+    std::vector<std::shared_ptr<Page>> &chain_pages) {
+  // deltapages of the chain are kept alive by chain_pages until the caller
+  // has replayed them, even if the buffer is flushed meanwhile
+  auto lookup = [&](const PageKey &key) -> const DeltaPage * {
+    std::shared_ptr<Page> page = pageLookup(key);
+    if (page == nullptr) return nullptr;
+    chain_pages.push_back(page);
+    return dynamic_cast<const DeltaPage *>(page.get());
+  };
+
   PageKey current_pagekey;
   auto delta_pagekey = pagekey;
   delta_pagekey.type = true;  // set to delta
@@ -274,9 +392,7 @@ BasePage *LSVPS::LoadPage(const PageKey &pagekey) {
     uint64_t replay_version =
         trie_->GetVersionUpperbound(pagekey.pid, pagekey.version);
     delta_pagekey.version = replay_version;
-    // WARNING: 这个page有可能被flush所释放掉。
-    DeltaPage *replay_sentinel =
-        dynamic_cast<DeltaPage *>(pageLookup(delta_pagekey));
+    const DeltaPage *replay_sentinel = lookup(delta_pagekey);
     if (replay_sentinel != nullptr) {
       delta_pages.push(replay_sentinel);
       current_pagekey = replay_sentinel->GetLastPageKey();
@@ -285,9 +401,7 @@ BasePage *LSVPS::LoadPage(const PageKey &pagekey) {
     }
   }
   while (current_pagekey.type) {
-    // WARNING: 这个page有可能被flush所释放掉。
-    DeltaPage *delta_page = dynamic_cast<DeltaPage *>(
-        pageLookup(current_pagekey));  // precisely search
+    const DeltaPage *delta_page = lookup(current_pagekey);  // precisely search
     if (delta_page) {
       delta_pages.push(delta_page);
       current_pagekey = delta_page->GetLastPageKey();
@@ -295,44 +409,11 @@ BasePage *LSVPS::LoadPage(const PageKey &pagekey) {
       break;
     }
   }
-  if (current_pagekey.version == 0)
-    basepage = new BasePage(trie_, nullptr, pagekey.pid);
-  else {
-    // WARNING: 这个page有可能被flush所释放掉。
-    basepage = dynamic_cast<BasePage *>(pageLookup(current_pagekey));
-    // TODO: leak here, basepage is not deleted but overwritten by new
-    if (basepage == nullptr) {
-      std::cerr << "Error: BasePage not found for PageKey: " << current_pagekey
-                << std::endl;
-      throw std::runtime_error("BasePage not found for the given PageKey");
-    }
-    basepage = new BasePage(*basepage);  // deep copy
-  }
-  while (!delta_pages.empty()) {
-    applyDelta(basepage, delta_pages.top(), pagekey);
-    delta_pages.pop();
-    // TODO: leak here, the poped deltapage is not freed
-  }
-  /* if (basepage->GetPageKey().version < pagekey.version) {
-    // TODO: 拿到的版本比要的版本小 不是有可能最新版本就是比这个版本小吗？
-    std::cerr << "Error: Requested version " << pagekey.version
-              << " not found. Latest available version is "
-              << basepage->GetPageKey().version << std::endl;
-    return nullptr;  // the version is not found
-  } */
-  return basepage;
+  return current_pagekey;
 }
 
-void LSVPS::StorePage(Page *page) {
-  // Create a deep copy of the page
-  Page *page_copy;
-  if (page->GetPageKey().type) {
-    page_copy = new DeltaPage(*dynamic_cast<DeltaPage *>(page));
-  } else {
-    page_copy = new BasePage(*dynamic_cast<BasePage *>(page));
-  }
-
-  table_.Store(page_copy);
+void LSVPS::StorePage(std::shared_ptr<Page> page) {
+  table_.Store(std::move(page));
   if (table_.IsFull()) {
     table_.Flush();
   }
@@ -340,13 +421,14 @@ void LSVPS::StorePage(Page *page) {
 
 void LSVPS::Flush() {
   table_.Flush();
+  std::lock_guard<std::mutex> lock(delta_cache_mutex_);
   active_delta_page_cache_.FlushToDisk();
 }
 void LSVPS::AddIndexFile(const IndexFile &index_file) {
   index_files_.push_back(index_file);
 }
 
-const std::vector<Page *> &LSVPS::GetTable() const {
+const std::vector<std::shared_ptr<Page>> &LSVPS::GetTable() const {
   return table_.GetBuffer();
 }
 
@@ -354,35 +436,60 @@ int LSVPS::GetNumOfIndexFile() { return index_files_.size(); }
 
 void LSVPS::RegisterTrie(DMMTrie *DMM_trie) { trie_ = DMM_trie; }
 
-Page *LSVPS::pageLookup(const PageKey &pagekey) {
+void LSVPS::SetChecksumVerify(ChecksumVerify mode, uint32_t sample_rate) {
+  checksum_policy_.Set(mode, sample_rate);
+}
+
+std::shared_ptr<Page> LSVPS::pageLookup(const PageKey &pagekey) {
+  std::shared_ptr<Page> page = findPageInMemory(pagekey);
+  if (page != nullptr) return page;
+  // second step:search in the disk
+  return readPageFromDisk(pagekey);
+}
+
+std::shared_ptr<Page> LSVPS::findPageInMemory(const PageKey &pagekey) {
   auto &buffer = table_.GetBuffer();
-  Page *smallest_page;
   // first step: search in the buffer
   if (pagekey.version == 0) return nullptr;
   //
   for (const auto &page : buffer) {
     if (page->GetPageKey() == pagekey) return page;
   }
-  // assumption: one block size <= cfr deltapage size
+  // pages frozen by the ongoing commit are handed over only when it finishes,
+  // but they are needed if the trie evicts and reloads a page meanwhile
+  if (pending_pages_ != nullptr) {
+    std::lock_guard<std::mutex> lock(*pending_pages_mutex_);
+    auto it = pending_pages_->find(pagekey);
+    if (it != pending_pages_->end()) return it->second;
+  }
+  return nullptr;
+}
 
-  auto file_iterator = std::find_if(index_files_.begin(), index_files_.end(),
-                                    [&pagekey](const IndexFile &file) {
-                                      return file.min_pagekey <= pagekey &&
-                                             pagekey <= file.max_pagekey;
-                                    });
+std::shared_ptr<Page> LSVPS::readPageFromDisk(const PageKey &pagekey) {
+  if (pagekey.version == 0) return nullptr;
+  // assumption: one block size <= cfr deltapage size
+  auto file_iterator = findIndexFile(pagekey);
   if (file_iterator == index_files_.end()) {
     std::cerr << "Error: Page not found in index file for PageKey: " << pagekey
               << std::endl;
     return nullptr;
     // there is no indexfile of the demanding version
   }
-  // second step:search in the disk
   return readPageFromIndexFile(file_iterator, pagekey);
 }
 
-Page *LSVPS::readPageFromIndexFile(
-    std::vector<IndexFile>::const_iterator file_it, const PageKey &pagekey) {
-  PageKey true_pagekey;
+std::vector<IndexFile>::const_iterator LSVPS::findIndexFile(
+    const PageKey &pagekey) const {
+  return std::find_if(index_files_.begin(), index_files_.end(),
+                      [&pagekey](const IndexFile &file) {
+                        return file.min_pagekey <= pagekey &&
+                               pagekey <= file.max_pagekey;
+                      });
+}
+
+bool LSVPS::readPageData(std::vector<IndexFile>::const_iterator file_it,
+                         const PageKey &pagekey, char *data,
+                         PageKey &true_pagekey) {
   std::ifstream in_file(file_it->filepath, std::ios::binary);
   if (!in_file) {
     throw std::runtime_error("Failed to open index file: " + file_it->filepath);
@@ -394,14 +501,28 @@ Page *LSVPS::readPageFromIndexFile(
     throw std::runtime_error("Failed to seek to LookupBlock");
   }
 
+  // the checksums of the blocks and the page are checked or not together
+  bool verify = checksum_policy_.ShouldVerify();
   LookupBlock lookup_block;
-  if (!lookup_block.Deserialize(in_file)) {
+  if (!lookup_block.Deserialize(in_file, verify)) {
+    if (!lookup_block.format_supported) {
+      throw std::runtime_error("Index file " + file_it->filepath +
+                               " has no LSVPS format " +
+                               std::to_string(LSVPS_FORMAT_VERSION) +
+                               " header, it was written by an older version");
+    }
+    if (lookup_block.hash_id != TrieHash::kId) {
+      throw std::runtime_error("Index file " + file_it->filepath +
+                               " was written with " +
+                               HashName(lookup_block.hash_id) +
+                               ", this build uses " + HashName(TrieHash::kId));
+    }
     throw std::runtime_error("Failed to deserialize LookupBlock");
   }
 
   // 验证lookup_block中的entries
   if (lookup_block.entries.empty()) {
-    return nullptr;
+    return false;
   }
 #ifdef DEBUG
   std::cout << "Searching for pagekey: " << pagekey << std::endl;
@@ -421,7 +542,7 @@ Page *LSVPS::readPageFromIndexFile(
     --it;  // 回退到前一个元素
   } else {
     // 没有找到合适的元素
-    return nullptr;
+    return false;
   }
 
   in_file.seekg(it->second);
@@ -430,14 +551,14 @@ Page *LSVPS::readPageFromIndexFile(
   }
 
   IndexBlock index_block;
-  if (!index_block.Deserialize(in_file)) {
+  if (!index_block.Deserialize(in_file, verify)) {
     throw std::runtime_error("Failed to deserialize IndexBlock");
   }
 
   // 验证index_block中的映射
   const auto &mappings = index_block.GetMappings();
   if (mappings.empty()) {
-    return nullptr;
+    return false;
   }
 
   auto mapping = mappings.begin();
@@ -447,7 +568,7 @@ Page *LSVPS::readPageFromIndexFile(
                    [&pagekey](const auto &m) { return m.pagekey == pagekey; });
 
   if (mapping == mappings.end()) {  // basepage没找到
-    return nullptr;
+    return false;
   }
 
   true_pagekey = mapping->pagekey;
@@ -456,24 +577,33 @@ Page *LSVPS::readPageFromIndexFile(
     throw std::runtime_error("Failed to seek to page data");
   }
 
-  Page temp_page;
-  if (!temp_page.Deserialize(in_file)) {
+  in_file.read(data, PAGE_SIZE);
+  if (!in_file.good()) {
     throw std::runtime_error("Failed to deserialize page data");
   }
+  if (verify && !ChecksumMatches(data, PAGE_SIZE)) {
+    throw std::runtime_error("Checksum mismatch in page " + pagekey.pid +
+                             " of index file " + file_it->filepath);
+  }
+  return true;
+}
 
-  // 验证数据完整性
+std::shared_ptr<Page> LSVPS::readPageFromIndexFile(
+    std::vector<IndexFile>::const_iterator file_it, const PageKey &pagekey) {
+  PageKey true_pagekey;
+  Page temp_page;
   char *data = temp_page.GetData();
-  if (!data) {
-    throw std::runtime_error("Invalid page data after deserialization");
+  if (!readPageData(file_it, pagekey, data, true_pagekey)) {
+    return nullptr;
   }
 
   // 根据 pagekey.type 创建正确的页面类型
-  Page *page = nullptr;
+  std::shared_ptr<Page> page;
   try {
     if (!pagekey.type) {
-      page = new BasePage(trie_, data);
+      page = std::make_shared<BasePage>(trie_, data);
     } else {
-      page = new DeltaPage(data);
+      page = std::make_shared<DeltaPage>(data);
     }
   } catch (const std::exception &e) {
     throw std::runtime_error(std::string("Failed to create page: ") + e.what());
@@ -494,15 +624,16 @@ void LSVPS::applyDelta(BasePage *basepage, const DeltaPage *deltapage,
 // MemIndexTable实现
 LSVPS::MemIndexTable::MemIndexTable(LSVPS &parent) : parent_LSVPS_(parent) {}
 
-const std::vector<Page *> &LSVPS::MemIndexTable::GetBuffer() const {
+const std::vector<std::shared_ptr<Page>> &LSVPS::MemIndexTable::GetBuffer()
+    const {
   return buffer_;
 }
 
-void LSVPS::MemIndexTable::Store(Page *page) {
+void LSVPS::MemIndexTable::Store(std::shared_ptr<Page> page) {
   // if (page->GetPageKey() == PageKey{426, 0, false, "02"}) {
   //   std::cout << "Hele" << std::endl;
   // }
-  buffer_.push_back(page);
+  buffer_.push_back(std::move(page));
 }
 
 bool LSVPS::MemIndexTable::IsFull() const {
@@ -553,9 +684,7 @@ void LSVPS::MemIndexTable::Flush() {
   parent_LSVPS_.AddIndexFile(
       {buffer_.front()->GetPageKey(), buffer_.back()->GetPageKey(), filepath});
 
-  for (auto page : buffer_) {
-    delete page;
-  }
+  // pages still shared with the trie stay alive until it drops them
   buffer_.clear();
 }
 
@@ -575,11 +704,12 @@ void LSVPS::MemIndexTable::writeToStorage(
         throw std::runtime_error("Invalid page data encountered");
       }
       page->SerializeTo();
+      SealChecksum(page->GetData(), PAGE_SIZE);
       outFile.write(reinterpret_cast<const char *>(page->GetData()), PAGE_SIZE);
       if (!outFile.good()) {
         throw std::runtime_error("Failed to write page data");
       }
-      // page->ReleaseData();
+      page->ReleaseData();  // the page may outlive the buffer
     }
 
     // 写入索引块
@@ -605,16 +735,19 @@ void LSVPS::MemIndexTable::writeToStorage(
   outFile.close();
 }
 
-LSVPS::ActiveDeltaPageCache::ActiveDeltaPageCache(size_t max_size,
-                                                  std::string cache_dir)
-    : max_size_(max_size), cache_dir_(std::move(cache_dir)) {
+LSVPS::ActiveDeltaPageCache::ActiveDeltaPageCache(
+    size_t max_size, std::string cache_dir, ChecksumPolicy &checksum_policy)
+    : max_size_(max_size),
+      cache_dir_(std::move(cache_dir)),
+      checksum_policy_(checksum_policy) {
   // 确保缓存目录存在
   std::filesystem::create_directories(cache_dir_);
   cache_file_ =
       (std::filesystem::path(cache_dir_) / "delta_cache.dat").string();
 
   // 如果文件存在，读取索引块
-  if (std::filesystem::exists(cache_file_)) {
+  if (std::filesystem::exists(cache_file_) &&
+      std::filesystem::file_size(cache_file_) > 0) {
     readIndexBlock();
   } else {  // 如果文件不存在，创建一个新的文件
     std::ofstream out(cache_file_, std::ios::binary | std::ios::out);
@@ -679,15 +812,11 @@ DeltaPage *LSVPS::ActiveDeltaPageCache::Get(const string &pid) {
 
 void LSVPS::ActiveDeltaPageCache::prepareForBatchWrite(const string &pid,
                                                        DeltaPage *page) {
-  // 计算并记录页面偏移量，为批量写入做准备
-  size_t offset = 0;
-  if (!pid_to_offset_.empty()) {
-    // 找到最大的offset
-    for (const auto &[_, existing_offset] : pid_to_offset_) {
-      offset = std::max(offset, existing_offset + PAGE_SIZE);
-    }
+  // 计算并记录页面偏移量，为批量写入做准备，新页面接在已有页面之后
+  if (pid_to_offset_.find(pid) == pid_to_offset_.end()) {
+    pid_to_offset_[pid] = pages_end_;
+    pages_end_ += PAGE_SIZE;
   }
-  pid_to_offset_[pid] = offset;
 }
 
 void LSVPS::ActiveDeltaPageCache::writePageToDisk(const string &pid,
@@ -706,9 +835,10 @@ void LSVPS::ActiveDeltaPageCache::writePageToDisk(const string &pid,
     if (it != pid_to_offset_.end()) {
       offset = it->second;
       out.seekp(offset, ios::beg);
-    } else {
-      out.seekp(0, ios::end);
-      offset = out.tellp();
+    } else {  // over the index block, which is written again at the flush
+      offset = pages_end_;
+      pages_end_ += PAGE_SIZE;
+      out.seekp(offset, ios::beg);
       pid_to_offset_.insert(std::make_pair(pid, offset));
     }
 
@@ -717,6 +847,7 @@ void LSVPS::ActiveDeltaPageCache::writePageToDisk(const string &pid,
       throw std::runtime_error("Invalid page data encountered");
     }
     page->SerializeTo();  // TODO: no serialize before write
+    SealChecksum(page->GetData(), PAGE_SIZE);
     out.write(reinterpret_cast<const char *>(page->GetData()), PAGE_SIZE);
     if (!out.good()) {
       throw std::runtime_error("Failed to write page data");
@@ -737,6 +868,12 @@ void LSVPS::ActiveDeltaPageCache::evictIfNeeded() {
   while (cache_.size() >= max_size_) {
     // 直接使用begin()获取第一个元素，不需要额外的find操作
     auto it = cache_.begin();
+    while (it != cache_.end() && pinned_.count(it->first)) {
+      ++it;
+    }
+    if (it == cache_.end()) {
+      throw std::runtime_error("All active delta pages are pinned");
+    }
     string pid_to_evict = it->first;
     // 写入磁盘
     // writePageToDisk(pid_to_evict, &page_pool_[it->second]);
@@ -747,8 +884,21 @@ void LSVPS::ActiveDeltaPageCache::evictIfNeeded() {
   }
 }
 
+void LSVPS::ActiveDeltaPageCache::Pin(const string &pid) { ++pinned_[pid]; }
+
+void LSVPS::ActiveDeltaPageCache::Unpin(const string &pid) {
+  auto it = pinned_.find(pid);
+  if (it != pinned_.end() && --it->second == 0) {
+    pinned_.erase(it);
+  }
+}
+
+/* index block at the end of the delta cache file:
+   | pid_length (8) | pid | offset (8) | ... | checksum (4) | magic (8) |
+   format version (4) | hash id (4) | size (8) |
+   size only counts the entries */
 void LSVPS::ActiveDeltaPageCache::writeIndexBlock() {
-  // 先计算索引块的大小（不包括最后的size_t）
+  // 先计算索引块的大小（不包括最后的校验和与size_t）
   size_t index_block_size = 0;
   std::vector<std::pair<std::string, size_t>> pid_offsets;
   pid_offsets.reserve(pid_to_offset_.size());
@@ -759,27 +909,8 @@ void LSVPS::ActiveDeltaPageCache::writeIndexBlock() {
     index_block_size += sizeof(size_t) + pid.length() + sizeof(size_t);
   }
 
-  // 如果文件不为空，需要先删除旧的索引块
-  if (std::filesystem::exists(cache_file_) &&
-      std::filesystem::file_size(cache_file_) > 0) {
-    // 读取旧的索引块大小
-    std::ifstream in(cache_file_, std::ios::binary);
-    if (!in) {
-      throw std::runtime_error(
-          "Failed to open file for reading old index block: " + cache_file_);
-    }
-
-    in.seekg(-static_cast<std::streamoff>(sizeof(size_t)), std::ios::end);
-    size_t old_index_block_size;
-    in.read(reinterpret_cast<char *>(&old_index_block_size),
-            sizeof(old_index_block_size));
-    in.close();
-
-    // 截断文件，删除旧的索引块
-    std::filesystem::resize_file(cache_file_,
-                                 std::filesystem::file_size(cache_file_) -
-                                     old_index_block_size - sizeof(size_t));
-  }
+  // 截断文件，删除页面之后旧的索引块
+  std::filesystem::resize_file(cache_file_, pages_end_);
 
   // 打开文件，写入新的索引块
   std::ofstream out(cache_file_, std::ios::binary | std::ios::app);
@@ -790,25 +921,33 @@ void LSVPS::ActiveDeltaPageCache::writeIndexBlock() {
 
   try {
     // 写入每个pid和offset
+    std::string block;
+    block.reserve(index_block_size);
     for (const auto &[pid, offset] : pid_offsets) {
       // 写入pid长度和pid
       size_t pid_length = pid.length();
-      out.write(reinterpret_cast<const char *>(&pid_length),
-                sizeof(pid_length));
-      out.write(pid.c_str(), pid_length);
+      block.append(reinterpret_cast<const char *>(&pid_length),
+                   sizeof(pid_length));
+      block.append(pid);
       // 写入offset
-      out.write(reinterpret_cast<const char *>(&offset), sizeof(offset));
+      block.append(reinterpret_cast<const char *>(&offset), sizeof(offset));
     }
-
-    // 在文件末尾写入索引块总大小
+    out.write(block.data(), block.size());
+
+    // 在文件末尾写入校验和、格式与索引块总大小
+    uint32_t checksum = Crc32c(block.data(), block.size());
+    out.write(reinterpret_cast<const char *>(&checksum), sizeof(checksum));
+    out.write(reinterpret_cast<const char *>(&LSVPS_FORMAT_MAGIC),
+              sizeof(LSVPS_FORMAT_MAGIC));
+    out.write(reinterpret_cast<const char *>(&LSVPS_FORMAT_VERSION),
+              sizeof(LSVPS_FORMAT_VERSION));
+    out.write(reinterpret_cast<const char *>(&TrieHash::kId),
+              sizeof(TrieHash::kId));
     out.write(reinterpret_cast<const char *>(&index_block_size),
               sizeof(index_block_size));
 
     out.flush();
     out.close();
-
-    // 清空pid_to_offset_
-    pid_to_offset_.clear();
   } catch (const std::exception &e) {
     out.close();
     throw;
@@ -823,29 +962,69 @@ void LSVPS::ActiveDeltaPageCache::readIndexBlock() {
   }
 
   try {
-    // 定位到文件末尾，读取索引块大小
-    in.seekg(-static_cast<std::streamoff>(sizeof(size_t)), std::ios::end);
-    size_t index_block_size;
-    in.read(reinterpret_cast<char *>(&index_block_size),
-            sizeof(index_block_size));
+    // 定位到文件末尾，读取格式与索引块大小
+    constexpr size_t kTrailerSize = sizeof(uint32_t) + sizeof(uint64_t) +
+                                    2 * sizeof(uint32_t) + sizeof(size_t);
+    size_t file_size = std::filesystem::file_size(cache_file_);
+    uint64_t magic = 0;
+    uint32_t format_version = 0;
+    uint32_t hash_id = 0;
+    size_t index_block_size = 0;
+    if (file_size >= kTrailerSize) {
+      in.seekg(file_size - kTrailerSize + sizeof(uint32_t), std::ios::beg);
+      in.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+      in.read(reinterpret_cast<char *>(&format_version),
+              sizeof(format_version));
+      in.read(reinterpret_cast<char *>(&hash_id), sizeof(hash_id));
+      in.read(reinterpret_cast<char *>(&index_block_size),
+              sizeof(index_block_size));
+    }
+    if (!in.good() || magic != LSVPS_FORMAT_MAGIC ||
+        format_version != LSVPS_FORMAT_VERSION) {
+      throw std::runtime_error(
+          "Delta cache " + cache_file_ + " has no LSVPS format " +
+          std::to_string(LSVPS_FORMAT_VERSION) +
+          " header, it was written by an older version");
+    }
+    if (hash_id != TrieHash::kId) {
+      throw std::runtime_error("Delta cache " + cache_file_ +
+                               " was written with " + HashName(hash_id) +
+                               ", this build uses " + HashName(TrieHash::kId));
+    }
+    if (index_block_size > file_size - kTrailerSize) {
+      throw std::runtime_error("Invalid index block in " + cache_file_);
+    }
 
-    // 定位到索引块开始位置
-    in.seekg(-static_cast<std::streamoff>(index_block_size + sizeof(size_t)),
-             std::ios::end);
+    // 定位到索引块开始位置，页面到此为止
+    pages_end_ = file_size - index_block_size - kTrailerSize;
+    in.seekg(pages_end_, std::ios::beg);
+
+    // the index block is only read when the file is opened, its checksum is
+    // always checked
+    std::string block(index_block_size, '\0');
+    uint32_t checksum;
+    in.read(&block[0], index_block_size);
+    in.read(reinterpret_cast<char *>(&checksum), sizeof(checksum));
+    if (!in.good() || checksum != Crc32c(block.data(), block.size())) {
+      throw std::runtime_error("Checksum mismatch in index block of " +
+                               cache_file_);
+    }
 
     // 读取每个pid和offset
     size_t current_size = 0;
-    while (current_size < index_block_size) {
+    while (current_size + 2 * sizeof(size_t) <= index_block_size) {
       size_t pid_length;
-      in.read(reinterpret_cast<char *>(&pid_length), sizeof(pid_length));
+      memcpy(&pid_length, block.data() + current_size, sizeof(pid_length));
       current_size += sizeof(size_t);
+      if (pid_length > index_block_size - current_size - sizeof(size_t)) {
+        throw std::runtime_error("Invalid index block in " + cache_file_);
+      }
 
-      std::string pid(pid_length, '\0');
-      in.read(&pid[0], pid_length);
+      std::string pid(block.data() + current_size, pid_length);
       current_size += pid_length;
 
       size_t offset;
-      in.read(reinterpret_cast<char *>(&offset), sizeof(offset));
+      memcpy(&offset, block.data() + current_size, sizeof(offset));
       current_size += sizeof(size_t);
 
       pid_to_offset_[pid] = offset;
@@ -888,6 +1067,7 @@ void LSVPS::ActiveDeltaPageCache::FlushToDisk() {
         throw std::runtime_error("Invalid page data encountered");
       }
       page_pool_[pool_pos].SerializeTo();
+      SealChecksum(page_pool_[pool_pos].GetData(), PAGE_SIZE);
       out.write(reinterpret_cast<const char *>(page_pool_[pool_pos].GetData()),
                 PAGE_SIZE);
       if (!out.good()) {
@@ -909,9 +1089,11 @@ void LSVPS::ActiveDeltaPageCache::FlushToDisk() {
 }
 
 void LSVPS::StoreActiveDeltaPage(DeltaPage *page) {
+  std::lock_guard<std::mutex> lock(delta_cache_mutex_);
   active_delta_page_cache_.Store(page);
 }
 DeltaPage *LSVPS::GetActiveDeltaPage(const string &pid) {
+  std::lock_guard<std::mutex> lock(delta_cache_mutex_);
   DeltaPage *page = active_delta_page_cache_.Get(pid);
   // if (page == nullptr) {
   //   page = new DeltaPage();
@@ -922,6 +1104,16 @@ DeltaPage *LSVPS::GetActiveDeltaPage(const string &pid) {
   return page;
 }
 
+void LSVPS::PinActiveDeltaPage(const string &pid) {
+  std::lock_guard<std::mutex> lock(delta_cache_mutex_);
+  active_delta_page_cache_.Pin(pid);
+}
+
+void LSVPS::UnpinActiveDeltaPage(const string &pid) {
+  std::lock_guard<std::mutex> lock(delta_cache_mutex_);
+  active_delta_page_cache_.Unpin(pid);
+}
+
 bool LSVPS::ActiveDeltaPageCache::readFromDisk(const string &pid,
                                                DeltaPage *page) {
   // 检查pid是否在索引中
@@ -954,6 +1146,10 @@ bool LSVPS::ActiveDeltaPageCache::readFromDisk(const string &pid,
     // TODO: close file, otherwise it will conflict with file writing in
     // evictIfNeeded
     in.close();
+    if (checksum_policy_.ShouldVerify() && !ChecksumMatches(data, PAGE_SIZE)) {
+      delete[] data;
+      throw std::runtime_error("Checksum mismatch in active deltapage " + pid);
+    }
 
     // 创建DeltaPage对象
     // DeltaPage *page = new DeltaPage(data);
@@ -3,7 +3,9 @@ extern "C" {
 }
 
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "DMMTrie.hpp"
 #include "LSVPS.hpp"
@@ -27,6 +29,12 @@ struct LetusProofPath {
   LetusProofNode* proof_nodes;
   uint64_t proof_size;
 };
+struct LetusIterator {
+  std::unique_ptr<DMMTrieIterator> it;
+};
+struct LetusScrubber {
+  std::unique_ptr<DMMTrieScrubber> scrubber;
+};
 
 struct Letus* OpenLetus(const char* path_c) {
   std::string path(path_c);
@@ -72,6 +80,20 @@ char* LetusGet(Letus* p, uint64_t tid, uint64_t version, const char* key_c) {
   return value_c;
 }
 
+char** LetusMultiGet(Letus* p, uint64_t tid, uint64_t version,
+                     const char** keys_c, uint64_t num_keys) {
+  std::vector<std::string> keys(keys_c, keys_c + num_keys);
+  std::vector<std::string> values = p->trie->MultiGet(tid, version, keys);
+  char** values_c = new char*[num_keys];
+  for (uint64_t i = 0; i < num_keys; i++) {
+    size_t value_size = values[i].size();
+    values_c[i] = new char[value_size + 1];
+    values[i].copy(values_c[i], value_size, 0);
+    values_c[i][value_size] = '\0';
+  }
+  return values_c;
+}
+
 bool LetusRevert(Letus* p, uint64_t tid, uint64_t version) {
   p->trie->Revert(tid, version);
   return true;
@@ -99,6 +121,134 @@ bool LetusFlush(Letus* p, uint64_t tid, uint64_t version) {
   return true;
 }
 
+void LetusSetCommitThreads(Letus* p, uint64_t num_threads) {
+  p->trie->SetCommitThreads(num_threads);
+}
+
+void LetusSetConcurrentReads(Letus* p, bool enable) {
+  p->trie->SetConcurrentReads(enable);
+}
+
+void LetusSetCacheBudget(Letus* p, uint64_t bytes) {
+  p->trie->SetCacheBudget(bytes);
+}
+
+void LetusGetCacheStats(Letus* p, uint64_t* hits, uint64_t* misses,
+                        uint64_t* evictions) {
+  PageCache::Stats stats = p->trie->GetCacheStats();
+  *hits = stats.hits;
+  *misses = stats.misses;
+  *evictions = stats.evictions;
+}
+
+void LetusSetDurability(Letus* p, int policy, uint64_t interval_ms) {
+  p->trie->SetDurability(static_cast<VDLS::DurabilityPolicy>(policy),
+                         interval_ms);
+}
+
+uint64_t LetusGetDurableVersion(Letus* p) {
+  return p->trie->GetDurableVersion();
+}
+
+void LetusSetValueDedup(Letus* p, uint64_t table_entries,
+                        uint64_t min_value_size) {
+  p->trie->SetValueDedup(table_entries, min_value_size);
+}
+
+uint64_t LetusCollectGarbage(Letus* p, uint64_t tid, uint64_t oldest_version,
+                             uint64_t rate_limit) {
+  p->trie->SetGcRateLimit(rate_limit);
+  return p->trie->CollectGarbage(tid, oldest_version);
+}
+
+bool LetusSetValueCompression(Letus* p, int codec, uint64_t block_size) {
+  return p->trie->SetValueCompression(static_cast<CompressionCodec>(codec),
+                                      block_size);
+}
+
+void LetusSetValueReadThreads(Letus* p, uint64_t num_threads) {
+  p->trie->SetValueReadThreads(num_threads);
+}
+
+void LetusSetValueInlineSize(Letus* p, uint64_t max_size) {
+  p->trie->SetValueInlineSize(max_size);
+}
+
+void LetusSetChecksumVerify(Letus* p, int mode, uint64_t sample_rate) {
+  p->trie->SetChecksumVerify(static_cast<ChecksumVerify>(mode), sample_rate);
+}
+
+LetusIterator* LetusNewIterator(Letus* p, uint64_t tid, uint64_t version,
+                                const char* begin_c, const char* end_c) {
+  LetusIterator* it = new LetusIterator();
+  it->it = p->trie->NewIterator(tid, version, begin_c, end_c);
+  return it;
+}
+
+void LetusIteratorSeekToFirst(LetusIterator* it) { it->it->SeekToFirst(); }
+
+void LetusIteratorSeekToLast(LetusIterator* it) { it->it->SeekToLast(); }
+
+void LetusIteratorSeek(LetusIterator* it, const char* key_c) {
+  it->it->Seek(key_c);
+}
+
+void LetusIteratorNext(LetusIterator* it) { it->it->Next(); }
+
+void LetusIteratorPrev(LetusIterator* it) { it->it->Prev(); }
+
+bool LetusIteratorValid(LetusIterator* it) { return it->it->Valid(); }
+
+char* LetusIteratorKey(LetusIterator* it) {
+  const std::string& key = it->it->Key();
+  char* key_c = new char[key.size() + 1];
+  key.copy(key_c, key.size(), 0);
+  key_c[key.size()] = '\0';
+  return key_c;
+}
+
+char* LetusIteratorValue(LetusIterator* it) {
+  std::string value = it->it->Value();
+  char* value_c = new char[value.size() + 1];
+  value.copy(value_c, value.size(), 0);
+  value_c[value.size()] = '\0';
+  return value_c;
+}
+
+void LetusDeleteIterator(LetusIterator* it) { delete it; }
+
+LetusScrubber* LetusNewScrubber(Letus* p, uint64_t tid, uint64_t version,
+                                const char* root_hash_c, uint64_t hash_size,
+                                const char* checkpoint_path_c,
+                                uint64_t rate_limit) {
+  LetusScrubber* s = new LetusScrubber();
+  s->scrubber = p->trie->NewScrubber(tid, version,
+                                     std::string(root_hash_c, hash_size),
+                                     checkpoint_path_c);
+  s->scrubber->SetRateLimit(rate_limit);
+  return s;
+}
+
+void LetusScrubberStart(LetusScrubber* s) { s->scrubber->Start(); }
+
+void LetusScrubberStop(LetusScrubber* s) { s->scrubber->Stop(); }
+
+int LetusScrubberState(LetusScrubber* s, uint64_t* pages,
+                       char** divergent_pid) {
+  DMMTrieScrubber::Status status = s->scrubber->GetStatus();
+  *pages = status.pages;
+  *divergent_pid = nullptr;
+  if (status.state == DMMTrieScrubber::State::kDiverged) {
+    size_t pid_size = status.divergent_pid.size();
+    *divergent_pid = new char[pid_size + 1];
+    status.divergent_pid.copy(*divergent_pid, pid_size, 0);
+    (*divergent_pid)[pid_size] = '\0';
+  }
+  return static_cast<int>(status.state);
+}
+
+void LetusDeleteScrubber(LetusScrubber* s) { delete s; }
+
 LetusProofPath* LetusProof(Letus* p, uint64_t tid, uint64_t version,
                            const char* key_c) {
   std::string key(key_c);
@@ -0,0 +1,253 @@
+#include "PageCache.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+#include "DMMTrie.hpp"
+
+PageCache::PageCache(size_t budget, size_t num_shards, size_t pinned_levels)
+    : shard_budget_(0), pinned_levels_(pinned_levels) {
+  num_shards = std::max<size_t>(num_shards, 1);
+  for (size_t i = 0; i < num_shards; i++) {
+    shards_.emplace_back(new Shard());
+  }
+  shard_budget_ = std::max<size_t>(budget / num_shards, 1);
+}
+
+PageCache::~PageCache() { Clear(); }
+
+std::shared_ptr<BasePage> PageCache::Get(const PageKey &pagekey) {
+  Shard &shard = GetShard(pagekey.pid);
+  std::shared_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.index.find(pagekey);
+  if (it == shard.index.end()) {
+    shard.misses.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  Entry *entry = shard.slots[it->second].get();
+  // only write the bit if it is not set, hot pages stay read-only
+  if (!entry->referenced.load(std::memory_order_relaxed)) {
+    entry->referenced.store(true, std::memory_order_relaxed);
+  }
+  shard.hits.fetch_add(1, std::memory_order_relaxed);
+  return entry->page;
+}
+
+bool PageCache::Holds(const PageKey &pagekey, const BasePage *page) {
+  Shard &shard = GetShard(pagekey.pid);
+  std::shared_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.index.find(pagekey);
+  return it != shard.index.end() &&
+         shard.slots[it->second]->page.get() == page;
+}
+
+void PageCache::Put(const PageKey &pagekey, std::shared_ptr<BasePage> page) {
+  Shard &shard = GetShard(pagekey.pid);
+  size_t bytes = page->GetMemorySize();
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  Entry *entry;
+  auto it = shard.index.find(pagekey);
+  if (it != shard.index.end()) {
+    entry = shard.slots[it->second].get();
+    shard.bytes -= entry->bytes;
+  } else {
+    entry = AddEntry(shard, pagekey);
+  }
+  entry->page = std::move(page);
+  Charge(shard, entry, bytes);
+}
+
+std::shared_ptr<BasePage> PageCache::PutIfAbsent(
+    const PageKey &pagekey, std::shared_ptr<BasePage> page) {
+  Shard &shard = GetShard(pagekey.pid);
+  size_t bytes = page->GetMemorySize();
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.index.find(pagekey);
+  if (it != shard.index.end()) {
+    Entry *entry = shard.slots[it->second].get();
+    entry->referenced = true;
+    return entry->page;
+  }
+  Entry *entry = AddEntry(shard, pagekey);
+  entry->page = page;
+  Charge(shard, entry, bytes);
+  return page;
+}
+
+void PageCache::Rekey(const PageKey &old_pagekey, const PageKey &new_pagekey) {
+  Shard &shard = GetShard(old_pagekey.pid);
+  if (&GetShard(new_pagekey.pid) != &shard) {
+    std::shared_ptr<BasePage> page;
+    {
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      auto it = shard.index.find(old_pagekey);
+      if (it == shard.index.end()) return;
+      page = shard.slots[it->second]->page;
+      Remove(shard, it->second);
+    }
+    Put(new_pagekey, std::move(page));
+    return;
+  }
+
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.index.find(old_pagekey);
+  if (it == shard.index.end()) {
+    return;
+  }
+  size_t slot = it->second;
+  auto existing = shard.index.find(new_pagekey);
+  if (existing != shard.index.end() && existing->second != slot) {
+    Remove(shard, existing->second);
+  }
+  shard.index.erase(old_pagekey);
+  Entry *entry = shard.slots[slot].get();
+  if (entry->pinned) {
+    shard.pinned.erase(old_pagekey.pid);
+    entry->pinned = false;
+  }
+  entry->pagekey = new_pagekey;
+  shard.index[new_pagekey] = slot;
+  shard.bytes -= entry->bytes;
+  entry->bytes = entry->page->GetMemorySize();
+  shard.bytes += entry->bytes;
+  entry->referenced = true;
+  if (IsTopLevel(new_pagekey.pid)) {
+    Pin(shard, entry);
+  }
+  EvictIfNeeded(shard);
+}
+
+void PageCache::Clear() {
+  for (auto &shard : shards_) {
+    std::unique_lock<std::shared_mutex> lock(shard->mutex);
+    shard->index.clear();
+    shard->slots.clear();
+    shard->free_slots.clear();
+    shard->pinned.clear();
+    shard->hand = 0;
+    shard->bytes = 0;
+  }
+}
+
+void PageCache::SetBudget(size_t budget) {
+  shard_budget_ = std::max<size_t>(budget / shards_.size(), 1);
+  for (auto &shard : shards_) {
+    std::unique_lock<std::shared_mutex> lock(shard->mutex);
+    EvictIfNeeded(*shard);
+  }
+}
+
+void PageCache::SetPinnedLevels(size_t levels) {
+  pinned_levels_ = levels;
+  for (auto &shard : shards_) {
+    std::unique_lock<std::shared_mutex> lock(shard->mutex);
+    for (auto it = shard->pinned.begin(); it != shard->pinned.end();) {
+      if (IsTopLevel(it->first)) {
+        ++it;
+        continue;
+      }
+      it->second->pinned = false;
+      it = shard->pinned.erase(it);
+    }
+    EvictIfNeeded(*shard);
+  }
+}
+
+PageCache::Stats PageCache::GetStats() const {
+  Stats stats{0, 0, 0, 0, 0};
+  for (const auto &shard : shards_) {
+    std::shared_lock<std::shared_mutex> lock(shard->mutex);
+    stats.hits += shard->hits.load(std::memory_order_relaxed);
+    stats.misses += shard->misses.load(std::memory_order_relaxed);
+    stats.evictions += shard->evictions.load(std::memory_order_relaxed);
+    stats.pages += shard->index.size();
+    stats.bytes += shard->bytes;
+  }
+  return stats;
+}
+
+PageCache::Shard &PageCache::GetShard(const std::string &pid) {
+  // the maps of the shards hash the same pids, use other bits for the shard
+  uint64_t h = std::hash<std::string>{}(pid) * 0x9E3779B97F4A7C15ULL;
+  return *shards_[(h >> 32) % shards_.size()];
+}
+
+bool PageCache::IsTopLevel(const std::string &pid) const {
+  return pid.size() < 2 * pinned_levels_.load(std::memory_order_relaxed);
+}
+
+void PageCache::Pin(Shard &shard, Entry *entry) {
+  Entry *&pinned = shard.pinned[entry->pagekey.pid];
+  if (pinned == entry) {
+    return;
+  }
+  if (pinned != nullptr) {
+    if (pinned->pagekey.version > entry->pagekey.version) {
+      return;  // an older version that a reader loaded
+    }
+    pinned->pinned = false;
+  }
+  entry->pinned = true;
+  pinned = entry;
+}
+
+PageCache::Entry *PageCache::AddEntry(Shard &shard, const PageKey &pagekey) {
+  size_t slot;
+  if (!shard.free_slots.empty()) {
+    slot = shard.free_slots.back();
+    shard.free_slots.pop_back();
+  } else {
+    slot = shard.slots.size();
+    shard.slots.emplace_back();
+  }
+  shard.slots[slot].reset(new Entry());
+  Entry *entry = shard.slots[slot].get();
+  entry->pagekey = pagekey;
+  entry->pinned = false;
+  shard.index[pagekey] = slot;
+  return entry;
+}
+
+void PageCache::Charge(Shard &shard, Entry *entry, size_t bytes) {
+  entry->bytes = bytes;
+  entry->referenced = true;
+  shard.bytes += bytes;
+  if (IsTopLevel(entry->pagekey.pid)) {
+    Pin(shard, entry);
+  }
+  EvictIfNeeded(shard);
+}
+
+void PageCache::Remove(Shard &shard, size_t slot) {
+  Entry *entry = shard.slots[slot].get();
+  if (entry->pinned) {
+    shard.pinned.erase(entry->pagekey.pid);
+  }
+  shard.bytes -= entry->bytes;
+  shard.index.erase(entry->pagekey);
+  shard.slots[slot].reset();
+  shard.free_slots.push_back(slot);
+}
+
+void PageCache::EvictIfNeeded(Shard &shard) {
+  // two sweeps of the hand clear every reference bit, stop after them if only
+  // pinned pages are left
+  size_t budget = shard_budget_.load(std::memory_order_relaxed);
+  size_t steps = 2 * shard.slots.size();
+  while (shard.bytes > budget && steps > 0) {
+    steps--;
+    if (shard.hand >= shard.slots.size()) {
+      shard.hand = 0;
+    }
+    size_t slot = shard.hand++;
+    Entry *entry = shard.slots[slot].get();
+    if (entry == nullptr || entry->pinned) {
+      continue;
+    }
+    if (entry->referenced.exchange(false, std::memory_order_relaxed)) {
+      continue;
+    }
+    Remove(shard, slot);
+    shard.evictions.fetch_add(1, std::memory_order_relaxed);
+  }
+}
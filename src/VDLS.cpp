@@ -0,0 +1,1488 @@
+#include "VDLS.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef LETUS_WITH_IO_URING
+#include <liburing.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+VDLS::Segment::~Segment() {
+  munmap(data, length);
+  if (fd != -1) {
+    close(fd);
+  }
+}
+
+void VDLS::ReadBatch::Wait() {
+  unique_lock<mutex> lock(mutex_);
+  done_cv_.wait(lock, [this]() { return pending_runs_ == 0; });
+  if (error_) {
+    rethrow_exception(error_);
+  }
+}
+
+bool VDLS::ReadBatch::Done() {
+  lock_guard<mutex> lock(mutex_);
+  return pending_runs_ == 0;
+}
+
+void VDLS::ReadBatch::Finish(exception_ptr error) {
+  lock_guard<mutex> lock(mutex_);
+  if (error && !error_) {
+    error_ = error;
+  }
+  if (--pending_runs_ == 0) {
+    done_cv_.notify_all();
+  }
+}
+
+VDLS::VDLS(string file_path)
+    : file_path_(file_path),
+      current_fileID_(0),
+      current_offset_(0),
+      max_read_segments_(kDefaultReadSegments),
+      max_read_map_bytes_(kDefaultReadMapBytes),
+      read_map_bytes_(0),
+      next_fileID_(1),
+      stop_background_(false),
+      durability_(DurabilityPolicy::kNone),
+      sync_interval_(0),
+      has_pending_sync_(false),
+      queued_fileID_(0),
+      queued_offset_(0),
+      written_version_(0),
+      durable_version_(0),
+      synced_version_(0),
+      manifest_fd_(-1),
+      manifest_seq_(0),
+      dedup_min_value_size_(kDefaultDedupMinValueSize),
+      inline_value_size_(0),
+      dedup_hits_(0),
+      dedup_saved_bytes_(0),
+      compression_codec_(CompressionCodec::kNone),
+      compression_block_size_(kDefaultBlockSize),
+      block_cache_bytes_(0),
+      max_block_cache_bytes_(kDefaultBlockCacheBytes),
+      next_segment_id_(1),
+      rewrite_rate_(0),
+      rewrite_ready_time_(chrono::steady_clock::now()),
+      gc_files_(0),
+      gc_reclaimed_bytes_(0),
+      num_read_threads_(kDefaultReadThreads),
+      stop_reads_(false) {
+  OpenManifest();
+  write_segment_ = OpenAndMapWriteFile(current_fileID_, false);
+  queued_fileID_ = current_fileID_;
+  queued_offset_ = current_offset_;
+  current_offset_ = ScanTail(*write_segment_, current_offset_);
+  RecoverRollOvers();
+  next_fileID_ = current_fileID_ + 1;
+  background_thread_ = thread([this]() { BackgroundLoop(); });
+}
+
+VDLS::~VDLS() {
+  StopReadThreads();
+  {
+    lock_guard<mutex> lock(background_mutex_);
+    stop_background_ = true;
+    QueuePendingSync();  // the values written last go to disk on close
+  }
+  background_cv_.notify_all();
+  background_thread_.join();
+  if (next_segment_ != nullptr) {  // the prepared data file was never used
+    next_segment_.reset();
+    unlink((file_path_ + "data_file_" + to_string(next_fileID_) + ".dat")
+               .c_str());
+  }
+  close(manifest_fd_);
+}
+
+tuple<uint64_t, uint64_t, uint64_t> VDLS::WriteValue(uint64_t version,
+                                                     const string& key,
+                                                     const string& value) {
+  if (IsInlineCandidate(value)) {
+    return InlineLocation(value);
+  }
+  size_t record_size = kRecordHeaderSize + key.size() + value.size();
+  if (record_size > MaxFileSize) {
+    throw runtime_error("Value record exceeds the data file size");
+  }
+
+  // an equal value reuses its existing record
+  uint64_t value_hash = 0;
+  tuple<uint64_t, uint64_t, uint64_t> location;
+  if (IsDedupCandidate(value)) {
+    value_hash = hash<string>{}(value);
+    if (FindDuplicate(value, value_hash, location)) {
+      return location;
+    }
+  }
+
+  // 检查是否需要创建新文件
+  if (current_offset_ + record_size > MaxFileSize) {
+    RollOver();
+  }
+
+  // 写入新记录到写映射区域
+  WriteRecord(write_segment_->data + current_offset_, version, key, value);
+
+  // 同步更改到磁盘
+  // if (msync(write_segment_->data, MaxFileSize, MS_SYNC) == -1) {
+  //   throw runtime_error("Failed to sync changes to disk");
+  // }
+
+  current_offset_ += record_size;
+
+  location = make_tuple(current_fileID_, current_offset_ - record_size,
+                        record_size);
+  if (IsDedupCandidate(value)) {
+    AddDedupEntry(value_hash, location);
+  }
+  return location;
+}
+
+vector<tuple<uint64_t, uint64_t, uint64_t>> VDLS::WriteValues(
+    uint64_t version,
+    const vector<pair<const string*, const string*>>& records) {
+  vector<tuple<uint64_t, uint64_t, uint64_t>> locations;
+  locations.reserve(records.size());
+  vector<uint64_t> value_hashes(records.size(), 0);
+  vector<bool> skipped(records.size(), false);
+  // first written record of each value hash in the batch
+  unordered_map<uint64_t, size_t> batch_values;
+  size_t begin = 0;
+  while (begin < records.size()) {
+    size_t end = begin;
+    uint64_t offset = current_offset_;
+    for (; end < records.size(); end++) {
+      const string& value = *records[end].second;
+      if (IsInlineCandidate(value)) {
+        locations.push_back(InlineLocation(value));
+        skipped[end] = true;
+        continue;
+      }
+      size_t record_size =
+          kRecordHeaderSize + records[end].first->size() + value.size();
+      if (record_size > MaxFileSize) {
+        throw runtime_error("Value record exceeds the data file size");
+      }
+      if (IsDedupCandidate(value)) {
+        value_hashes[end] = hash<string>{}(value);
+        auto it = batch_values.find(value_hashes[end]);
+        if (it != batch_values.end() &&
+            *records[it->second].second == value) {
+          locations.push_back(locations[it->second]);
+          skipped[end] = true;
+          dedup_hits_.fetch_add(1, memory_order_relaxed);
+          dedup_saved_bytes_.fetch_add(get<2>(locations.back()),
+                                       memory_order_relaxed);
+          continue;
+        }
+        tuple<uint64_t, uint64_t, uint64_t> location;
+        if (FindDuplicate(value, value_hashes[end], location)) {
+          locations.push_back(location);
+          skipped[end] = true;
+          continue;
+        }
+      }
+      if (offset + record_size > MaxFileSize) {
+        break;
+      }
+      locations.emplace_back(current_fileID_, offset, record_size);
+      offset += record_size;
+      if (IsDedupCandidate(value)) {
+        batch_values.emplace(value_hashes[end], end);
+      }
+    }
+    if (end == begin) {  // the next record doesn't fit any more
+      RollOver();
+      continue;
+    }
+    char* record = write_segment_->data + current_offset_;
+    for (size_t i = begin; i < end; i++) {
+      if (skipped[i]) {
+        continue;
+      }
+      record = WriteRecord(record, version, *records[i].first,
+                           *records[i].second);
+    }
+    current_offset_ = offset;
+    for (size_t i = begin; i < end; i++) {
+      if (!skipped[i] && IsDedupCandidate(*records[i].second)) {
+        AddDedupEntry(value_hashes[i], locations[i]);
+      }
+    }
+    begin = end;
+  }
+  return locations;
+}
+
+string VDLS::ReadValue(const tuple<uint64_t, uint64_t, uint64_t>& location) {
+  if (IsInline(location)) {
+    return InlineValue(location);
+  }
+  return string(ReadValueView(location).value);
+}
+
+VDLS::ValueView VDLS::ReadValueView(
+    const tuple<uint64_t, uint64_t, uint64_t>& location) {
+  if (IsInline(location)) {
+    auto value = make_shared<const string>(InlineValue(location));
+    string_view view(*value);
+    return {view, move(value)};
+  }
+  return ReadValueView(location, GetSegment(get<0>(location)));
+}
+
+bool VDLS::VerifyRecord(const tuple<uint64_t, uint64_t, uint64_t>& location) {
+  if (IsInline(location)) {
+    return true;
+  }
+  shared_ptr<const void> holder;
+  const char* record =
+      FindRecord(location, GetSegment(get<0>(location)), holder);
+  if (record == nullptr) {
+    return false;
+  }
+  uint64_t size = get<2>(location);
+  uint32_t key_size, value_size;
+  memcpy(&key_size, record + 8, sizeof(uint32_t));
+  memcpy(&value_size, record + 12, sizeof(uint32_t));
+  if (kRecordHeaderSize + key_size + value_size != size) {
+    return false;
+  }
+  return RecordChecksumMatches(record, key_size + value_size);
+}
+
+vector<string> VDLS::ReadValues(
+    const vector<tuple<uint64_t, uint64_t, uint64_t>>& locations) {
+  vector<string> values;
+  SubmitReads(locations, values, true)->Wait();
+  return values;
+}
+
+shared_ptr<VDLS::ReadBatch> VDLS::ReadValuesAsync(
+    const vector<tuple<uint64_t, uint64_t, uint64_t>>& locations,
+    vector<string>& values) {
+  return SubmitReads(locations, values, false);
+}
+
+void VDLS::SetReadThreads(size_t num_threads) {
+  StopReadThreads();
+  lock_guard<mutex> lock(read_queue_mutex_);
+  num_read_threads_ = num_threads;
+}
+
+void VDLS::SetDurability(DurabilityPolicy policy, uint64_t interval_ms) {
+  {
+    lock_guard<mutex> lock(background_mutex_);
+    durability_ = policy;
+    sync_interval_ = chrono::milliseconds(max<uint64_t>(interval_ms, 1));
+  }
+  background_cv_.notify_all();
+}
+
+VDLS::DurabilityPolicy VDLS::GetDurability() {
+  lock_guard<mutex> lock(background_mutex_);
+  return durability_;
+}
+
+void VDLS::CommitVersion(uint64_t version) {
+  {
+    lock_guard<mutex> lock(background_mutex_);
+    pending_sync_ = {write_segment_, current_fileID_, 0, current_offset_,
+                     false, version};
+    has_pending_sync_ = true;
+    written_version_ = version;
+    if (durability_ != DurabilityPolicy::kGroupCommit) {
+      return;
+    }
+    QueuePendingSync();
+  }
+  background_cv_.notify_all();
+}
+
+void VDLS::WaitDurable(uint64_t version) {
+  unique_lock<mutex> lock(background_mutex_);
+  uint64_t target = min(version, written_version_);
+  if (durable_version_ >= target) {
+    return;
+  }
+  QueuePendingSync();
+  background_cv_.notify_all();
+  durable_cv_.wait(lock, [this, target]() {
+    return durable_version_ >= target || background_error_ != nullptr;
+  });
+  if (durable_version_ < target) {
+    rethrow_exception(background_error_);
+  }
+}
+
+uint64_t VDLS::GetDurableVersion() {
+  lock_guard<mutex> lock(background_mutex_);
+  return durable_version_;
+}
+
+void VDLS::SetDedup(size_t table_entries, size_t min_value_size) {
+  size_t slots = 0;
+  if (table_entries > 0) {
+    slots = 1;
+    while (slots < table_entries) {
+      slots <<= 1;
+    }
+  }
+  dedup_table_.assign(slots, DedupEntry{0, make_tuple(0, 0, 0)});
+  dedup_min_value_size_ = min_value_size;
+}
+
+void VDLS::SetInlineValueSize(size_t max_size) {
+  inline_value_size_ = min(max_size, kMaxInlineValueSize);
+}
+
+void VDLS::SetChecksumVerify(ChecksumVerify mode, uint32_t sample_rate) {
+  checksum_policy_.Set(mode, sample_rate);
+}
+
+bool VDLS::SetCompression(CompressionCodec codec, size_t block_size) {
+  if (!CodecAvailable(codec)) {
+    return false;
+  }
+  lock_guard<mutex> lock(background_mutex_);
+  compression_codec_ = codec;
+  compression_block_size_ = max<size_t>(block_size, 1);
+  return true;
+}
+
+void VDLS::SetBlockCacheBudget(size_t bytes) {
+  lock_guard<mutex> lock(block_cache_mutex_);
+  max_block_cache_bytes_ = bytes;
+  EvictBlocks();
+}
+
+void VDLS::SetRewriteRateLimit(uint64_t bytes_per_second) {
+  {
+    lock_guard<mutex> lock(background_mutex_);
+    rewrite_rate_ = bytes_per_second;
+  }
+  background_cv_.notify_all();
+}
+
+size_t VDLS::CollectGarbage(LiveRecords& live, double dead_ratio) {
+  size_t queued = 0;
+  for (uint64_t fileID = 0; fileID < current_fileID_; fileID++) {
+    {
+      lock_guard<mutex> lock(read_mutex_);
+      if (retiring_segments_.count(fileID) != 0) {
+        continue;  // not synced yet
+      }
+    }
+    {
+      lock_guard<mutex> lock(background_mutex_);
+      bool queued_already = false;
+      for (const RewriteTask& task : rewrite_queue_) {
+        queued_already |= task.fileID == fileID;
+      }
+      if (queued_already) {
+        continue;
+      }
+    }
+    shared_ptr<const Segment> segment = GetSegment(fileID);
+    uint64_t stored = segment->length;
+    if (segment->has_blocks) {
+      stored = 0;
+      for (const Block& block : segment->blocks) {
+        stored += block.size;
+      }
+    }
+    vector<pair<uint64_t, uint64_t>>& records = live[fileID];
+    sort(records.begin(), records.end());
+    records.erase(unique(records.begin(), records.end()), records.end());
+    uint64_t live_bytes = 0;
+    for (const auto& record : records) {
+      live_bytes += record.second;
+    }
+    if (stored == 0 || live_bytes > stored * (1 - dead_ratio)) {
+      continue;
+    }
+    for (DedupEntry& entry : dedup_table_) {
+      if (get<0>(entry.location) == fileID) {
+        entry.location = make_tuple(0, 0, 0);
+      }
+    }
+    {
+      lock_guard<mutex> lock(background_mutex_);
+      rewrite_queue_.push_back({fileID, move(segment), false, 0,
+                                move(records), 0, compression_codec_,
+                                compression_block_size_, 0, {}, -1});
+    }
+    queued++;
+  }
+  background_cv_.notify_all();
+  return queued;
+}
+
+VDLS::GcStats VDLS::GetGcStats() const {
+  return {gc_files_.load(memory_order_relaxed),
+          gc_reclaimed_bytes_.load(memory_order_relaxed)};
+}
+
+VDLS::DedupStats VDLS::GetDedupStats() const {
+  return {dedup_hits_.load(memory_order_relaxed),
+          dedup_saved_bytes_.load(memory_order_relaxed)};
+}
+
+void VDLS::SetReadMapBudget(size_t max_segments, size_t max_bytes) {
+  lock_guard<mutex> lock(read_mutex_);
+  max_read_segments_ = max(max_segments, size_t(1));
+  max_read_map_bytes_ = max_bytes;
+  EvictReadMaps();
+}
+
+VDLS::ValueView VDLS::ReadValueView(
+    const tuple<uint64_t, uint64_t, uint64_t>& location,
+    shared_ptr<const Segment> segment) {
+  shared_ptr<const void> holder;
+  const char* record = FindRecord(location, move(segment), holder);
+  if (record == nullptr) {
+    throw runtime_error("Invalid value location in data file " +
+                        to_string(get<0>(location)));
+  }
+  return {RecordValue(record, location), move(holder)};
+}
+
+string_view VDLS::RecordValue(
+    const char* record, const tuple<uint64_t, uint64_t, uint64_t>& location) {
+  uint32_t key_size, value_size;
+  memcpy(&key_size, record + 8, sizeof(uint32_t));
+  memcpy(&value_size, record + 12, sizeof(uint32_t));
+  if (kRecordHeaderSize + key_size + value_size != get<2>(location) ||
+      (checksum_policy_.ShouldVerify() &&
+       !RecordChecksumMatches(record, key_size + value_size))) {
+    throw runtime_error("Corrupted value record in data file " +
+                        to_string(get<0>(location)));
+  }
+  return string_view(record + kRecordHeaderSize + key_size, value_size);
+}
+
+bool VDLS::RecordChecksumMatches(const char* record, size_t data_size) {
+  uint32_t checksum;
+  memcpy(&checksum, record + 16, sizeof(uint32_t));
+  uint32_t expected = Crc32c(record, 16);
+  expected = Crc32cExtend(expected, record + kRecordHeaderSize, data_size);
+  return checksum == expected;
+}
+
+shared_ptr<VDLS::ReadBatch> VDLS::SubmitReads(
+    const vector<tuple<uint64_t, uint64_t, uint64_t>>& locations,
+    vector<string>& values, bool read_first) {
+  values.assign(locations.size(), string());
+  auto batch = make_shared<ReadBatch>();
+  vector<size_t> order;
+  order.reserve(locations.size());
+  for (size_t i = 0; i < locations.size(); i++) {
+    if (IsInline(locations[i])) {
+      values[i] = InlineValue(locations[i]);
+    } else {
+      order.push_back(i);
+    }
+  }
+  sort(order.begin(), order.end(), [&locations](size_t a, size_t b) {
+    return locations[a] < locations[b];
+  });
+  vector<ReadRun> runs;
+  shared_ptr<const Segment> segment;
+  uint64_t segment_fileID = 0;
+  for (size_t i : order) {
+    uint64_t fileID, offset, size;
+    tie(fileID, offset, size) = locations[i];
+    if (segment == nullptr || fileID != segment_fileID) {
+      segment = GetSegment(fileID);
+      segment_fileID = fileID;
+    }
+    // adjacent records are merged into one read
+    ReadRun* run = runs.empty() ? nullptr : &runs.back();
+    if (run == nullptr || run->fileID != fileID ||
+        offset > run->offset + run->length + kReadCoalesceGap ||
+        offset + size - run->offset > kMaxReadRun) {
+      runs.push_back(
+          {segment, fileID, offset, 0, {}, &values, batch, false});
+      run = &runs.back();
+    }
+    run->length = max(run->length, offset + size - run->offset);
+    run->records.emplace_back(i, locations[i]);
+  }
+  batch->pending_runs_ = runs.size();
+  // records in memory are copied from the mapping, the others come first
+  // and are handed to the read threads
+  for (size_t begin = 0, end; begin < runs.size(); begin = end) {
+    for (end = begin + 1;
+         end < runs.size() && runs[end].fileID == runs[begin].fileID;
+         end++) {
+    }
+    MarkResidentRuns(runs, begin, end);
+  }
+  auto cold = stable_partition(runs.begin(), runs.end(),
+                               [](const ReadRun& run) { return !run.mapped; });
+  size_t cold_runs = cold - runs.begin();
+
+  size_t queued = 0;
+  {
+    lock_guard<mutex> lock(read_queue_mutex_);
+    while (read_threads_.size() < num_read_threads_) {
+      read_threads_.emplace_back([this]() { ReadLoop(); });
+    }
+    if (!read_threads_.empty()) {
+      for (size_t i = read_first ? 1 : 0; i < cold_runs; i++) {
+        read_queue_.push_back(move(runs[i]));
+        queued++;
+      }
+    }
+  }
+  if (queued > 0) {
+    read_queue_cv_.notify_all();
+  }
+  for (size_t i = 0; i < runs.size(); i++) {
+    if (i < cold_runs && i >= cold_runs - queued) {
+      continue;  // handed to the read threads
+    }
+    ReadRunValues(runs[i]);
+  }
+  return batch;
+}
+
+void VDLS::MarkResidentRuns(vector<ReadRun>& runs, size_t begin, size_t end) {
+  const Segment& segment = *runs[begin].segment;
+  uint64_t last = runs[end - 1].offset + runs[end - 1].length;
+  if (segment.has_blocks || last > segment.length) {
+    return;
+  }
+  static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  uint64_t first = runs[begin].offset & ~(page_size - 1);
+  vector<unsigned char> pages((last - first + page_size - 1) / page_size);
+  if (mincore(segment.data + first, last - first, pages.data()) != 0) {
+    return;
+  }
+  for (size_t i = begin; i < end; i++) {
+    ReadRun& run = runs[i];
+    size_t page = (run.offset - first) / page_size;
+    size_t last_page = (run.offset + run.length - 1 - first) / page_size;
+    run.mapped = true;
+    for (; page <= last_page && run.mapped; page++) {
+      run.mapped = (pages[page] & 1) != 0;
+    }
+  }
+}
+
+#ifdef LETUS_WITH_IO_URING
+struct VDLS::IoRing {
+  ~IoRing() {
+    if (open) {
+      io_uring_queue_exit(&ring);
+    }
+  }
+
+  io_uring ring;
+  bool open = false;
+};
+#else
+struct VDLS::IoRing {};
+#endif
+
+void VDLS::ReadLoop() {
+  unique_ptr<IoRing> ring;
+#ifdef LETUS_WITH_IO_URING
+  ring.reset(new IoRing);
+  ring->open = io_uring_queue_init(kReadRingDepth, &ring->ring, 0) == 0;
+  if (!ring->open) {  // a kernel without io_uring, read with pread
+    ring.reset();
+  }
+#endif
+  vector<ReadRun> runs;
+  unique_lock<mutex> lock(read_queue_mutex_);
+  while (true) {
+    read_queue_cv_.wait(
+        lock, [this]() { return stop_reads_ || !read_queue_.empty(); });
+    if (read_queue_.empty()) {  // exit once the queue is drained
+      return;
+    }
+    // on a ring a read thread takes its share of the queue at once
+    size_t max_runs = 1;
+    if (ring != nullptr) {
+      max_runs = min(kReadRingDepth,
+                     max<size_t>(1, read_queue_.size() / read_threads_.size()));
+    }
+    while (!read_queue_.empty() && runs.size() < max_runs) {
+      runs.push_back(move(read_queue_.front()));
+      read_queue_.pop_front();
+    }
+    lock.unlock();
+    if (!ReadRuns(runs, ring.get())) {
+      ring.reset();
+    }
+    runs.clear();
+    lock.lock();
+  }
+}
+
+bool VDLS::ReadRuns(vector<ReadRun>& runs, IoRing* ring) {
+#ifdef LETUS_WITH_IO_URING
+  if (ring != nullptr) {
+    // the runs of plain data files are read on the ring, the result of each
+    // is kept until all of them are done
+    static constexpr int kNotRead = INT32_MIN;
+    vector<string> buffers(runs.size());
+    vector<int> results(runs.size(), kNotRead);
+    vector<size_t> queued;
+    for (size_t i = 0; i < runs.size(); i++) {
+      ReadRun& run = runs[i];
+      if (run.segment->has_blocks || run.mapped ||
+          run.offset + run.length > run.segment->length) {
+        ReadRunValues(run);
+        continue;
+      }
+      buffers[i].resize(run.length);
+      io_uring_sqe* sqe = io_uring_get_sqe(&ring->ring);
+      io_uring_prep_read(sqe, run.segment->fd, &buffers[i][0], run.length,
+                         run.offset);
+      io_uring_sqe_set_data(sqe, &run);
+      queued.push_back(i);
+    }
+    int submitted;
+    do {
+      submitted = io_uring_submit(&ring->ring);
+    } while (submitted == -EINTR);
+    bool ring_ok = submitted == static_cast<int>(queued.size());
+    for (int n = 0; n < submitted; n++) {
+      io_uring_cqe* cqe;
+      int ret;
+      do {
+        ret = io_uring_wait_cqe(&ring->ring, &cqe);
+      } while (ret == -EINTR);
+      if (ret != 0) {
+        // the reads in flight end with the ring before their buffers do
+        io_uring_queue_exit(&ring->ring);
+        ring->open = false;
+        ring_ok = false;
+        break;
+      }
+      size_t i = static_cast<ReadRun*>(io_uring_cqe_get_data(cqe)) -
+                 runs.data();
+      results[i] = cqe->res;
+      io_uring_cqe_seen(&ring->ring, cqe);
+    }
+    // a run the ring did not read, or only in part, goes on with pread
+    for (size_t i : queued) {
+      ReadRun& run = runs[i];
+      exception_ptr error;
+      try {
+        int result = results[i];
+        if (result < 0 && result != kNotRead && result != -EINTR &&
+            result != -EAGAIN) {
+          throw runtime_error("Cannot read data file " + to_string(run.fileID));
+        }
+        size_t done = max(result, 0);
+        ReadAll(run.segment->fd, &buffers[i][done], run.length - done,
+                run.offset + done, run.fileID);
+        CopyRunValues(run, buffers[i].data());
+      } catch (...) {
+        error = current_exception();
+      }
+      run.batch->Finish(error);
+    }
+    return ring_ok;
+  }
+#endif
+  for (ReadRun& run : runs) {
+    ReadRunValues(run);
+  }
+  return true;
+}
+
+void VDLS::ReadRunValues(ReadRun& run) {
+  exception_ptr error;
+  try {
+    vector<string>& values = *run.values;
+    // read through the mapping or the block cache
+    if (run.segment->has_blocks || run.mapped) {
+      for (const auto& record : run.records) {
+        values[record.first] =
+            string(ReadValueView(record.second, run.segment).value);
+      }
+    } else {
+      if (run.offset + run.length > run.segment->length) {
+        throw runtime_error("Invalid value location in data file " +
+                            to_string(run.fileID));
+      }
+      string buffer(run.length, '\0');
+      ReadAll(run.segment->fd, &buffer[0], run.length, run.offset,
+              run.fileID);
+      CopyRunValues(run, buffer.data());
+    }
+  } catch (...) {
+    error = current_exception();
+  }
+  run.batch->Finish(error);
+}
+
+void VDLS::CopyRunValues(ReadRun& run, const char* buffer) {
+  vector<string>& values = *run.values;
+  for (const auto& record : run.records) {
+    const char* data = buffer + (get<1>(record.second) - run.offset);
+    values[record.first] = string(RecordValue(data, record.second));
+  }
+}
+
+void VDLS::StopReadThreads() {
+  {
+    lock_guard<mutex> lock(read_queue_mutex_);
+    stop_reads_ = true;
+  }
+  read_queue_cv_.notify_all();
+  for (thread& read_thread : read_threads_) {
+    read_thread.join();
+  }
+  lock_guard<mutex> lock(read_queue_mutex_);
+  read_threads_.clear();
+  stop_reads_ = false;
+}
+
+const char* VDLS::FindRecord(
+    const tuple<uint64_t, uint64_t, uint64_t>& location,
+    shared_ptr<const Segment> segment, shared_ptr<const void>& holder) {
+  uint64_t fileID, offset, size;
+  tie(fileID, offset, size) = location;
+  if (size < kRecordHeaderSize) {
+    return nullptr;
+  }
+  if (!segment->has_blocks) {
+    if (offset + size > segment->length) {
+      return nullptr;
+    }
+    const char* record = segment->data + offset;
+    holder = move(segment);
+    return record;
+  }
+  // records don't span blocks
+  auto it = upper_bound(
+      segment->blocks.begin(), segment->blocks.end(), offset,
+      [](uint64_t offset, const Block& block) {
+        return offset < block.offset;
+      });
+  if (it == segment->blocks.begin()) {
+    return nullptr;
+  }
+  --it;
+  if (offset + size > it->offset + it->size) {
+    return nullptr;
+  }
+  // an uncompressed block is read from the mapping
+  if (segment->codec == CompressionCodec::kNone) {
+    const char* record =
+        segment->data + it->physical_offset + (offset - it->offset);
+    holder = move(segment);
+    return record;
+  }
+  shared_ptr<const string> block =
+      GetBlock(it - segment->blocks.begin(), *segment);
+  const char* record = block->data() + (offset - it->offset);
+  holder = move(block);
+  return record;
+}
+
+shared_ptr<const string> VDLS::GetBlock(size_t index, const Segment& segment) {
+  uint64_t key = segment.id << 32 | index;
+  {
+    lock_guard<mutex> lock(block_cache_mutex_);
+    auto it = block_cache_index_.find(key);
+    if (it != block_cache_index_.end()) {
+      block_cache_.splice(block_cache_.begin(), block_cache_, it->second);
+      return it->second->second;
+    }
+  }
+  // decompress outside the lock, concurrent readers may each decompress
+  // the same block
+  const Block& entry = segment.blocks[index];
+  auto block = make_shared<string>(entry.size, '\0');
+  Decompress(segment.codec, segment.data + entry.physical_offset,
+             entry.physical_size, &(*block)[0], entry.size);
+  lock_guard<mutex> lock(block_cache_mutex_);
+  if (block_cache_index_.count(key) == 0) {
+    block_cache_.emplace_front(key, block);
+    block_cache_index_[key] = block_cache_.begin();
+    block_cache_bytes_ += block->size();
+    EvictBlocks();
+  }
+  return block;
+}
+
+void VDLS::EvictBlocks() {
+  while (!block_cache_.empty() &&
+         block_cache_bytes_ > max_block_cache_bytes_) {
+    block_cache_bytes_ -= block_cache_.back().second->size();
+    block_cache_index_.erase(block_cache_.back().first);
+    block_cache_.pop_back();
+  }
+}
+
+bool VDLS::IsInlineCandidate(const string& value) const {
+  return inline_value_size_ > 0 && value.size() <= inline_value_size_;
+}
+
+bool VDLS::IsDedupCandidate(const string& value) const {
+  return !dedup_table_.empty() && value.size() >= dedup_min_value_size_;
+}
+
+bool VDLS::FindDuplicate(const string& value, uint64_t value_hash,
+                         tuple<uint64_t, uint64_t, uint64_t>& location) {
+  const DedupEntry& entry =
+      dedup_table_[value_hash & (dedup_table_.size() - 1)];
+  if (get<2>(entry.location) == 0 || entry.value_hash != value_hash) {
+    return false;
+  }
+  shared_ptr<const void> holder;
+  const char* record = FindRecord(
+      entry.location, GetSegment(get<0>(entry.location)), holder);
+  if (record == nullptr) {
+    return false;
+  }
+  uint32_t key_size, value_size;
+  memcpy(&key_size, record + 8, sizeof(uint32_t));
+  memcpy(&value_size, record + 12, sizeof(uint32_t));
+  if (string_view(record + kRecordHeaderSize + key_size, value_size) !=
+      value) {
+    return false;
+  }
+  location = entry.location;
+  dedup_hits_.fetch_add(1, memory_order_relaxed);
+  dedup_saved_bytes_.fetch_add(get<2>(location), memory_order_relaxed);
+  return true;
+}
+
+void VDLS::AddDedupEntry(uint64_t value_hash,
+                         const tuple<uint64_t, uint64_t, uint64_t>& location) {
+  dedup_table_[value_hash & (dedup_table_.size() - 1)] = {value_hash,
+                                                          location};
+}
+
+char* VDLS::WriteRecord(char* record, uint64_t version, const string& key,
+                        const string& value) {
+  uint32_t key_size = key.size(), value_size = value.size();
+  memcpy(record, &version, sizeof(uint64_t));
+  memcpy(record + 8, &key_size, sizeof(uint32_t));
+  memcpy(record + 12, &value_size, sizeof(uint32_t));
+  memcpy(record + kRecordHeaderSize, key.data(), key_size);
+  memcpy(record + kRecordHeaderSize + key_size, value.data(), value_size);
+  uint32_t checksum = Crc32c(record, 16);
+  checksum = Crc32cExtend(checksum, record + kRecordHeaderSize,
+                          key_size + value_size);
+  memcpy(record + 16, &checksum, sizeof(uint32_t));
+  return record + kRecordHeaderSize + key_size + value_size;
+}
+
+shared_ptr<const VDLS::Segment> VDLS::GetSegment(uint64_t fileID) {
+  lock_guard<mutex> lock(read_mutex_);
+  if (fileID == current_fileID_) {
+    return write_segment_;
+  }
+  auto retiring = retiring_segments_.find(fileID);
+  if (retiring != retiring_segments_.end()) {
+    return retiring->second;
+  }
+  auto it = read_map_index_.find(fileID);
+  if (it != read_map_index_.end()) {
+    read_maps_.splice(read_maps_.begin(), read_maps_, it->second);
+    return it->second->second;
+  }
+  shared_ptr<const Segment> segment = OpenAndMapReadFile(fileID);
+  read_maps_.emplace_front(fileID, segment);
+  read_map_index_[fileID] = read_maps_.begin();
+  read_map_bytes_ += segment->length;
+  EvictReadMaps();
+  return segment;
+}
+
+void VDLS::EvictReadMaps() {
+  // the most recent mapping is kept, views of evicted ones keep them mapped
+  while (read_maps_.size() > 1 &&
+         (read_maps_.size() > max_read_segments_ ||
+          read_map_bytes_ > max_read_map_bytes_)) {
+    read_map_bytes_ -= read_maps_.back().second->length;
+    read_map_index_.erase(read_maps_.back().first);
+    read_maps_.pop_back();
+  }
+}
+
+void VDLS::RollOver() {
+  shared_ptr<Segment> next_segment;
+  {
+    unique_lock<mutex> lock(background_mutex_);
+    segment_ready_cv_.wait(lock, [this]() {
+      return next_segment_ != nullptr || background_error_ != nullptr;
+    });
+    if (background_error_ != nullptr) {
+      rethrow_exception(background_error_);
+    }
+    next_segment = move(next_segment_);
+  }
+
+  // the next file ID and offset, the old mapping goes with its last reader
+  uint64_t retired_fileID = current_fileID_;
+  uint64_t retired_length = current_offset_;
+  shared_ptr<Segment> retired_segment = write_segment_;
+  {
+    lock_guard<mutex> lock(read_mutex_);
+    retiring_segments_[retired_fileID] = retired_segment;
+    write_segment_ = move(next_segment);
+    current_fileID_++;
+    current_offset_ = 0;
+  }
+  {
+    lock_guard<mutex> lock(background_mutex_);
+    // a committed version that is not queued yet is durable with the file
+    uint64_t version = 0;
+    if (has_pending_sync_ && pending_sync_.fileID == retired_fileID) {
+      version = pending_sync_.version;
+      has_pending_sync_ = false;
+      pending_sync_.segment.reset();
+    }
+    QueueSync({retired_segment, retired_fileID, 0, retired_length, true,
+               version});
+    next_fileID_ = current_fileID_ + 1;
+  }
+  background_cv_.notify_all();
+}
+
+void VDLS::QueuePendingSync() {
+  if (has_pending_sync_) {
+    QueueSync(move(pending_sync_));
+    has_pending_sync_ = false;
+    pending_sync_.segment.reset();
+  }
+}
+
+void VDLS::QueueSync(SyncJob job) {
+  if (job.fileID == queued_fileID_) {
+    job.from = max(job.from, queued_offset_);
+  }
+  queued_fileID_ = job.fileID;
+  queued_offset_ = max(job.from, job.to);
+  sync_queue_.push_back(move(job));
+}
+
+void VDLS::BackgroundLoop() {
+  unique_lock<mutex> lock(background_mutex_);
+  chrono::steady_clock::time_point next_interval_sync =
+      chrono::steady_clock::now();
+  while (true) {
+    DurabilityPolicy policy = durability_;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if (policy == DurabilityPolicy::kInterval && now >= next_interval_sync) {
+      QueuePendingSync();
+      next_interval_sync = now + sync_interval_;
+    }
+    auto rewrite_ready = [this]() {
+      return !rewrite_queue_.empty() && !stop_background_ &&
+             chrono::steady_clock::now() >= rewrite_ready_time_;
+    };
+    auto has_work = [this, policy, &rewrite_ready]() {
+      return stop_background_ || !sync_queue_.empty() || rewrite_ready() ||
+             (next_segment_ == nullptr && background_error_ == nullptr) ||
+             durability_ != policy;
+    };
+    // wake up for the next interval sync and when the rate limit allows
+    // the next rewrite step
+    chrono::steady_clock::time_point deadline =
+        chrono::steady_clock::time_point::max();
+    if (policy == DurabilityPolicy::kInterval) {
+      deadline = next_interval_sync;
+    }
+    if (!rewrite_queue_.empty()) {
+      deadline = min(deadline, rewrite_ready_time_);
+    }
+    if (deadline == chrono::steady_clock::time_point::max()) {
+      background_cv_.wait(lock, has_work);
+    } else if (!background_cv_.wait_until(lock, deadline, has_work)) {
+      continue;
+    }
+    try {
+      if (next_segment_ == nullptr && background_error_ == nullptr &&
+          !stop_background_) {
+        uint64_t fileID = next_fileID_;
+        lock.unlock();
+        shared_ptr<Segment> segment = OpenAndMapWriteFile(fileID, true);
+        lock.lock();
+        next_segment_ = move(segment);
+        segment_ready_cv_.notify_all();
+      } else if (!sync_queue_.empty()) {
+        SyncJob job = move(sync_queue_.front());
+        sync_queue_.pop_front();
+        lock.unlock();
+        Sync(job);
+        lock.lock();
+        if (job.retire && job.to > 0 &&
+            compression_codec_ != CompressionCodec::kNone) {
+          rewrite_queue_.push_back({job.fileID, job.segment, true, job.to,
+                                    {}, 0, compression_codec_,
+                                    compression_block_size_, 0, {}, -1});
+        }
+        synced_version_ = max(synced_version_, job.version);
+        // the manifest is written once for a run of queued jobs, a version
+        // is durable when it is recorded there
+        if (job.retire || sync_queue_.empty()) {
+          uint64_t version = synced_version_;
+          lock.unlock();
+          if (job.retire) {  // the writer goes on in the next data file
+            WriteManifest(job.fileID + 1, 0, version);
+          } else {
+            WriteManifest(job.fileID, job.to, version);
+          }
+          lock.lock();
+          if (version > durable_version_) {
+            durable_version_ = version;
+            durable_cv_.notify_all();
+          }
+        }
+      } else if (rewrite_ready()) {
+        // one block at a time, so that syncs wait for a block at most
+        RewriteTask& task = rewrite_queue_.front();
+        lock.unlock();
+        bool done = true;
+        uint64_t bytes = 0;
+        try {
+          done = RewriteBlock(task, bytes);
+        } catch (...) {  // the data file stays as it is
+          AbandonRewrite(task);
+        }
+        lock.lock();
+        if (rewrite_rate_ > 0) {
+          rewrite_ready_time_ =
+              max(rewrite_ready_time_, chrono::steady_clock::now()) +
+              chrono::microseconds(bytes * 1000000 / rewrite_rate_);
+        }
+        if (done) {
+          rewrite_queue_.pop_front();
+        }
+      } else if (stop_background_) {
+        for (RewriteTask& task : rewrite_queue_) {
+          AbandonRewrite(task);
+        }
+        rewrite_queue_.clear();
+        return;
+      }
+    } catch (...) {
+      if (!lock.owns_lock()) {
+        lock.lock();
+      }
+      background_error_ = current_exception();
+      segment_ready_cv_.notify_all();
+      durable_cv_.notify_all();
+    }
+  }
+}
+
+void VDLS::Sync(const SyncJob& job) {
+  // sync the changes to disk, msync starts at a page boundary
+  static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  uint64_t from = job.from / page_size * page_size;
+  if (job.to > from &&
+      msync(job.segment->data + from, job.to - from, MS_SYNC) == -1) {
+    throw runtime_error("Failed to sync changes to disk");
+  }
+  if (!job.retire) {
+    return;
+  }
+  string filename =
+      file_path_ + "data_file_" + to_string(job.fileID) + ".dat";
+  if (truncate(filename.c_str(), job.to) == -1) {
+    throw runtime_error("Cannot truncate file: " + filename);
+  }
+  lock_guard<mutex> lock(read_mutex_);
+  retiring_segments_.erase(job.fileID);
+}
+
+bool VDLS::RewriteBlock(RewriteTask& task, uint64_t& bytes) {
+  string filename = file_path_ + "data_file_" + to_string(task.fileID);
+  if (task.fd == -1) {
+    task.fd = open((filename + ".cdat.tmp").c_str(),
+                   O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (task.fd == -1) {
+      throw runtime_error("Cannot create file: " + filename + ".cdat.tmp");
+    }
+  }
+  // split the records into blocks of whole records. the records of a block
+  // are contiguous, a record larger than a block has a block of its own
+  string records;
+  uint64_t block_offset = 0;
+  uint64_t offset, size;
+  while (PeekRecord(task, offset, size)) {
+    if (!records.empty() && (offset != block_offset + records.size() ||
+                             records.size() + size > task.block_size)) {
+      break;
+    }
+    shared_ptr<const void> holder;
+    const char* record =
+        FindRecord(make_tuple(task.fileID, offset, size), task.source, holder);
+    if (record == nullptr) {
+      throw runtime_error("Invalid value location in data file " +
+                          to_string(task.fileID));
+    }
+    if (records.empty()) {
+      block_offset = offset;
+    }
+    records.append(record, size);
+    task.position = task.all_records ? offset + size : task.position + 1;
+  }
+  string out;
+  if (!records.empty()) {
+    bytes = records.size();
+    Compress(task.codec, records.data(), records.size(), out);
+    WriteAll(task.fd, out.data(), out.size(), filename + ".cdat.tmp");
+    task.blocks.push_back({block_offset, task.physical_offset,
+                           uint32_t(out.size()), uint32_t(records.size())});
+    task.physical_offset += out.size();
+    return false;
+  }
+
+  // | index | index_offset (8) | block_count (4) | codec (4) | crc32c (4) |
+  // | reserved (4) | magic (8) |
+  out.resize(task.blocks.size() * kBlockEntrySize + kFooterSize);
+  char* entry = &out[0];
+  for (const Block& block : task.blocks) {
+    memcpy(entry, &block.offset, sizeof(uint64_t));
+    memcpy(entry + 8, &block.physical_offset, sizeof(uint64_t));
+    memcpy(entry + 16, &block.physical_size, sizeof(uint32_t));
+    memcpy(entry + 20, &block.size, sizeof(uint32_t));
+    entry += kBlockEntrySize;
+  }
+  uint32_t block_count = task.blocks.size();
+  uint32_t codec = static_cast<uint32_t>(task.codec);
+  uint32_t checksum = Crc32c(out.data(), entry - out.data());
+  uint32_t reserved = 0;
+  memcpy(entry, &task.physical_offset, sizeof(uint64_t));
+  memcpy(entry + 8, &block_count, sizeof(uint32_t));
+  memcpy(entry + 12, &codec, sizeof(uint32_t));
+  memcpy(entry + 16, &checksum, sizeof(uint32_t));
+  memcpy(entry + 20, &reserved, sizeof(uint32_t));
+  memcpy(entry + 24, &kCompressedMagic, sizeof(uint64_t));
+  bytes = out.size();
+  WriteAll(task.fd, out.data(), out.size(), filename + ".cdat.tmp");
+  if (fsync(task.fd) == -1) {
+    throw runtime_error("Failed to sync file: " + filename + ".cdat.tmp");
+  }
+  close(task.fd);
+  task.fd = -1;
+  if (rename((filename + ".cdat.tmp").c_str(),
+             (filename + ".cdat").c_str()) == -1) {
+    throw runtime_error("Cannot rename file: " + filename + ".cdat.tmp");
+  }
+  // the rename is durable before the data file is deleted
+  int dir_fd = open(file_path_.c_str(), O_RDONLY);
+  if (dir_fd != -1) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  if (!task.all_records) {
+    gc_files_.fetch_add(1, memory_order_relaxed);
+    gc_reclaimed_bytes_.fetch_add(
+        task.source->length - min<uint64_t>(task.source->length,
+                                            task.physical_offset + out.size()),
+        memory_order_relaxed);
+  }
+  lock_guard<mutex> lock(read_mutex_);
+  auto it = read_map_index_.find(task.fileID);
+  if (it != read_map_index_.end()) {
+    read_map_bytes_ -= it->second->second->length;
+    read_maps_.erase(it->second);
+    read_map_index_.erase(it);
+  }
+  unlink((filename + ".dat").c_str());
+  return true;
+}
+
+bool VDLS::PeekRecord(const RewriteTask& task, uint64_t& offset,
+                      uint64_t& size) {
+  if (!task.all_records) {
+    if (task.position >= task.records.size()) {
+      return false;
+    }
+    tie(offset, size) = task.records[task.position];
+    return true;
+  }
+  if (task.position >= task.length) {
+    return false;
+  }
+  offset = task.position;
+  if (offset + kRecordHeaderSize > task.length) {
+    throw runtime_error("Corrupted value record in data file " +
+                        to_string(task.fileID));
+  }
+  uint32_t key_size, value_size;
+  memcpy(&key_size, task.source->data + offset + 8, sizeof(uint32_t));
+  memcpy(&value_size, task.source->data + offset + 12, sizeof(uint32_t));
+  size = kRecordHeaderSize + uint64_t(key_size) + value_size;
+  if (offset + size > task.length) {
+    throw runtime_error("Corrupted value record in data file " +
+                        to_string(task.fileID));
+  }
+  return true;
+}
+
+void VDLS::AbandonRewrite(RewriteTask& task) {
+  if (task.fd != -1) {
+    close(task.fd);
+    task.fd = -1;
+  }
+  unlink((file_path_ + "data_file_" + to_string(task.fileID) + ".cdat.tmp")
+             .c_str());
+}
+
+void VDLS::ReadAll(int fd, char* data, size_t size, uint64_t offset,
+                   uint64_t fileID) {
+  while (size > 0) {
+    ssize_t n = pread(fd, data, size, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw runtime_error("Cannot read data file " + to_string(fileID));
+    }
+    data += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+void VDLS::WriteAll(int fd, const char* data, size_t size,
+                    const string& filename) {
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n <= 0) {
+      throw runtime_error("Cannot write file: " + filename);
+    }
+    data += n;
+    size -= n;
+  }
+}
+
+void VDLS::OpenManifest() {
+  string filename = file_path_ + "MANIFEST";
+  manifest_fd_ = open(filename.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  if (manifest_fd_ == -1) {
+    throw runtime_error("Cannot open or create file: " + filename);
+  }
+  struct stat sb;
+  if (fstat(manifest_fd_, &sb) == 0 && sb.st_size == 0) {
+    // a new manifest is synced into its directory
+    int dir_fd = open(file_path_.c_str(), O_RDONLY);
+    if (dir_fd != -1) {
+      fsync(dir_fd);
+      close(dir_fd);
+    }
+  }
+  for (size_t slot = 0; slot < 2; slot++) {
+    char buffer[kManifestSlotSize];
+    if (pread(manifest_fd_, buffer, kManifestSlotSize,
+              slot * kManifestSlotSize) != kManifestSlotSize) {
+      continue;
+    }
+    uint64_t fields[5];  // magic, seq, fileID, offset, version
+    uint32_t checksum;
+    memcpy(fields, buffer, sizeof(fields));
+    memcpy(&checksum, buffer + sizeof(fields), sizeof(uint32_t));
+    if (fields[0] != kManifestMagic ||
+        checksum != Crc32c(buffer, sizeof(fields)) ||
+        fields[1] < manifest_seq_) {
+      continue;
+    }
+    manifest_seq_ = fields[1];
+    current_fileID_ = fields[2];
+    current_offset_ = fields[3];
+    durable_version_ = synced_version_ = written_version_ = fields[4];
+  }
+}
+
+void VDLS::WriteManifest(uint64_t fileID, uint64_t offset, uint64_t version) {
+  manifest_seq_++;
+  char buffer[kManifestSlotSize] = {};
+  uint64_t fields[5] = {kManifestMagic, manifest_seq_, fileID, offset,
+                        version};
+  memcpy(buffer, fields, sizeof(fields));
+  uint32_t checksum = Crc32c(buffer, sizeof(fields));
+  memcpy(buffer + sizeof(fields), &checksum, sizeof(uint32_t));
+  if (pwrite(manifest_fd_, buffer, kManifestSlotSize,
+             manifest_seq_ % 2 * kManifestSlotSize) != kManifestSlotSize ||
+      fdatasync(manifest_fd_) == -1) {
+    throw runtime_error("Failed to write the manifest");
+  }
+}
+
+uint64_t VDLS::ScanTail(const Segment& segment, uint64_t offset) {
+  while (offset + kRecordHeaderSize <= MaxFileSize) {
+    const char* record = segment.data + offset;
+    uint32_t key_size, value_size;
+    memcpy(&key_size, record + 8, sizeof(uint32_t));
+    memcpy(&value_size, record + 12, sizeof(uint32_t));
+    uint64_t size = kRecordHeaderSize + uint64_t(key_size) + value_size;
+    if (offset + size > MaxFileSize ||
+        !RecordChecksumMatches(record, key_size + value_size)) {
+      break;
+    }
+    offset += size;
+  }
+  return offset;
+}
+
+void VDLS::RecoverRollOvers() {
+  while (true) {
+    string filename =
+        file_path_ + "data_file_" + to_string(current_fileID_ + 1) + ".dat";
+    struct stat sb;
+    if (stat(filename.c_str(), &sb) != 0) {
+      return;
+    }
+    shared_ptr<Segment> segment =
+        OpenAndMapWriteFile(current_fileID_ + 1, false);
+    uint64_t end = ScanTail(*segment, 0);
+    if (end == 0) {  // prepared by the background thread and not used
+      return;
+    }
+    Sync({write_segment_, current_fileID_, queued_offset_, current_offset_,
+          true, 0});
+    write_segment_ = move(segment);
+    current_fileID_++;
+    current_offset_ = end;
+    queued_fileID_ = current_fileID_;
+    queued_offset_ = 0;
+  }
+}
+
+shared_ptr<VDLS::Segment> VDLS::OpenAndMapWriteFile(uint64_t fileID,
+                                                    bool populate) {
+  string filename = file_path_ + "data_file_" + to_string(fileID) + ".dat";
+
+  // 打开或创建文件
+  int fd = open(filename.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    throw runtime_error("Cannot open or create file: " + filename);
+  }
+
+  // 确保文件至少有 MaxFileSize 大小
+  if (!populate || posix_fallocate(fd, 0, MaxFileSize) != 0) {
+    ftruncate(fd, MaxFileSize);
+  }
+
+  // 内存映射文件为写映射区域
+  void* write_map =
+      mmap(nullptr, MaxFileSize, PROT_READ | PROT_WRITE,
+           populate ? MAP_SHARED | MAP_POPULATE : MAP_SHARED, fd, 0);
+  if (write_map == MAP_FAILED) {
+    close(fd);
+    throw runtime_error("Memory map for writing failed: " + filename);
+  }
+
+  // the read threads pread from the kept file descriptor
+  auto segment =
+      make_shared<Segment>(static_cast<char*>(write_map), MaxFileSize);
+  segment->fd = fd;
+  return segment;
+}
+
+shared_ptr<const VDLS::Segment> VDLS::OpenAndMapReadFile(uint64_t fileID) {
+  shared_ptr<const Segment> compressed = OpenAndMapCompressedFile(fileID);
+  if (compressed != nullptr) {
+    return compressed;
+  }
+  string filename = file_path_ + "data_file_" + to_string(fileID) + ".dat";
+
+  // 打开文件
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw runtime_error("Cannot open file for reading: " + filename);
+  }
+
+  // the file size, older data files were truncated to their length
+  // on rollover
+  struct stat sb;
+  if (fstat(fd, &sb) == -1 || sb.st_size == 0) {
+    close(fd);
+    throw runtime_error("Cannot get file size: " + filename);
+  }
+
+  // 内存映射文件为读映射区域，根据实际文件大小映射
+  void* read_map = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (read_map == MAP_FAILED) {
+    close(fd);
+    throw runtime_error("Memory map for reading failed: " + filename);
+  }
+
+  // the read threads pread from the kept file descriptor
+  auto segment =
+      make_shared<Segment>(static_cast<char*>(read_map), sb.st_size);
+  segment->fd = fd;
+  return segment;
+}
+
+shared_ptr<const VDLS::Segment> VDLS::OpenAndMapCompressedFile(
+    uint64_t fileID) {
+  string filename = file_path_ + "data_file_" + to_string(fileID) + ".cdat";
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return nullptr;
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) == -1 || sb.st_size < int64_t(kFooterSize)) {
+    close(fd);
+    throw runtime_error("Corrupted compressed data file: " + filename);
+  }
+  void* read_map = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (read_map == MAP_FAILED) {
+    throw runtime_error("Memory map for reading failed: " + filename);
+  }
+  auto segment =
+      make_shared<Segment>(static_cast<char*>(read_map), sb.st_size);
+  segment->id = next_segment_id_.fetch_add(1, memory_order_relaxed);
+  segment->has_blocks = true;
+
+  // read the footer and the block index
+  const char* footer = segment->data + segment->length - kFooterSize;
+  uint64_t index_offset, magic;
+  uint32_t block_count, codec, checksum;
+  memcpy(&index_offset, footer, sizeof(uint64_t));
+  memcpy(&block_count, footer + 8, sizeof(uint32_t));
+  memcpy(&codec, footer + 12, sizeof(uint32_t));
+  memcpy(&checksum, footer + 16, sizeof(uint32_t));
+  memcpy(&magic, footer + 24, sizeof(uint64_t));
+  if (magic != kCompressedMagic ||
+      index_offset + uint64_t(block_count) * kBlockEntrySize !=
+          segment->length - kFooterSize ||
+      checksum != Crc32c(segment->data + index_offset,
+                         uint64_t(block_count) * kBlockEntrySize) ||
+      !CodecAvailable(static_cast<CompressionCodec>(codec))) {
+    throw runtime_error("Corrupted compressed data file: " + filename);
+  }
+  segment->codec = static_cast<CompressionCodec>(codec);
+  segment->blocks.resize(block_count);
+  const char* entry = segment->data + index_offset;
+  for (Block& block : segment->blocks) {
+    memcpy(&block.offset, entry, sizeof(uint64_t));
+    memcpy(&block.physical_offset, entry + 8, sizeof(uint64_t));
+    memcpy(&block.physical_size, entry + 16, sizeof(uint32_t));
+    memcpy(&block.size, entry + 20, sizeof(uint32_t));
+    if (block.physical_offset + block.physical_size > index_offset) {
+      throw runtime_error("Corrupted compressed data file: " + filename);
+    }
+    entry += kBlockEntrySize;
+  }
+  return segment;
+}
@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+
+#include "Arena.hpp"
+
+TEST(ArenaTest, AllocationsAreAlignedAndOwned) {
+  Arena arena(64);
+  int outside = 0;
+  for (size_t size = 1; size < 300; size += 7) {
+    void *p = arena.Allocate(size);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % alignof(std::max_align_t), 0u);
+    EXPECT_TRUE(arena.Owns(p));
+    memset(p, 0x5a, size);
+  }
+  EXPECT_FALSE(arena.Owns(&outside));
+  EXPECT_GT(arena.MemoryUsage(), 0u);
+  arena.Release();
+  EXPECT_EQ(arena.MemoryUsage(), 0u);
+}
+
+TEST(ArenaTest, NewConstructsInPlace) {
+  struct Pair {
+    Pair(int a, double b) : a(a), b(b) {}
+    int a;
+    double b;
+  };
+  Arena arena;
+  Pair *first = arena.New<Pair>(1, 2.5);
+  Pair *second = arena.New<Pair>(3, 4.5);
+  EXPECT_EQ(first->a, 1);
+  EXPECT_EQ(first->b, 2.5);
+  EXPECT_EQ(second->a, 3);
+  EXPECT_NE(first, second);
+}
+
+// a reserved run of allocations fits in one chunk
+TEST(ArenaTest, ReserveKeepsAllocationsTogether) {
+  Arena arena(64);
+  arena.Allocate(40);
+  arena.Reserve(1000);
+  size_t usage = arena.MemoryUsage();
+  char *first = static_cast<char *>(arena.Allocate(500, 1));
+  char *second = static_cast<char *>(arena.Allocate(500, 1));
+  EXPECT_EQ(second, first + 500);
+  EXPECT_EQ(arena.MemoryUsage(), usage);
+}
@@ -0,0 +1,32 @@
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+
+#include "Codec.hpp"
+
+// the codecs that are not built in refuse to compress
+TEST(CodecTest, RoundTripsAvailableCodecs) {
+  std::string data;
+  for (int i = 0; i < 2000; i++) {
+    data += "record " + std::to_string(i % 50) + ",";
+  }
+  for (CompressionCodec codec :
+       {CompressionCodec::kNone, CompressionCodec::kLz4,
+        CompressionCodec::kZstd, CompressionCodec::kZlib}) {
+    std::string compressed;
+    if (!CodecAvailable(codec)) {
+      EXPECT_THROW(Compress(codec, data.data(), data.size(), compressed),
+                   std::runtime_error);
+      continue;
+    }
+    Compress(codec, data.data(), data.size(), compressed);
+    if (codec != CompressionCodec::kNone) {
+      EXPECT_LT(compressed.size(), data.size());
+    }
+    std::string decompressed(data.size(), '\0');
+    Decompress(codec, compressed.data(), compressed.size(), &decompressed[0],
+               decompressed.size());
+    EXPECT_EQ(decompressed, data) << static_cast<int>(codec);
+  }
+}
@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+
+#include "Crc32c.hpp"
+
+TEST(Crc32cTest, MatchesKnownValue) {
+  EXPECT_EQ(Crc32c("123456789", 9), 0xe3069283u);
+  EXPECT_EQ(Crc32cExtendTable(0, "123456789", 9), 0xe3069283u);
+  EXPECT_EQ(Crc32c("", 0), 0u);
+}
+
+// the hardware path, if there is one, and any split of the data give the
+// checksum of the table
+TEST(Crc32cTest, ExtendMatchesTable) {
+  std::mt19937_64 rng(13);
+  std::string data(1000, '\0');
+  for (char &c : data) {
+    c = static_cast<char>(rng());
+  }
+  for (size_t begin = 0; begin < 9; begin++) {
+    for (size_t size : {0, 1, 7, 8, 9, 63, 500, 991}) {
+      const char *p = data.data() + begin;
+      uint32_t expected = Crc32cExtendTable(0, p, size);
+      EXPECT_EQ(Crc32c(p, size), expected) << begin << " " << size;
+      size_t half = size / 3;
+      EXPECT_EQ(Crc32cExtend(Crc32c(p, half), p + half, size - half),
+                expected);
+    }
+  }
+}
+
+TEST(Crc32cTest, PolicyPicksReads) {
+  ChecksumPolicy policy;
+  policy.Set(ChecksumVerify::kAlways, 0);
+  EXPECT_TRUE(policy.ShouldVerify());
+
+  policy.Set(ChecksumVerify::kSampled, 4);
+  int verified = 0;
+  for (int i = 0; i < 100; i++) {
+    verified += policy.ShouldVerify();
+  }
+  EXPECT_EQ(verified, 25);
+
+  policy.Set(ChecksumVerify::kScrub, 0);
+  EXPECT_FALSE(policy.ShouldVerify());
+  {
+    ChecksumPolicy::ScrubScope scrub;
+    EXPECT_TRUE(policy.ShouldVerify());
+  }
+  EXPECT_FALSE(policy.ShouldVerify());
+}
@@ -0,0 +1,558 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TestStore.hpp"
+
+namespace {
+
+// commits versions 1 to num_versions of puts of keys, and deletes if
+// with_deletes, drawn from seed and returns the root hash of each version.
+// the expected state of each version goes to states if given.
+std::vector<std::string> CommitVersionsOf(
+    DMMTrie *trie, const std::vector<std::string> &keys, int num_versions,
+    int updates_per_version, uint64_t seed, bool with_deletes = true,
+    std::vector<std::map<std::string, std::string>> *states = nullptr) {
+  std::mt19937_64 rng(seed);
+  std::vector<std::string> roots(num_versions + 1);
+  std::map<std::string, std::string> state;
+  if (states != nullptr) {
+    states->assign(num_versions + 1, state);
+  }
+  for (int version = 1; version <= num_versions; version++) {
+    for (int i = 0; i < updates_per_version; i++) {
+      const std::string &key = keys[rng() % keys.size()];
+      if (with_deletes && rng() % 10 == 0) {
+        trie->Delete(0, version, key);
+        state.erase(key);
+        continue;
+      }
+      std::string value = "value_" + std::to_string(version) + "_" +
+                          std::to_string(i) + std::string(rng() % 40, 'v');
+      trie->Put(0, version, key, value);
+      state[key] = value;
+    }
+    trie->CalcRootHash(0, version);
+    roots[version] = trie->GetRootHash(0, version);
+    if (states != nullptr) {
+      (*states)[version] = state;
+    }
+  }
+  return roots;
+}
+
+// CommitVersionsOf the 3000 decimal keys of TestKey
+std::vector<std::string> CommitVersions(
+    DMMTrie *trie, int num_versions, int updates_per_version, uint64_t seed,
+    bool with_deletes = true,
+    std::vector<std::map<std::string, std::string>> *states = nullptr) {
+  std::vector<std::string> keys;
+  for (int i = 0; i < 3000; i++) {
+    keys.push_back(TestKey(i));
+  }
+  return CommitVersionsOf(trie, keys, num_versions, updates_per_version, seed,
+                          with_deletes, states);
+}
+
+// num_keys keys of 6 to 12 hex nibbles drawn from seed. no key is a prefix of
+// another one, as a key ends at a leafnode.
+std::vector<std::string> HexKeys(size_t num_keys, uint64_t seed) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::mt19937_64 rng(seed);
+  std::set<std::string> keys;
+  while (keys.size() < num_keys) {
+    std::string key(6 + rng() % 7, '0');
+    for (char &nibble : key) {
+      nibble = kHexDigits[rng() % 16];
+    }
+    bool has_prefix = false;
+    for (size_t size = 6; size < key.size(); size++) {
+      has_prefix |= keys.count(key.substr(0, size)) > 0;
+    }
+    auto next = keys.lower_bound(key);
+    if (!has_prefix &&
+        (next == keys.end() || next->compare(0, key.size(), key) != 0)) {
+      keys.insert(key);
+    }
+  }
+  return std::vector<std::string>(keys.begin(), keys.end());
+}
+
+}  // namespace
+
+TEST(DMMTrieTest, RootHashIndependentOfCommitThreads) {
+  TestStore serial("serial");
+  TestStore parallel("parallel");
+  parallel.Trie()->SetCommitThreads(4);
+  std::vector<std::string> serial_roots =
+      CommitVersions(serial.Trie(), 20, 300, 1);
+  std::vector<std::string> parallel_roots =
+      CommitVersions(parallel.Trie(), 20, 300, 1);
+  for (int version = 1; version <= 20; version++) {
+    EXPECT_FALSE(serial_roots[version].empty());
+    EXPECT_EQ(serial_roots[version], parallel_roots[version])
+        << "version " << version;
+  }
+}
+
+// Verify derives the hashes again from the values, and a deleted leaf keeps
+// the empty hash the commit gave it
+TEST(DMMTrieTest, IndexNodeHashesMatchVerify) {
+  TestStore store;
+  std::vector<std::string> roots = CommitVersions(store.Trie(), 10, 300, 2);
+  for (int version = 1; version <= 10; version++) {
+    EXPECT_TRUE(store.Trie()->Verify(0, version, roots[version]))
+        << "version " << version;
+  }
+}
+
+// with no cache budget every read deserializes the pages again
+TEST(DMMTrieTest, GetsFromSerializedPages) {
+  TestStore store;
+  std::vector<std::map<std::string, std::string>> states;
+  CommitVersions(store.Trie(), 10, 300, 3, true, &states);
+  store.Trie()->SetCacheBudget(1);
+  for (int version = 1; version <= 10; version++) {
+    for (const auto &[key, value] : states[version]) {
+      ASSERT_EQ(store.Trie()->Get(0, version, key), value)
+          << "version " << version << " key " << key;
+    }
+  }
+}
+
+// a page with more updates in a version than two deltapages hold is written
+// as a checkpoint. the hex keys put most of the updates of a version into the
+// root page, the versions before each checkpoint still read their own pages.
+TEST(DMMTrieTest, GetsVersionsBeforeCheckpoints) {
+  TestStore store;
+  std::vector<std::map<std::string, std::string>> states;
+  CommitVersionsOf(store.Trie(), HexKeys(2000, 17), 10, 300, 18, true,
+                   &states);
+  for (int version = 1; version <= 10; version++) {
+    for (const auto &[key, value] : states[version]) {
+      ASSERT_EQ(store.Trie()->Get(0, version, key), value)
+          << "version " << version << " key " << key;
+    }
+  }
+}
+
+// a page that needs no delta replay is read through a view of its bytes. the
+// pages of every version are walked down from the root page.
+TEST(DMMTrieTest, PageViewMatchesDeserializedPage) {
+  TestStore store;
+  CommitVersions(store.Trie(), 10, 300, 4);
+  store.Trie()->Flush(0, 10);
+  std::vector<char> buffer(PAGE_SIZE);
+  std::vector<PageKey> pagekeys;
+  for (uint64_t version = 1; version <= 10; version++) {
+    pagekeys.push_back({version, 0, false, ""});
+  }
+  std::set<std::pair<std::string, uint64_t>> visited;
+  size_t views = 0;
+  while (!pagekeys.empty()) {
+    PageKey pagekey = pagekeys.back();
+    pagekeys.pop_back();
+    if (!visited.insert({pagekey.pid, pagekey.version}).second) {
+      continue;
+    }
+    std::shared_ptr<BasePage> page = store.PageStore()->LoadPage(pagekey);
+    ASSERT_NE(page, nullptr);
+    Node *root = page->GetRoot();
+    if (!root->IsLeaf()) {
+      for (int i = 0; i < static_cast<int>(DMM_NODE_FANOUT); i++) {
+        Node *child = root->HasChild(i) ? root->GetChild(i) : nullptr;
+        for (int j = 0; child != nullptr && !child->IsLeaf() &&
+                        j < static_cast<int>(DMM_NODE_FANOUT);
+             j++) {
+          if (child->HasChild(j)) {
+            pagekeys.push_back({child->GetChildVersion(j), 0, false,
+                                pagekey.pid + std::to_string(i) +
+                                    std::to_string(j)});
+          }
+        }
+      }
+    }
+    if (store.PageStore()->LoadPage(pagekey, buffer.data()) != nullptr) {
+      continue;
+    }
+    views++;
+    BasePageView view(buffer.data());
+    NodeView root_view = view.GetRoot();
+    EXPECT_EQ(view.GetPid(), pagekey.pid);
+    EXPECT_EQ(view.GetVersion(), page->GetPageKey().version);
+    ASSERT_EQ(root_view.IsLeaf(), root->IsLeaf());
+    EXPECT_EQ(root_view.GetHash(), root->GetHash());
+    if (root->IsLeaf()) {
+      EXPECT_EQ(root_view.GetLocation(),
+                static_cast<LeafNode *>(root)->GetLocation());
+      continue;
+    }
+    for (int i = 0; i < static_cast<int>(DMM_NODE_FANOUT); i++) {
+      ASSERT_EQ(root_view.HasChild(i), root->HasChild(i)) << "child " << i;
+      if (root->HasChild(i)) {
+        EXPECT_EQ(root_view.GetChildHash(i), root->GetChildHash(i));
+        EXPECT_EQ(root_view.GetChildVersion(i), root->GetChildVersion(i));
+      }
+    }
+  }
+  EXPECT_GT(views, 0u);
+}
+
+// pages shared with LSVPS are copied before a commit changes them, also
+// when the page cache evicts them right away
+TEST(DMMTrieTest, SharedPagesSurviveEviction) {
+  TestStore cached("cached");
+  TestStore evicting("evicting");
+  evicting.Trie()->SetCacheBudget(1);
+  std::vector<std::map<std::string, std::string>> states;
+  std::vector<std::string> cached_roots =
+      CommitVersions(cached.Trie(), 15, 300, 5);
+  std::vector<std::string> evicting_roots =
+      CommitVersions(evicting.Trie(), 15, 300, 5, true, &states);
+  for (int version = 1; version <= 15; version++) {
+    EXPECT_EQ(cached_roots[version], evicting_roots[version])
+        << "version " << version;
+  }
+  for (int version : {1, 8, 15}) {
+    for (const auto &[key, value] : states[version]) {
+      ASSERT_EQ(evicting.Trie()->Get(0, version, key), value)
+          << "version " << version << " key " << key;
+    }
+  }
+}
+
+// readers on another thread see the committed versions while later versions
+// are committed
+TEST(DMMTrieTest, ReadsDuringCommit) {
+  TestStore expected("expected");
+  std::vector<std::map<std::string, std::string>> states;
+  std::vector<std::string> roots =
+      CommitVersions(expected.Trie(), 12, 300, 6, true, &states);
+
+  TestStore store;
+  store.Trie()->SetConcurrentReads(true);
+  store.Trie()->SetCacheBudget(1 << 16);
+  std::atomic<bool> done(false);
+  std::atomic<uint64_t> reads(0);
+  std::thread reader([&]() {
+    std::mt19937_64 rng(7);
+    while (!done.load()) {
+      uint64_t version = store.Trie()->GetCommittedVersion();
+      if (version == 0 || states[version].empty()) {
+        continue;
+      }
+      auto it = states[version].begin();
+      std::advance(it, rng() % states[version].size());
+      ASSERT_EQ(store.Trie()->Get(0, version, it->first), it->second)
+          << "version " << version << " key " << it->first;
+      ASSERT_EQ(store.Trie()->GetRootHash(0, version), roots[version]);
+      reads++;
+    }
+  });
+  std::vector<std::string> concurrent_roots =
+      CommitVersions(store.Trie(), 12, 300, 6);
+  done = true;
+  reader.join();
+  EXPECT_EQ(concurrent_roots, roots);
+  EXPECT_GT(reads.load(), 0u);
+}
+
+// unsorted keys with duplicates and keys that were never written
+TEST(DMMTrieTest, MultiGetMatchesGet) {
+  TestStore store;
+  CommitVersions(store.Trie(), 10, 300, 8);
+  std::mt19937_64 rng(9);
+  std::vector<std::string> keys;
+  for (int i = 0; i < 500; i++) {
+    keys.push_back(TestKey(rng() % 3500));
+  }
+  for (int version : {1, 5, 10}) {
+    std::vector<std::string> values = store.Trie()->MultiGet(0, version, keys);
+    ASSERT_EQ(values.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      EXPECT_EQ(values[i], store.Trie()->Get(0, version, keys[i]))
+          << "version " << version << " key " << keys[i];
+    }
+  }
+}
+
+// scans of ranges forward and backward return the keys of the version in
+// order. deleted keys stay in the trie with an empty value, so the versions
+// have no deletes.
+TEST(DMMTrieTest, IteratorMatchesOrderedMap) {
+  TestStore store;
+  std::vector<std::map<std::string, std::string>> states;
+  CommitVersions(store.Trie(), 8, 300, 10, false, &states);
+  std::vector<std::pair<std::string, std::string>> ranges = {
+      {"", "999999"},
+      {TestKey(100), TestKey(2500)},
+      {TestKey(1234), TestKey(1300)}};
+  for (int version : {1, 8}) {
+    const std::map<std::string, std::string> &state = states[version];
+    for (const auto &[begin, end] : ranges) {
+      auto first = state.lower_bound(begin);
+      auto last = state.lower_bound(end);
+      std::unique_ptr<DMMTrieIterator> it =
+          store.Trie()->NewIterator(0, version, begin, end);
+      auto expected = first;
+      for (it->SeekToFirst(); it->Valid(); it->Next(), ++expected) {
+        ASSERT_NE(expected, last) << "extra key " << it->Key();
+        EXPECT_EQ(it->Key(), expected->first);
+        EXPECT_EQ(it->Value(), expected->second);
+      }
+      EXPECT_EQ(expected, last) << "version " << version << " from " << begin;
+
+      auto reverse = std::make_reverse_iterator(last);
+      for (it->SeekToLast(); it->Valid(); it->Prev(), ++reverse) {
+        ASSERT_NE(reverse, std::make_reverse_iterator(first));
+        EXPECT_EQ(it->Key(), reverse->first);
+      }
+      EXPECT_EQ(reverse, std::make_reverse_iterator(first));
+
+      std::string target = TestKey(1500);
+      it->Seek(target);
+      auto found = state.lower_bound(std::max(target, begin));
+      if (found == state.end() || found->first >= end) {
+        EXPECT_FALSE(it->Valid());
+      } else {
+        ASSERT_TRUE(it->Valid());
+        EXPECT_EQ(it->Key(), found->first);
+      }
+    }
+  }
+}
+
+// the iterator prefetches pages on its own thread while versions commit. a
+// prefetched page never replaces the cached page a commit is changing.
+TEST(DMMTrieTest, IteratorPrefetchKeepsCommittedPages) {
+  TestStore store;
+  // pages are evicted and prefetched again
+  store.Trie()->SetCacheBudget(1 << 20);
+  std::vector<std::string> keys = HexKeys(2000, 21);
+  std::vector<std::map<std::string, std::string>> states;
+  CommitVersionsOf(store.Trie(), keys, 5, 300, 22, false, &states);
+  std::unique_ptr<DMMTrieIterator> it =
+      store.Trie()->NewIterator(0, 5, "", "g");
+  std::mt19937_64 rng(23);
+  std::map<std::string, std::string> state = states[5];
+  int version = 5;
+  size_t scanned = 0;
+  for (it->SeekToFirst(); it->Valid(); it->Next(), scanned++) {
+    if (scanned % 100 != 0) {
+      continue;
+    }
+    version++;
+    for (int i = 0; i < 50; i++) {
+      std::string key = keys[rng() % keys.size()];
+      std::string value = "value_" + std::to_string(version) + "_" +
+                          std::to_string(i);
+      store.Trie()->Put(0, version, key, value);
+      state[key] = value;
+    }
+    store.Trie()->CalcRootHash(0, version);
+    states.push_back(state);
+  }
+  EXPECT_EQ(scanned, states[5].size());
+  it.reset();
+  for (int v = 1; v <= version; v++) {
+    for (const auto &[key, value] : states[v]) {
+      ASSERT_EQ(store.Trie()->Get(0, v, key), value)
+          << "version " << v << " key " << key;
+    }
+  }
+}
+
+// the versions from the oldest retained one on read the same values after
+// the data files with few of their values are collected
+TEST(DMMTrieTest, CollectGarbageKeepsRetainedVersions) {
+  TestStore store;
+  std::mt19937_64 rng(11);
+  std::vector<std::map<std::string, std::string>> states(1);
+  std::vector<std::string> roots(1);
+  for (int version = 1; version <= 50; version++) {
+    states.push_back(states.back());
+    for (int i = 0; i < 100; i++) {
+      std::string key = TestKey(rng() % 200);
+      std::string value = "value_" + std::to_string(version) + "_" +
+                          std::to_string(i) + std::string(25000, 'v');
+      store.Trie()->Put(0, version, key, value);
+      states[version][key] = value;
+    }
+    store.Trie()->CalcRootHash(0, version);
+    roots.push_back(store.Trie()->GetRootHash(0, version));
+  }
+  // only synced data files are collected
+  store.ValueStore()->WaitDurable(50);
+  EXPECT_GT(store.Trie()->CollectGarbage(0, 45), 0u);
+  for (int i = 0; i < 10000 && store.ValueStore()->GetGcStats().files == 0;
+       i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_GT(store.ValueStore()->GetGcStats().reclaimed_bytes, 0u);
+  for (int version = 45; version <= 50; version++) {
+    for (const auto &[key, value] : states[version]) {
+      ASSERT_EQ(store.Trie()->Get(0, version, key), value)
+          << "version " << version << " key " << key;
+    }
+    EXPECT_TRUE(store.Trie()->Verify(0, version, roots[version]));
+  }
+}
+
+// values of up to 16 bytes are kept in their leaves, which changes neither
+// the root hashes nor what is read
+TEST(DMMTrieTest, InlineValuesKeepRootsAndGets) {
+  TestStore plain("plain");
+  TestStore inlined("inlined");
+  inlined.Trie()->SetValueInlineSize(VDLS::kMaxInlineValueSize);
+  std::vector<std::map<std::string, std::string>> states;
+  std::vector<std::string> plain_roots =
+      CommitVersions(plain.Trie(), 10, 300, 12);
+  std::vector<std::string> inlined_roots =
+      CommitVersions(inlined.Trie(), 10, 300, 12, true, &states);
+  EXPECT_EQ(inlined_roots, plain_roots);
+  size_t inline_values = 0;
+  for (int version : {1, 10}) {
+    for (const auto &[key, value] : states[version]) {
+      inline_values += value.size() <= VDLS::kMaxInlineValueSize;
+      ASSERT_EQ(inlined.Trie()->Get(0, version, key), value)
+          << "version " << version << " key " << key;
+    }
+  }
+  EXPECT_GT(inline_values, 0u);
+}
+
+TEST(DMMTrieTest, ScrubberChecksRootHash) {
+  TestStore store;
+  std::vector<std::string> roots =
+      CommitVersions(store.Trie(), 10, 300, 14, false);
+  std::unique_ptr<DMMTrieScrubber> scrubber = store.Trie()->NewScrubber(
+      0, 10, roots[10], store.Path() + "/scrub_passed");
+  scrubber->SetRateLimit(0);
+  scrubber->Start();
+  DMMTrieScrubber::Status status = scrubber->Wait();
+  EXPECT_EQ(status.state, DMMTrieScrubber::State::kPassed) << status.error;
+  EXPECT_GT(status.pages, 0u);
+  EXPECT_GT(status.values, 0u);
+
+  scrubber = store.Trie()->NewScrubber(0, 10, roots[9],
+                                       store.Path() + "/scrub_diverged");
+  scrubber->SetRateLimit(0);
+  scrubber->Start();
+  status = scrubber->Wait();
+  EXPECT_EQ(status.state, DMMTrieScrubber::State::kDiverged);
+  EXPECT_FALSE(status.error.empty());
+}
+
+// a stopped scrub goes on from its checkpoint
+TEST(DMMTrieTest, ScrubberResumesFromCheckpoint) {
+  TestStore store;
+  std::vector<std::string> roots =
+      CommitVersions(store.Trie(), 10, 300, 15, false);
+  std::string checkpoint = store.Path() + "/scrub";
+  std::unique_ptr<DMMTrieScrubber> scrubber =
+      store.Trie()->NewScrubber(0, 10, roots[10], store.Path() + "/full");
+  scrubber->SetRateLimit(0);
+  scrubber->Start();
+  uint64_t total_pages = scrubber->Wait().pages;
+
+  scrubber = store.Trie()->NewScrubber(0, 10, roots[10], checkpoint);
+  scrubber->SetRateLimit(100);
+  scrubber->Start();
+  for (int i = 0; i < 10000 && scrubber->GetStatus().pages < 10; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  scrubber->Stop();
+  DMMTrieScrubber::Status status = scrubber->GetStatus();
+  EXPECT_EQ(status.state, DMMTrieScrubber::State::kIdle);
+  EXPECT_GT(status.pages, 0u);
+  EXPECT_LT(status.pages, total_pages);
+
+  scrubber = store.Trie()->NewScrubber(0, 10, roots[10], checkpoint);
+  scrubber->SetRateLimit(0);
+  EXPECT_GT(scrubber->GetStatus().pages, 0u);
+  scrubber->Start();
+  status = scrubber->Wait();
+  EXPECT_EQ(status.state, DMMTrieScrubber::State::kPassed) << status.error;
+  EXPECT_EQ(status.pages, total_pages);
+}
+
+// Wait and Stop on two threads join the scrub once, and the stopped scrub
+// leaves a complete checkpoint and no temporary file
+TEST(DMMTrieTest, ScrubberStopsWhileWaited) {
+  TestStore store;
+  std::vector<std::string> roots =
+      CommitVersionsOf(store.Trie(), HexKeys(1000, 24), 5, 300, 25);
+  std::string checkpoint = store.Path() + "/scrub";
+  std::unique_ptr<DMMTrieScrubber> scrubber =
+      store.Trie()->NewScrubber(0, 5, roots[5], checkpoint);
+  scrubber->SetRateLimit(100);
+  scrubber->Start();
+  DMMTrieScrubber::Status waited;
+  std::thread waiter([&]() { waited = scrubber->Wait(); });
+  for (int i = 0; i < 10000 && scrubber->GetStatus().pages < 5; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  scrubber->Stop();
+  waiter.join();
+  EXPECT_EQ(waited.state, DMMTrieScrubber::State::kIdle);
+  EXPECT_GT(waited.pages, 0u);
+  EXPECT_TRUE(std::filesystem::exists(checkpoint));
+  EXPECT_FALSE(std::filesystem::exists(checkpoint + ".tmp"));
+
+  scrubber = store.Trie()->NewScrubber(0, 5, roots[5], checkpoint);
+  EXPECT_EQ(scrubber->GetStatus().pages, waited.pages);
+  scrubber->SetRateLimit(0);
+  scrubber->Start();
+  std::thread stopper([&]() { scrubber->Stop(); });
+  DMMTrieScrubber::Status status = scrubber->Wait();
+  stopper.join();
+  EXPECT_NE(status.state, DMMTrieScrubber::State::kDiverged) << status.error;
+}
+
+// a parallel Verify agrees with the depth first one, also when its memory
+// budget makes it verify most pages depth first
+TEST(DMMTrieTest, ParallelVerifyMatchesSerial) {
+  TestStore store;
+  std::vector<std::string> roots =
+      CommitVersions(store.Trie(), 10, 300, 16, false);
+  for (size_t memory_bytes : {size_t(64) << 20, size_t(1)}) {
+    for (size_t num_threads : {1, 4}) {
+      store.Trie()->SetVerifyThreads(num_threads);
+      store.Trie()->SetVerifyBudget(memory_bytes, 0);
+      for (int version : {1, 10}) {
+        EXPECT_TRUE(store.Trie()->Verify(0, version, roots[version]))
+            << num_threads << " threads, version " << version;
+      }
+      EXPECT_FALSE(store.Trie()->Verify(0, 10, roots[9]))
+          << num_threads << " threads";
+    }
+  }
+}
+
+// the child pages of hex nibbles a to f are found below their own versions,
+// also for keys of mixed lengths and with deletes
+TEST(DMMTrieTest, VerifiesHexKeysOfMixedLengths) {
+  TestStore store;
+  std::vector<std::string> roots =
+      CommitVersionsOf(store.Trie(), HexKeys(2000, 19), 10, 300, 20);
+  for (size_t num_threads : {1, 4}) {
+    store.Trie()->SetVerifyThreads(num_threads);
+    for (int version = 1; version <= 10; version++) {
+      EXPECT_TRUE(store.Trie()->Verify(0, version, roots[version]))
+          << num_threads << " threads, version " << version;
+    }
+    EXPECT_FALSE(store.Trie()->Verify(0, 10, roots[9]))
+        << num_threads << " threads";
+  }
+}
@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "TestStore.hpp"
+
+namespace {
+
+// commits a few versions into the stores at path and closes them, which
+// writes the delta cache
+void WriteStore(const std::string &path) {
+  std::filesystem::create_directories(path + "/data");
+  LSVPS *page_store = new LSVPS(path);
+  VDLS *value_store = new VDLS(path + "/data/");
+  DMMTrie *trie = new DMMTrie(0, page_store, value_store);
+  page_store->RegisterTrie(trie);
+  for (int version = 1; version <= 5; version++) {
+    for (int i = 0; i < 100; i++) {
+      trie->Put(0, version, TestKey(i * 7 + version),
+                "value_" + std::to_string(version));
+    }
+    trie->CalcRootHash(0, version);
+  }
+  delete trie;
+  delete page_store;
+  delete value_store;
+}
+
+// overwrite the 4 bytes at offset from the end of file with value
+void PatchFromEnd(const std::string &file, size_t offset, uint32_t value) {
+  std::fstream out(file, std::ios::in | std::ios::out | std::ios::binary);
+  out.seekp(-static_cast<std::streamoff>(offset), std::ios::end);
+  out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// the message of the exception thrown by opening the page store at path
+std::string OpenError(const std::string &path) {
+  try {
+    LSVPS page_store(path);
+  } catch (const std::runtime_error &e) {
+    return e.what();
+  }
+  return "";
+}
+
+// the basepages of versions 1 to num_versions, walked down from the root
+// pages. a page shared by several versions is listed once.
+std::vector<PageKey> BasePageKeys(LSVPS *page_store, uint64_t num_versions) {
+  std::vector<PageKey> pagekeys, pending;
+  for (uint64_t version = 1; version <= num_versions; version++) {
+    pending.push_back({version, 0, false, ""});
+  }
+  std::set<std::pair<std::string, uint64_t>> visited;
+  while (!pending.empty()) {
+    PageKey pagekey = pending.back();
+    pending.pop_back();
+    std::shared_ptr<BasePage> page = page_store->LoadPage(pagekey);
+    if (!visited.insert({pagekey.pid, page->GetPageKey().version}).second) {
+      continue;
+    }
+    pagekeys.push_back(pagekey);
+    Node *root = page->GetRoot();
+    for (int i = 0; !root->IsLeaf() && i < static_cast<int>(DMM_NODE_FANOUT);
+         i++) {
+      Node *child = root->HasChild(i) ? root->GetChild(i) : nullptr;
+      for (int j = 0; child != nullptr && !child->IsLeaf() &&
+                      j < static_cast<int>(DMM_NODE_FANOUT);
+           j++) {
+        if (child->HasChild(j)) {
+          pending.push_back({child->GetChildVersion(j), 0, false,
+                             pagekey.pid + std::to_string(i) +
+                                 std::to_string(j)});
+        }
+      }
+    }
+  }
+  return pagekeys;
+}
+
+}  // namespace
+
+TEST(LSVPSTest, ReopensDeltaCache) {
+  TestDir dir;
+  WriteStore(dir.Path());
+  EXPECT_EQ(OpenError(dir.Path()), "");
+}
+
+// the delta cache ends with | hash id (4) | size (8) |
+TEST(LSVPSTest, RefusesAnotherHash) {
+  TestDir dir;
+  WriteStore(dir.Path());
+  uint32_t other_hash = TrieHash::kId == 1 ? 2 : 1;
+  PatchFromEnd(dir.Path() + "/delta_cache.dat", 12, other_hash);
+  std::string error = OpenError(dir.Path());
+  EXPECT_NE(error.find("was written with " + HashName(other_hash)),
+            std::string::npos)
+      << error;
+}
+
+// a page of an index file with a flipped byte fails the checked reads. the
+// page is the first one that is read through a view of its bytes, which come
+// from the index file.
+TEST(LSVPSTest, DetectsCorruptedPage) {
+  TestStore store;
+  for (int version = 1; version <= 10; version++) {
+    for (int i = 0; i < 300; i++) {
+      store.Trie()->Put(0, version, TestKey(i * 7 + version),
+                        "value_" + std::to_string(version));
+    }
+    store.Trie()->CalcRootHash(0, version);
+  }
+  store.Trie()->Flush(0, 10);
+  store.Trie()->SetChecksumVerify(ChecksumVerify::kAlways);
+  std::vector<char> page(PAGE_SIZE);
+  PageKey pagekey{0, 0, false, ""};
+  for (const PageKey &candidate : BasePageKeys(store.PageStore(), 10)) {
+    if (store.PageStore()->LoadPage(candidate, page.data()) == nullptr) {
+      pagekey = candidate;
+      break;
+    }
+  }
+  ASSERT_NE(pagekey.version, 0u);
+
+  std::string index_file = store.Path() + "/IndexFile/index_0.dat";
+  std::fstream file(index_file,
+                    std::ios::in | std::ios::out | std::ios::binary);
+  std::vector<char> buffer(PAGE_SIZE);
+  std::streamoff offset = 0;
+  while (file.read(buffer.data(), PAGE_SIZE) && buffer != page) {
+    offset += PAGE_SIZE;
+  }
+  ASSERT_EQ(buffer, page);
+  file.seekp(offset + 100);
+  file.put(static_cast<char>(page[100] ^ 0x20));
+  file.close();
+  try {
+    store.PageStore()->LoadPage(pagekey, buffer.data());
+    ADD_FAILURE() << "the corrupted page was read";
+  } catch (const std::runtime_error &e) {
+    EXPECT_NE(std::string(e.what()).find("Checksum mismatch"),
+              std::string::npos)
+        << e.what();
+  }
+
+  // only scrubs check the checksums
+  store.Trie()->SetChecksumVerify(ChecksumVerify::kScrub);
+  EXPECT_EQ(store.PageStore()->LoadPage(pagekey, buffer.data()), nullptr);
+}
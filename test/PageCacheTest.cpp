@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include "DMMTrie.hpp"
+#include "PageCache.hpp"
+
+namespace {
+
+// a page with a single leaf, its pid decides whether it is pinned
+std::shared_ptr<BasePage> NewPage(const std::string &pid) {
+  return std::make_shared<BasePage>(nullptr, "key", pid, "");
+}
+
+}  // namespace
+
+TEST(PageCacheTest, CountsHitsAndMisses) {
+  PageCache cache;
+  std::shared_ptr<BasePage> page = NewPage("0123");
+  cache.Put({1, 0, false, "0123"}, page);
+  EXPECT_EQ(cache.Get({1, 0, false, "0123"}), page);
+  EXPECT_EQ(cache.Get({2, 0, false, "0123"}), nullptr);
+  EXPECT_EQ(cache.Get({1, 0, false, "0124"}), nullptr);
+  PageCache::Stats stats = cache.GetStats();
+  EXPECT_EQ(stats.hits, 1u);
+  EXPECT_EQ(stats.misses, 2u);
+  EXPECT_EQ(stats.pages, 1u);
+  EXPECT_EQ(stats.bytes, page->GetMemorySize());
+}
+
+TEST(PageCacheTest, EvictsOverBudget) {
+  size_t page_size = NewPage("0123")->GetMemorySize();
+  PageCache cache(4 * page_size, 1);
+  for (uint64_t version = 1; version <= 20; version++) {
+    cache.Put({version, 0, false, "0123"}, NewPage("0123"));
+  }
+  PageCache::Stats stats = cache.GetStats();
+  EXPECT_LE(stats.bytes, 4 * page_size);
+  EXPECT_EQ(stats.pages + stats.evictions, 20u);
+  EXPECT_NE(cache.Get({20, 0, false, "0123"}), nullptr);
+
+  cache.SetBudget(1);
+  EXPECT_EQ(cache.GetStats().pages, 0u);
+}
+
+// only the latest version of a top level page is pinned
+TEST(PageCacheTest, PinsLatestTopLevelPages) {
+  PageCache cache(1, 1, 2);
+  cache.Put({1, 0, false, "01"}, NewPage("01"));
+  cache.Put({2, 0, false, "01"}, NewPage("01"));
+  cache.Put({1, 0, false, "0123"}, NewPage("0123"));
+  EXPECT_NE(cache.Get({2, 0, false, "01"}), nullptr);
+  EXPECT_EQ(cache.Get({1, 0, false, "01"}), nullptr);
+  EXPECT_EQ(cache.Get({1, 0, false, "0123"}), nullptr);
+
+  cache.SetPinnedLevels(1);
+  EXPECT_EQ(cache.Get({2, 0, false, "01"}), nullptr);
+}
+
+TEST(PageCacheTest, HoldsOnlyTheCachedPage) {
+  PageCache cache;
+  std::shared_ptr<BasePage> page = NewPage("0123");
+  std::shared_ptr<BasePage> other = NewPage("0123");
+  cache.Put({1, 0, false, "0123"}, page);
+  EXPECT_TRUE(cache.Holds({1, 0, false, "0123"}, page.get()));
+  EXPECT_FALSE(cache.Holds({1, 0, false, "0123"}, other.get()));
+  EXPECT_FALSE(cache.Holds({2, 0, false, "0123"}, page.get()));
+  PageCache::Stats stats = cache.GetStats();
+  EXPECT_EQ(stats.hits + stats.misses, 0u);
+
+  cache.Rekey({1, 0, false, "0123"}, {2, 0, false, "0123"});
+  EXPECT_TRUE(cache.Holds({2, 0, false, "0123"}, page.get()));
+  EXPECT_FALSE(cache.Holds({1, 0, false, "0123"}, page.get()));
+}
+
+// a page loaded by a reader does not replace the cached page
+TEST(PageCacheTest, PutIfAbsentKeepsCachedPage) {
+  PageCache cache;
+  std::shared_ptr<BasePage> cached = NewPage("0123");
+  std::shared_ptr<BasePage> loaded = NewPage("0123");
+  EXPECT_EQ(cache.PutIfAbsent({1, 0, false, "0123"}, cached), cached);
+  EXPECT_EQ(cache.PutIfAbsent({1, 0, false, "0123"}, loaded), cached);
+  EXPECT_EQ(cache.Get({1, 0, false, "0123"}), cached);
+  EXPECT_EQ(cache.GetStats().pages, 1u);
+
+  cache.Put({1, 0, false, "0123"}, loaded);
+  EXPECT_EQ(cache.Get({1, 0, false, "0123"}), loaded);
+}
@@ -0,0 +1,75 @@
+#ifndef _TEST_STORE_HPP_
+#define _TEST_STORE_HPP_
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+#include "DMMTrie.hpp"
+#include "LSVPS.hpp"
+#include "VDLS.hpp"
+
+// a fresh directory for the running test, removed with the object
+class TestDir {
+ public:
+  explicit TestDir(const std::string &suffix = "") {
+    const ::testing::TestInfo *info =
+        ::testing::UnitTest::GetInstance()->current_test_info();
+    path_ = (std::filesystem::temp_directory_path() / "letus_test" /
+             (std::string(info->test_suite_name()) + "." + info->name() +
+              suffix))
+                .string();
+    std::filesystem::remove_all(path_);
+    std::filesystem::create_directories(path_);
+  }
+  ~TestDir() { std::filesystem::remove_all(path_); }
+  TestDir(const TestDir &) = delete;
+  TestDir &operator=(const TestDir &) = delete;
+
+  const std::string &Path() const { return path_; }
+
+ private:
+  std::string path_;
+};
+
+// a trie with its page store and its value store in a TestDir, like
+// OpenLetus lays them out
+class TestStore {
+ public:
+  explicit TestStore(const std::string &suffix = "") : dir_(suffix) {
+    std::filesystem::create_directories(dir_.Path() + "/data");
+    page_store_ = new LSVPS(dir_.Path());
+    value_store_ = new VDLS(dir_.Path() + "/data/");
+    trie_ = new DMMTrie(0, page_store_, value_store_);
+    page_store_->RegisterTrie(trie_);
+  }
+  ~TestStore() {
+    delete trie_;
+    delete page_store_;
+    delete value_store_;
+  }
+  TestStore(const TestStore &) = delete;
+  TestStore &operator=(const TestStore &) = delete;
+
+  DMMTrie *Trie() { return trie_; }
+  LSVPS *PageStore() { return page_store_; }
+  VDLS *ValueStore() { return value_store_; }
+  const std::string &Path() const { return dir_.Path(); }
+
+ private:
+  TestDir dir_;
+  LSVPS *page_store_;
+  VDLS *value_store_;
+  DMMTrie *trie_;
+};
+
+// the key of number i, keys of a test share their length
+inline std::string TestKey(uint64_t i) {
+  char key[16];
+  snprintf(key, sizeof(key), "%06llu", static_cast<unsigned long long>(i));
+  return key;
+}
+
+#endif
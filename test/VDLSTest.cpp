@@ -0,0 +1,523 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "TestStore.hpp"
+
+namespace {
+
+typedef std::tuple<uint64_t, uint64_t, uint64_t> Location;
+
+// the bytes of the record at location in the data files under path
+std::string ReadRecord(const std::string &path, const Location &location) {
+  std::ifstream in(
+      path + "data_file_" + std::to_string(std::get<0>(location)) + ".dat",
+      std::ios::binary);
+  std::string record(std::get<2>(location), '\0');
+  in.seekg(std::get<1>(location));
+  in.read(&record[0], record.size());
+  return record;
+}
+
+// flip a byte of the data file fileID under path
+void CorruptByte(const std::string &path, uint64_t fileID, uint64_t offset) {
+  int fd = open((path + "data_file_" + std::to_string(fileID) + ".dat").c_str(),
+                O_RDWR);
+  ASSERT_NE(fd, -1);
+  char byte;
+  ASSERT_EQ(pread(fd, &byte, 1, offset), 1);
+  byte ^= 0x20;
+  ASSERT_EQ(pwrite(fd, &byte, 1, offset), 1);
+  close(fd);
+}
+
+// a value of about 1MB that tells i apart, 64 of them fill a data file
+std::string LargeValue(size_t i) {
+  return std::string(1 << 20, static_cast<char>('a' + i % 26)) +
+         std::to_string(i);
+}
+
+}  // namespace
+
+// values with the separators of the old text format and binary bytes
+TEST(VDLSTest, RoundTripsAnyBytes) {
+  TestDir dir;
+  std::string path = dir.Path() + "/";
+  VDLS store(path);
+  std::vector<std::string> values = {
+      "plain value", "comma,separated,value", "two\nlines\n",
+      std::string("zero\0bytes\0", 11), std::string(5000, '\xff')};
+  std::vector<Location> locations;
+  for (size_t i = 0; i < values.size(); i++) {
+    locations.push_back(store.WriteValue(7, "key,\n" + std::to_string(i),
+                                         values[i]));
+  }
+  for (size_t i = 0; i < values.size(); i++) {
+    EXPECT_EQ(store.ReadValue(locations[i]), values[i]) << "value " << i;
+    EXPECT_EQ(store.ReadValueView(locations[i]).value, values[i]);
+    EXPECT_TRUE(store.VerifyRecord(locations[i]));
+  }
+}
+
+// | version (8) | key_size (4) | value_size (4) | crc32c (4) | key | value |
+TEST(VDLSTest, WritesLengthPrefixedRecords) {
+  TestDir dir;
+  std::string path = dir.Path() + "/";
+  VDLS store(path);
+  std::string key = "some key";
+  std::string value = "some value\n";
+  Location location = store.WriteValue(42, key, value);
+  ASSERT_EQ(std::get<2>(location),
+            VDLS::kRecordHeaderSize + key.size() + value.size());
+  std::string record = ReadRecord(path, location);
+  uint64_t version;
+  uint32_t key_size, value_size, checksum;
+  memcpy(&version, record.data(), sizeof(version));
+  memcpy(&key_size, record.data() + 8, sizeof(key_size));
+  memcpy(&value_size, record.data() + 12, sizeof(value_size));
+  memcpy(&checksum, record.data() + 16, sizeof(checksum));
+  EXPECT_EQ(version, 42u);
+  EXPECT_EQ(key_size, key.size());
+  EXPECT_EQ(value_size, value.size());
+  EXPECT_EQ(record.substr(VDLS::kRecordHeaderSize), key + value);
+  EXPECT_EQ(checksum,
+            Crc32cExtend(Crc32c(record.data(), 16),
+                         record.data() + VDLS::kRecordHeaderSize,
+                         key.size() + value.size()));
+}
+
+TEST(VDLSTest, DetectsCorruptedRecord) {
+  TestDir dir;
+  std::string path = dir.Path() + "/";
+  VDLS store(path);
+  store.SetChecksumVerify(ChecksumVerify::kAlways, 0);
+  Location first = store.WriteValue(1, "first", "the first value");
+  Location second = store.WriteValue(1, "second", "the second value");
+  CorruptByte(path, std::get<0>(second), std::get<1>(second) +
+                                             std::get<2>(second) - 1);
+  EXPECT_TRUE(store.VerifyRecord(first));
+  EXPECT_FALSE(store.VerifyRecord(second));
+  EXPECT_EQ(store.ReadValue(first), "the first value");
+  EXPECT_THROW(store.ReadValue(second), std::runtime_error);
+}
+
+// reads of values spread over several data files, with room for the read
+// mapping of one older data file only
+TEST(VDLSTest, ReadsAcrossDataFiles) {
+  TestDir dir;
+  VDLS store(dir.Path() + "/");
+  store.SetReadMapBudget(1, 1ULL << 30);
+  std::vector<Location> locations;
+  for (size_t i = 0; i < 200; i++) {
+    locations.push_back(store.WriteValue(i, TestKey(i), LargeValue(i)));
+  }
+  ASSERT_GE(std::get<0>(locations.back()), 3u);
+  // 37 is prime to 200, so every value is read in an order that jumps
+  // between the data files
+  for (size_t i = 0; i < locations.size(); i++) {
+    size_t j = i * 37 % locations.size();
+    ASSERT_EQ(store.ReadValue(locations[j]), LargeValue(j)) << "value " << j;
+  }
+}
+
+// a batch is laid out like the values written one by one, also when it
+// goes on in the next data file
+TEST(VDLSTest, WriteValuesMatchesWriteValue) {
+  TestDir single_dir("single");
+  TestDir batch_dir("batch");
+  VDLS single(single_dir.Path() + "/");
+  VDLS batch(batch_dir.Path() + "/");
+  std::vector<std::string> keys, values;
+  for (size_t i = 0; i < 100; i++) {
+    keys.push_back(TestKey(i));
+    values.push_back(i % 4 == 0 ? "small value " + std::to_string(i)
+                                : LargeValue(i));
+  }
+  std::vector<Location> single_locations;
+  std::vector<std::pair<const std::string *, const std::string *>> records;
+  for (size_t i = 0; i < keys.size(); i++) {
+    single_locations.push_back(single.WriteValue(3, keys[i], values[i]));
+    records.emplace_back(&keys[i], &values[i]);
+  }
+  std::vector<Location> batch_locations = batch.WriteValues(3, records);
+  EXPECT_EQ(batch_locations, single_locations);
+  ASSERT_GE(std::get<0>(batch_locations.back()), 1u);
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(batch.ReadValue(batch_locations[i]), values[i]) << "value " << i;
+    EXPECT_TRUE(batch.VerifyRecord(batch_locations[i]));
+  }
+}
+
+// the background thread keeps the next data file ready. a full data file is
+// truncated to its records, and the prepared one is removed on close.
+TEST(VDLSTest, RollOverToPreparedDataFile) {
+  TestDir dir;
+  std::string path = dir.Path() + "/";
+  auto data_file = [&](uint64_t fileID) {
+    return path + "data_file_" + std::to_string(fileID) + ".dat";
+  };
+  std::vector<Location> locations;
+  {
+    VDLS store(path);
+    for (size_t i = 0; i < 150; i++) {
+      locations.push_back(store.WriteValue(i, TestKey(i), LargeValue(i)));
+    }
+    ASSERT_EQ(std::get<0>(locations.back()), 2u);
+    for (int i = 0; i < 1000 && !std::filesystem::exists(data_file(3)); i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(std::filesystem::exists(data_file(3)));
+    for (size_t i = 0; i < locations.size(); i += 10) {
+      ASSERT_EQ(store.ReadValue(locations[i]), LargeValue(i));
+    }
+  }
+  EXPECT_FALSE(std::filesystem::exists(data_file(3)));
+  for (uint64_t fileID = 0; fileID < 2; fileID++) {
+    uint64_t length = 0;
+    for (const Location &location : locations) {
+      if (std::get<0>(location) == fileID) {
+        length = std::get<1>(location) + std::get<2>(location);
+      }
+    }
+    EXPECT_EQ(std::filesystem::file_size(data_file(fileID)), length);
+  }
+
+  VDLS store(path);
+  Location location = store.WriteValue(150, TestKey(150), LargeValue(150));
+  EXPECT_EQ(std::get<0>(location), 2u);
+  EXPECT_EQ(std::get<1>(location),
+            std::get<1>(locations.back()) + std::get<2>(locations.back()));
+  for (size_t i = 0; i < locations.size(); i += 10) {
+    ASSERT_EQ(store.ReadValue(locations[i]), LargeValue(i));
+  }
+}
+
+TEST(VDLSTest, DurableVersionFollowsPolicy) {
+  TestDir dir;
+  std::string path = dir.Path() + "/";
+  {
+    VDLS store(path);
+    store.SetDurability(VDLS::DurabilityPolicy::kGroupCommit);
+    for (uint64_t version = 1; version <= 5; version++) {
+      store.WriteValue(version, TestKey(version), LargeValue(version));
+      store.CommitVersion(version);
+    }
+    store.WaitDurable(5);
+    EXPECT_EQ(store.GetDurableVersion(), 5u);
+
+    // without a policy a version is only synced when waited for
+    store.SetDurability(VDLS::DurabilityPolicy::kNone);
+    store.WriteValue(6, TestKey(6), LargeValue(6));
+    store.CommitVersion(6);
+    EXPECT_EQ(store.GetDurableVersion(), 5u);
+    store.WaitDurable(10);
+    EXPECT_EQ(store.GetDurableVersion(), 6u);
+
+    store.SetDurability(VDLS::DurabilityPolicy::kInterval, 1);
+    store.WriteValue(7, TestKey(7), LargeValue(7));
+    store.CommitVersion(7);
+    for (int i = 0; i < 1000 && store.GetDurableVersion() < 7; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(store.GetDurableVersion(), 7u);
+    store.WriteValue(8, TestKey(8), LargeValue(8));
+    store.CommitVersion(8);
+  }
+  // the values written last are synced on close
+  VDLS store(path);
+  EXPECT_EQ(store.GetDurableVersion(), 8u);
+}
+
+// a child process commits versions under no durability policy, so that the
+// manifest lags behind the records and the data files it rolled over to, and
+// is killed. the reopened store reads every value the child handed out and
+// writes behind them.
+TEST(VDLSTest, RecoversValuesAfterKill) {
+  TestDir dir;
+  std::string path = dir.Path() + "/";
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  pid_t pid = fork();
+  ASSERT_NE(pid, -1);
+  if (pid == 0) {
+    close(fds[0]);
+    VDLS store(path);
+    for (uint64_t version = 1; version <= 100; version++) {
+      Location location =
+          store.WriteValue(version, TestKey(version), LargeValue(version));
+      store.CommitVersion(version);
+      if (write(fds[1], &location, sizeof(location)) != sizeof(location)) {
+        _exit(1);
+      }
+    }
+    kill(getpid(), SIGKILL);
+  }
+  close(fds[1]);
+  std::vector<Location> locations;
+  Location location;
+  while (read(fds[0], &location, sizeof(location)) == sizeof(location)) {
+    locations.push_back(location);
+  }
+  close(fds[0]);
+  int status;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+  ASSERT_EQ(locations.size(), 100u);
+  ASSERT_GE(std::get<0>(locations.back()), 1u);
+
+  VDLS store(path);
+  Location next = store.WriteValue(101, TestKey(101), LargeValue(101));
+  EXPECT_EQ(next, Location(std::get<0>(locations.back()),
+                           std::get<1>(locations.back()) +
+                               std::get<2>(locations.back()),
+                           std::get<2>(next)));
+  for (size_t i = 0; i < locations.size(); i++) {
+    ASSERT_EQ(store.ReadValue(locations[i]), LargeValue(i + 1))
+        << "version " << i + 1;
+  }
+  EXPECT_EQ(store.ReadValue(next), LargeValue(101));
+}
+
+// equal values written one by one and within a batch share one record
+TEST(VDLSTest, DeduplicatesEqualValues) {
+  TestDir dir;
+  VDLS store(dir.Path() + "/");
+  store.SetDedup(1024);
+  std::string value(100, 'd');
+  std::string small_value = "short";
+  Location first = store.WriteValue(1, "a", value);
+  EXPECT_EQ(store.WriteValue(2, "b", value), first);
+  EXPECT_NE(store.WriteValue(2, "c", small_value),
+            store.WriteValue(2, "d", small_value));
+  VDLS::DedupStats stats = store.GetDedupStats();
+  EXPECT_EQ(stats.hits, 1u);
+  EXPECT_EQ(stats.saved_bytes, std::get<2>(first));
+
+  std::string other(200, 'e');
+  std::vector<std::string> keys = {"e", "f", "g", "h"};
+  std::vector<std::pair<const std::string *, const std::string *>> records = {
+      {&keys[0], &other}, {&keys[1], &value}, {&keys[2], &other},
+      {&keys[3], &other}};
+  std::vector<Location> locations = store.WriteValues(3, records);
+  EXPECT_EQ(locations[1], first);
+  EXPECT_NE(locations[0], first);
+  EXPECT_EQ(locations[2], locations[0]);
+  EXPECT_EQ(locations[3], locations[0]);
+  stats = store.GetDedupStats();
+  EXPECT_EQ(stats.hits, 4u);
+  EXPECT_EQ(stats.saved_bytes,
+            2 * std::get<2>(first) + 2 * std::get<2>(locations[0]));
+  EXPECT_EQ(store.ReadValue(locations[3]), other);
+}
+
+// a retired data file is rewritten as compressed blocks in the background,
+// its values are read from them before and after a reopen
+TEST(VDLSTest, ReadsCompressedDataFiles) {
+  TestDir dir;
+  std::string path = dir.Path() + "/";
+  CompressionCodec codec = CompressionCodec::kNone;
+  for (CompressionCodec built_in : {CompressionCodec::kLz4,
+                                    CompressionCodec::kZstd,
+                                    CompressionCodec::kZlib}) {
+    if (CodecAvailable(built_in)) {
+      codec = built_in;
+      break;
+    }
+  }
+  if (codec == CompressionCodec::kNone) {
+    GTEST_SKIP() << "no compression codec is built in";
+  }
+  std::vector<Location> locations;
+  {
+    VDLS store(path);
+    ASSERT_TRUE(store.SetCompression(codec, 32 * 1024));
+    for (size_t i = 0; i < 70; i++) {
+      locations.push_back(store.WriteValue(i, TestKey(i), LargeValue(i)));
+    }
+    ASSERT_EQ(std::get<0>(locations.back()), 1u);
+    for (int i = 0;
+         i < 10000 && std::filesystem::exists(path + "data_file_0.dat"); i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_TRUE(std::filesystem::exists(path + "data_file_0.cdat"));
+    EXPECT_LT(std::filesystem::file_size(path + "data_file_0.cdat"),
+              std::get<1>(locations.back()));
+    for (size_t i = 0; i < locations.size(); i++) {
+      ASSERT_EQ(store.ReadValue(locations[i]), LargeValue(i)) << "value " << i;
+    }
+  }
+  VDLS store(path);
+  for (size_t i = 0; i < locations.size(); i++) {
+    ASSERT_EQ(store.ReadValue(locations[i]), LargeValue(i)) << "value " << i;
+    EXPECT_TRUE(store.VerifyRecord(locations[i]));
+  }
+}
+
+// a retired data file with few live records is rewritten with them only
+TEST(VDLSTest, CollectsDeadRecords) {
+  TestDir dir;
+  std::string path = dir.Path() + "/";
+  std::vector<Location> locations;
+  // all records of data file 1 and every tenth one of data file 0 are live
+  auto is_live = [&](size_t i) {
+    return std::get<0>(locations[i]) == 1 ||
+           (std::get<0>(locations[i]) == 0 && i % 10 == 0);
+  };
+  {
+    VDLS store(path);
+    for (size_t i = 0; i < 130; i++) {
+      locations.push_back(store.WriteValue(i, TestKey(i), LargeValue(i)));
+    }
+    store.CommitVersion(130);
+    store.WaitDurable(130);
+    ASSERT_EQ(std::get<0>(locations.back()), 2u);
+    VDLS::LiveRecords live;
+    for (size_t i = 0; i < locations.size(); i++) {
+      if (is_live(i)) {
+        live[std::get<0>(locations[i])].emplace_back(
+            std::get<1>(locations[i]), std::get<2>(locations[i]));
+      }
+    }
+    EXPECT_EQ(store.CollectGarbage(live), 1u);
+    for (int i = 0; i < 10000 && store.GetGcStats().files == 0; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    VDLS::GcStats stats = store.GetGcStats();
+    EXPECT_EQ(stats.files, 1u);
+    EXPECT_GT(stats.reclaimed_bytes, 50u << 20);
+    EXPECT_FALSE(std::filesystem::exists(path + "data_file_0.dat"));
+    EXPECT_TRUE(std::filesystem::exists(path + "data_file_1.dat"));
+  }
+  VDLS store(path);
+  for (size_t i = 0; i < locations.size(); i++) {
+    if (is_live(i)) {
+      ASSERT_EQ(store.ReadValue(locations[i]), LargeValue(i)) << "value " << i;
+    }
+  }
+}
+
+// batches of neighbouring and scattered locations over several data files,
+// read by the caller alone and with read threads. the pages of the retired
+// data file are dropped from memory first, so that they are read from disk.
+TEST(VDLSTest, BatchReadsMatchReadValue) {
+  TestDir dir;
+  std::string path = dir.Path() + "/";
+  VDLS store(path);
+  auto value_of = [](size_t i) {
+    return i % 4 == 0 ? LargeValue(i)
+                      : "value " + std::to_string(i) +
+                            std::string(i % 100, 'r');
+  };
+  std::vector<Location> written;
+  for (size_t i = 0; i < 300; i++) {
+    written.push_back(store.WriteValue(i, TestKey(i), value_of(i)));
+  }
+  store.CommitVersion(300);
+  store.WaitDurable(300);
+  ASSERT_GE(std::get<0>(written.back()), 1u);
+  int fd = open((path + "data_file_0.dat").c_str(), O_RDONLY);
+  ASSERT_NE(fd, -1);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+
+  std::vector<Location> locations;
+  std::vector<std::string> expected;
+  for (size_t i = 0; i < 600; i++) {
+    locations.push_back(written[i * 7 % written.size()]);
+    expected.push_back(value_of(i * 7 % written.size()));
+  }
+  for (size_t num_threads : {4, 0}) {
+    store.SetReadThreads(num_threads);
+    EXPECT_EQ(store.ReadValues(locations), expected) << num_threads;
+    std::vector<std::string> values;
+    store.ReadValuesAsync(locations, values)->Wait();
+    EXPECT_EQ(values, expected) << num_threads;
+  }
+  for (size_t i = 0; i < locations.size(); i++) {
+    ASSERT_EQ(store.ReadValue(locations[i]), expected[i]);
+  }
+
+  Location wrong_size = written[1];
+  std::get<2>(wrong_size)++;
+  std::vector<std::string> values;
+  EXPECT_THROW(store.ReadValuesAsync({written[0], wrong_size}, values)->Wait(),
+               std::runtime_error);
+}
+
+// every other record is read, so each one is a run of its own and the read
+// threads take more runs than kReadRingDepth
+TEST(VDLSTest, ReadsBatchesOfManyRuns) {
+  TestDir dir;
+  std::string path = dir.Path() + "/";
+  VDLS store(path);
+  std::vector<Location> written;
+  std::vector<std::string> values_written;
+  for (size_t i = 0; i < 400; i++) {
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", i * 0x9e3779b97f4a7c15ULL);
+    std::string value(VDLS::kReadCoalesceGap + i * 37 % 2048,
+                      "0123456789abcdef"[i % 16]);
+    values_written.push_back(value + std::to_string(i));
+    written.push_back(store.WriteValue(
+        i, std::string(key, 1 + i % 16), values_written.back()));
+  }
+  store.CommitVersion(400);
+  store.WaitDurable(400);
+  int fd = open((path + "data_file_0.dat").c_str(), O_RDONLY);
+  ASSERT_NE(fd, -1);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+
+  std::vector<Location> locations;
+  std::vector<std::string> expected;
+  for (size_t i = 0; i < written.size(); i += 2) {
+    locations.push_back(written[i]);
+    expected.push_back(values_written[i]);
+  }
+  ASSERT_GT(locations.size(), 4 * VDLS::kReadRingDepth);
+  for (size_t num_threads : {1, 4}) {
+    store.SetReadThreads(num_threads);
+    EXPECT_EQ(store.ReadValues(locations), expected) << num_threads;
+
+    // a wrong location fails its batch, the read threads go on
+    std::vector<Location> wrong = locations;
+    std::get<2>(wrong[wrong.size() / 2])++;
+    std::vector<std::string> values;
+    EXPECT_THROW(store.ReadValuesAsync(wrong, values)->Wait(),
+                 std::runtime_error);
+    store.ReadValuesAsync(locations, values)->Wait();
+    EXPECT_EQ(values, expected) << num_threads;
+  }
+}
+
+// a short value is kept in its location and no record is written for it
+TEST(VDLSTest, KeepsShortValuesInline) {
+  TestDir dir;
+  VDLS store(dir.Path() + "/");
+  store.SetInlineValueSize(VDLS::kMaxInlineValueSize);
+  std::vector<std::string> values = {"", "10", std::string("a\0b", 3),
+                                     std::string(16, 'i')};
+  for (const std::string &value : values) {
+    Location location = store.WriteValue(1, "key", value);
+    EXPECT_TRUE(VDLS::IsInline(location));
+    EXPECT_EQ(store.ReadValue(location), value);
+    EXPECT_EQ(store.ReadValueView(location).value, value);
+    EXPECT_TRUE(store.VerifyRecord(location));
+  }
+  Location location = store.WriteValue(1, "key", std::string(17, 'r'));
+  EXPECT_FALSE(VDLS::IsInline(location));
+  EXPECT_EQ(location, Location(0, 0, VDLS::kRecordHeaderSize + 3 + 17));
+}
@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+
+#include "WorkStealingPool.hpp"
+
+namespace {
+
+// spawn a binary tree of tasks of the given depth, each one counts itself
+void SpawnTree(WorkStealingPool &pool, int depth, std::atomic<int> &tasks) {
+  tasks++;
+  if (depth == 0) {
+    return;
+  }
+  for (int i = 0; i < 2; i++) {
+    pool.Spawn([&pool, depth, &tasks]() { SpawnTree(pool, depth - 1, tasks); });
+  }
+}
+
+}  // namespace
+
+TEST(WorkStealingPoolTest, RunsEverySpawnedTask) {
+  for (size_t num_threads : {0, 1, 4}) {
+    WorkStealingPool pool(num_threads);
+    EXPECT_EQ(pool.Size(), num_threads == 0 ? 1u : num_threads);
+    for (int job = 0; job < 3; job++) {
+      std::atomic<int> tasks(0);
+      pool.Run([&]() { SpawnTree(pool, 10, tasks); });
+      EXPECT_EQ(tasks.load(), (1 << 11) - 1) << num_threads << " threads";
+    }
+  }
+}
+
+// the first exception is rethrown by Run and the pool runs the next job
+TEST(WorkStealingPoolTest, RethrowsTaskException) {
+  WorkStealingPool pool(4);
+  std::atomic<int> tasks(0);
+  auto job = [&]() {
+    for (int i = 0; i < 100; i++) {
+      pool.Spawn([&, i]() {
+        tasks++;
+        if (i == 50) {
+          throw std::runtime_error("task failed");
+        }
+      });
+    }
+  };
+  EXPECT_THROW(pool.Run(job), std::runtime_error);
+
+  tasks = 0;
+  pool.Run([&]() { SpawnTree(pool, 5, tasks); });
+  EXPECT_EQ(tasks.load(), (1 << 6) - 1);
+}